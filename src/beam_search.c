@@ -0,0 +1,314 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "beam_search.h"
+
+/*
+* The generated characters of the beams form a tree, a beam refers
+* to its last character. Beams that share history share the nodes,
+* so forking a beam never copies its history.
+*/
+typedef struct beam_token_t {
+  struct beam_token_t *parent;
+  int refs;
+  int length;
+  char symbol;
+} beam_token_t;
+
+typedef struct beam_t {
+  beam_token_t *tokens;
+  double score;       // Summed log probability
+  int index;          // Feature index of the last character, the next input
+  int row;            // Row in the batch holding the state of this beam
+} beam_t;
+
+typedef struct beam_candidate_t {
+  int beam;
+  int index;
+  double score;
+} beam_candidate_t;
+
+static beam_token_t* beam_token_new(beam_token_t *parent, char symbol)
+{
+  beam_token_t *token = e_calloc(1, sizeof(beam_token_t));
+
+  token->parent = parent;
+  token->refs = 1;
+  token->symbol = symbol;
+  token->length = parent != NULL ? parent->length + 1 : 1;
+  if ( parent != NULL )
+    parent->refs++;
+
+  return token;
+}
+
+static void beam_token_release(beam_token_t *token)
+{
+  while ( token != NULL && --token->refs == 0 ) {
+    beam_token_t *parent = token->parent;
+    free(token);
+    token = parent;
+  }
+}
+
+static double beam_normalized(double score, int length, double length_penalty)
+{
+  if ( length_penalty == 0.0 )
+    return score;
+  return score / pow((5.0 + length) / 6.0, length_penalty);
+}
+
+// Keep the best candidates in descending order, candidates holds up to max
+static void beam_candidate_insert(beam_candidate_t *candidates, int *count, int max,
+  int beam, int index, double score)
+{
+  int k = *count;
+
+  if ( k == max ) {
+    if ( score <= candidates[max - 1].score )
+      return;
+    --k;
+  }
+
+  while ( k > 0 && candidates[k - 1].score < score ) {
+    candidates[k] = candidates[k - 1];
+    --k;
+  }
+
+  candidates[k].beam = beam;
+  candidates[k].index = index;
+  candidates[k].score = score;
+
+  if ( *count < max )
+    (*count)++;
+}
+
+int lstm_beam_search(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *seed, int width, int length, double length_penalty, int stop,
+  writer_t *writer)
+{
+  lstm_batch_t *batch;
+  beam_t *beams, *next_beams, *tmp_beams, best;
+  beam_candidate_t *candidates, *beam_top;
+  int *indices, *row_claimed;
+  int Y = model_layers[0]->Y;
+  double temperature = model_layers[0]->params->softmax_temp;
+  double best_normalized = 0.0;
+  int live = 1, finished = 0, t, b, k, n, r;
+  char *output;
+  size_t i;
+
+  if ( width <= 0 || length <= 0 )
+    return -1;
+
+  batch = lstm_batch_init(model_layers, layers, width);
+  beams = e_calloc(width, sizeof(beam_t));
+  next_beams = e_calloc(width, sizeof(beam_t));
+  candidates = e_calloc(width, sizeof(beam_candidate_t));
+  beam_top = e_calloc(width, sizeof(beam_candidate_t));
+  indices = e_calloc(width, sizeof(int));
+  row_claimed = e_calloc(width, sizeof(int));
+  output = e_calloc(length + 1, sizeof(char));
+
+  memset(&best, 0, sizeof(best));
+
+  // Feed the seed through the first row, the rest of it is the last input
+  i = 0;
+  indices[0] = 0;
+  while ( seed[i] != '\0' ) {
+    indices[0] = set_char_to_indx(set, seed[i]);
+    if ( seed[i + 1] != '\0' )
+      lstm_batch_step(batch, indices, 1);
+    ++i;
+  }
+
+  beams[0].tokens = NULL;
+  beams[0].score = 0.0;
+  beams[0].index = indices[0];
+  beams[0].row = 0;
+
+  t = 0;
+  while ( t < length && live > 0 ) {
+    double *logits;
+    int count = 0, next_live = 0;
+
+    b = 0;
+    while ( b < live ) {
+      indices[beams[b].row] = beams[b].index;
+      ++b;
+    }
+
+    logits = lstm_batch_step(batch, indices, live);
+
+    // The best continuations of each beam, then the best among those
+    b = 0;
+    while ( b < live ) {
+      double *row = &logits[beams[b].row * Y];
+      double max = row[0], sum = 0.0, log_sum;
+      int top = 0;
+
+      n = 0;
+      while ( n < Y ) {
+        if ( row[n] > max )
+          max = row[n];
+        ++n;
+      }
+      n = 0;
+      while ( n < Y ) {
+        sum += exp((row[n] - max) / temperature);
+        ++n;
+      }
+      log_sum = max / temperature + log(sum);
+
+      n = 0;
+      while ( n < Y ) {
+        beam_candidate_insert(beam_top, &top, width, b, n, row[n] / temperature - log_sum);
+        ++n;
+      }
+
+      k = 0;
+      while ( k < top ) {
+        beam_candidate_insert(candidates, &count, width, b,
+          beam_top[k].index, beams[b].score + beam_top[k].score);
+        ++k;
+      }
+      ++b;
+    }
+
+    k = 0;
+    while ( k < count ) {
+      beam_t *parent = &beams[candidates[k].beam];
+      char symbol = set_indx_to_char(set, candidates[k].index);
+      beam_token_t *token = beam_token_new(parent->tokens, symbol);
+      double normalized = beam_normalized(candidates[k].score, token->length, length_penalty);
+
+      if ( stop >= 0 && symbol == (char) stop ) {
+        // A finished hypothesis
+        if ( finished == 0 || normalized > best_normalized ) {
+          beam_token_release(best.tokens);
+          best.tokens = token;
+          best_normalized = normalized;
+        } else {
+          beam_token_release(token);
+        }
+        ++finished;
+      } else {
+        next_beams[next_live].tokens = token;
+        next_beams[next_live].score = candidates[k].score;
+        next_beams[next_live].index = candidates[k].index;
+        next_beams[next_live].row = candidates[k].beam;   // parent, resolved below
+        ++next_live;
+      }
+      ++k;
+    }
+
+    /*
+    * Rows are only copied when a beam forks. The first child of a beam
+    * takes over its row, the other children get a copy in a free row.
+    * Rows of beams without children are free.
+    */
+    memset(row_claimed, 0, width * sizeof(int));
+
+    b = 0;
+    while ( b < next_live ) {
+      int parent_row = beams[next_beams[b].row].row;
+      if ( parent_row < next_live && !row_claimed[parent_row] ) {
+        row_claimed[parent_row] = 1;
+        next_beams[b].row = parent_row;
+      } else {
+        next_beams[b].row = -1 - parent_row;
+      }
+      ++b;
+    }
+
+    r = 0;
+    b = 0;
+    while ( b < next_live ) {
+      if ( next_beams[b].row < 0 ) {
+        int parent_row = -1 - next_beams[b].row;
+        while ( row_claimed[r] )
+          ++r;
+        row_claimed[r] = 1;
+        lstm_batch_copy_row(batch, r, parent_row);
+        next_beams[b].row = r;
+      }
+      ++b;
+    }
+
+    b = 0;
+    while ( b < live ) {
+      beam_token_release(beams[b].tokens);
+      ++b;
+    }
+
+    tmp_beams = beams;
+    beams = next_beams;
+    next_beams = tmp_beams;
+    live = next_live;
+
+    if ( finished >= width )
+      break;
+
+    ++t;
+  }
+
+  // The best hypothesis, finished or not
+  b = 0;
+  while ( b < live ) {
+    if ( beams[b].tokens != NULL ) {
+      double normalized = beam_normalized(beams[b].score, beams[b].tokens->length, length_penalty);
+      if ( best.tokens == NULL || normalized > best_normalized ) {
+        beam_token_release(best.tokens);
+        best.tokens = beams[b].tokens;
+        best.tokens->refs++;
+        best_normalized = normalized;
+      }
+    }
+    beam_token_release(beams[b].tokens);
+    ++b;
+  }
+
+  writer_write(writer, seed, strlen(seed));
+  if ( best.tokens != NULL ) {
+    beam_token_t *token = best.tokens;
+    int len = token->length;
+
+    while ( token != NULL ) {
+      output[token->length - 1] = token->symbol;
+      token = token->parent;
+    }
+    writer_write(writer, output, len);
+    beam_token_release(best.tokens);
+  }
+
+  lstm_batch_free(batch);
+  free(beams);
+  free(next_beams);
+  free(candidates);
+  free(beam_top);
+  free(indices);
+  free(row_claimed);
+  free(output);
+
+  return 0;
+}
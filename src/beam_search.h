@@ -0,0 +1,61 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file beam_search.h
+    \brief Beam search decoding
+
+    Instead of sampling one feature at a time, the most likely
+    continuations of a seed are searched for. All beams are
+    advanced together, one row each in a \ref lstm_batch_t.
+*/
+
+#ifndef LSTM_BEAM_SEARCH_H
+#define LSTM_BEAM_SEARCH_H
+
+#include "lstm.h"
+#include "set.h"
+#include "utilities.h"
+
+/**
+* Write the most likely continuation of a seed, found with beam search.
+*
+* Hypotheses are ranked by their summed log probability divided by
+* ((5 + length) / 6) ^ length_penalty, so that hypotheses ending
+* early on \p stop can be compared with longer ones.
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @param set The feature-to-index mapping.
+* @param seed input seed, may be empty
+* @param width number of beams
+* @param length maximum number of characters to generate
+* @param length_penalty exponent of the length normalization, 0 disables it
+* @param stop a hypothesis ends when it produces this character, \
+negative to only stop at \p length
+* @param writer the seed followed by the best continuation is written here
+* @return 0 on success, negative values on errors
+*/
+int lstm_beam_search(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *seed, int width, int length, double length_penalty, int stop,
+  writer_t *writer);
+
+#endif
@@ -0,0 +1,401 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "checkpoint.h"
+#include "delta.h"
+#include "trace.h"
+
+#ifndef WINDOWS
+#include <pthread.h>
+#endif
+
+/* Copy of the weights, as much of a layer as lstm_store needs */
+typedef struct checkpoint_snapshot_t {
+  lstm_model_t *model[LSTM_MAX_LAYERS];
+  unsigned int layers;
+  set_t set;
+  unsigned long iteration;
+  // Training state, as much of a trainer as lstm_trainer_store needs
+  int has_trainer;
+  lstm_trainer_t trainer;
+  lstm_model_parameters_t params;
+  lstm_model_t *M[LSTM_MAX_LAYERS];
+  lstm_model_t *R[LSTM_MAX_LAYERS];
+  lstm_values_state_t *state[LSTM_MAX_LAYERS];
+} checkpoint_snapshot_t;
+
+struct checkpoint_t {
+  char *raw_path;
+  char *json_path;
+  char *json_set_name;
+  int json_format;
+  unsigned int dtype;
+  char *training_path;
+  // History of bases and deltas, used by the writer only
+  unsigned int delta_every;
+  int delta_encoding;
+  unsigned int since_base;            // Checkpoints since the base
+  lstm_model_t *base[LSTM_MAX_LAYERS];
+  unsigned int base_layers;
+  uint32_t base_crc;
+  unsigned long base_iteration;
+  int failed;                         // Checkpoints that failed to be written
+  checkpoint_snapshot_t snapshots[2];
+  checkpoint_snapshot_t *pending;     // Taken, waiting to be written
+  checkpoint_snapshot_t *writing;     // Being written by the thread
+  int has_pending;
+  int stop;
+  int running;
+#ifndef WINDOWS
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+#endif
+};
+
+static char* checkpoint_strdup(const char *string)
+{
+  char *copy;
+  if ( string == NULL )
+    return NULL;
+  copy = e_calloc(strlen(string) + 1, 1);
+  memcpy(copy, string, strlen(string));
+  return copy;
+}
+
+static void checkpoint_copy_layer(lstm_model_t **copy, const lstm_model_t *layer)
+{
+  lstm_model_t *c = *copy;
+  unsigned int N = layer->N, S = layer->S, Y = layer->Y;
+
+  if ( c != NULL && ( c->X != layer->X || c->N != N || c->Y != Y ) ) {
+    lstm_free_model(c);
+    c = NULL;
+  }
+
+  if ( c == NULL ) {
+    c = e_calloc(1, sizeof(lstm_model_t));
+    c->X = layer->X;
+    c->N = N;
+    c->S = S;
+    c->Y = Y;
+
+    c->Wf = e_calloc(N * S, sizeof(double));
+    c->Wi = e_calloc(N * S, sizeof(double));
+    c->Wc = e_calloc(N * S, sizeof(double));
+    c->Wo = e_calloc(N * S, sizeof(double));
+    c->Wy = e_calloc(Y * N, sizeof(double));
+
+    c->bf = e_calloc(N, sizeof(double));
+    c->bi = e_calloc(N, sizeof(double));
+    c->bc = e_calloc(N, sizeof(double));
+    c->bo = e_calloc(N, sizeof(double));
+    c->by = e_calloc(Y, sizeof(double));
+    *copy = c;
+  }
+
+  memcpy(c->Wf, layer->Wf, N * S * sizeof(double));
+  memcpy(c->Wi, layer->Wi, N * S * sizeof(double));
+  memcpy(c->Wc, layer->Wc, N * S * sizeof(double));
+  memcpy(c->Wo, layer->Wo, N * S * sizeof(double));
+  memcpy(c->Wy, layer->Wy, Y * N * sizeof(double));
+
+  memcpy(c->bf, layer->bf, N * sizeof(double));
+  memcpy(c->bi, layer->bi, N * sizeof(double));
+  memcpy(c->bc, layer->bc, N * sizeof(double));
+  memcpy(c->bo, layer->bo, N * sizeof(double));
+  memcpy(c->by, layer->by, Y * sizeof(double));
+}
+
+static void checkpoint_copy(checkpoint_snapshot_t *snapshot, lstm_model_t **model,
+  set_t *set, unsigned int layers)
+{
+  unsigned int l = 0;
+
+  while ( l < layers ) {
+    checkpoint_copy_layer(&snapshot->model[l], model[l]);
+    ++l;
+  }
+  snapshot->layers = layers;
+  snapshot->set = *set;
+}
+
+static void checkpoint_copy_trainer(checkpoint_snapshot_t *snapshot,
+  const lstm_trainer_t *trainer)
+{
+  lstm_trainer_t *copy = &snapshot->trainer;
+  unsigned int p = 0, N;
+
+  snapshot->params = *trainer->params;
+
+  memset(copy, 0, sizeof(*copy));
+  copy->model = snapshot->model;
+  copy->layers = trainer->layers;
+  copy->params = &snapshot->params;
+  copy->training_points = trainer->training_points;
+  copy->i = trainer->i;
+  copy->n = trainer->n;
+  copy->epoch = trainer->epoch;
+  copy->loss = trainer->loss;
+  copy->record_keeper = trainer->record_keeper;
+  copy->record_iteration = trainer->record_iteration;
+  copy->initial_learning_rate = trainer->initial_learning_rate;
+
+  if ( trainer->M_layers != NULL ) {
+    copy->M_layers = snapshot->M;
+    copy->R_layers = snapshot->R;
+  }
+  if ( trainer->stateful_d_next != NULL )
+    copy->stateful_d_next = snapshot->state;
+
+  while ( p < trainer->layers ) {
+    if ( trainer->M_layers != NULL ) {
+      checkpoint_copy_layer(&snapshot->M[p], trainer->M_layers[p]);
+      checkpoint_copy_layer(&snapshot->R[p], trainer->R_layers[p]);
+    }
+
+    if ( trainer->stateful_d_next != NULL ) {
+      N = trainer->model[p]->N;
+      if ( snapshot->state[p] == NULL )
+        lstm_values_state_init(&snapshot->state[p], N);
+      memcpy(snapshot->state[p]->h, trainer->stateful_d_next[p]->h, N * sizeof(double));
+      memcpy(snapshot->state[p]->c, trainer->stateful_d_next[p]->c, N * sizeof(double));
+    }
+    ++p;
+  }
+}
+
+/* Writes a base or a delta against it, returns 0 on success */
+static int checkpoint_write_history(checkpoint_t *checkpoint, lstm_model_t **model,
+  set_t *set, unsigned int layers, unsigned long iteration, int *is_base)
+{
+  size_t size = strlen(checkpoint->raw_path) + 32;
+  char *path = e_calloc(size, 1);
+  unsigned int l = 0;
+  int ret;
+
+  *is_base = checkpoint->since_base == 0 || checkpoint->base_layers != layers;
+
+  if ( *is_base ) {
+    snprintf(path, size, "%s.%lu", checkpoint->raw_path, iteration);
+    ret = lstm_store(path, set, model, layers);
+    if ( ret == 0 ) {
+      while ( l < layers ) {
+        checkpoint_copy_layer(&checkpoint->base[l], model[l]);
+        ++l;
+      }
+      checkpoint->base_layers = layers;
+      checkpoint->base_crc = delta_base_crc(model, layers);
+      checkpoint->base_iteration = iteration;
+    }
+  } else {
+    snprintf(path, size, "%s.%lu.delta", checkpoint->raw_path, iteration);
+    ret = delta_store(path, model, checkpoint->base, layers,
+      checkpoint->delta_encoding, checkpoint->base_crc, iteration,
+      checkpoint->base_iteration);
+  }
+
+  // A base that failed is tried again next time
+  if ( ret == 0 || !*is_base )
+    checkpoint->since_base = ( checkpoint->since_base + 1 ) % checkpoint->delta_every;
+
+  free(path);
+  return ret;
+}
+
+/* Returns the number of files that failed to be written */
+static int checkpoint_write(checkpoint_t *checkpoint, lstm_model_t **model,
+  set_t *set, unsigned int layers, lstm_trainer_t *trainer, unsigned long iteration)
+{
+  int failed = 0, is_base = 1;
+  char *tmp_path;
+  double begin = trace_begin();
+
+  if ( checkpoint->delta_every > 0 ) {
+    if ( checkpoint_write_history(checkpoint, model, set, layers, iteration, &is_base) < 0 )
+      ++failed;
+  } else if ( lstm_store_as(checkpoint->raw_path, set, model, layers, checkpoint->dtype) < 0 ) {
+    ++failed;
+  }
+
+  // Deltas are not written as JSON
+  if ( checkpoint->json_path != NULL && is_base ) {
+    tmp_path = temp_file_name(checkpoint->json_path);
+    lstm_store_net_layers_as_json(model, tmp_path, checkpoint->json_set_name,
+      set, layers, checkpoint->json_format);
+    if ( replace_file(tmp_path, checkpoint->json_path) < 0 )
+      ++failed;
+    free(tmp_path);
+  }
+
+  if ( checkpoint->training_path != NULL && trainer != NULL &&
+    lstm_trainer_store(trainer, set, checkpoint->training_path) < 0 )
+    ++failed;
+
+  trace_end("checkpoint write", -1, begin);
+  return failed;
+}
+
+#ifndef WINDOWS
+static void* checkpoint_thread(void *data)
+{
+  checkpoint_t *checkpoint = data;
+  checkpoint_snapshot_t *snapshot;
+  int failed;
+
+  trace_thread_name("checkpoint");
+
+  pthread_mutex_lock(&checkpoint->lock);
+  while ( 1 ) {
+    while ( !checkpoint->has_pending && !checkpoint->stop )
+      pthread_cond_wait(&checkpoint->wake, &checkpoint->lock);
+
+    if ( !checkpoint->has_pending )
+      break;
+
+    snapshot = checkpoint->pending;
+    checkpoint->pending = checkpoint->writing;
+    checkpoint->writing = snapshot;
+    checkpoint->has_pending = 0;
+    pthread_mutex_unlock(&checkpoint->lock);
+
+    failed = checkpoint_write(checkpoint, snapshot->model, &snapshot->set,
+      snapshot->layers, snapshot->has_trainer ? &snapshot->trainer : NULL,
+      snapshot->iteration);
+
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->failed += failed;
+  }
+  pthread_mutex_unlock(&checkpoint->lock);
+
+  return NULL;
+}
+#endif
+
+checkpoint_t* checkpoint_init(const lstm_model_parameters_t *params)
+{
+  checkpoint_t *checkpoint = e_calloc(1, sizeof(checkpoint_t));
+
+  checkpoint->raw_path = checkpoint_strdup(params->store_network_name_raw);
+  checkpoint->json_path = checkpoint_strdup(params->store_network_name_json);
+  checkpoint->json_set_name = checkpoint_strdup(params->store_char_indx_map_name);
+  checkpoint->json_format = params->store_network_json_format;
+  checkpoint->dtype = params->store_network_dtype;
+  checkpoint->training_path = checkpoint_strdup(params->store_training_name);
+  checkpoint->delta_every = params->store_network_delta_every;
+  checkpoint->delta_encoding = params->store_network_delta_encoding;
+  checkpoint->pending = &checkpoint->snapshots[0];
+  checkpoint->writing = &checkpoint->snapshots[1];
+
+#ifndef WINDOWS
+  pthread_mutex_init(&checkpoint->lock, NULL);
+  pthread_cond_init(&checkpoint->wake, NULL);
+  if ( pthread_create(&checkpoint->thread, NULL, checkpoint_thread, checkpoint) == 0 ) {
+    checkpoint->running = 1;
+  } else {
+    fprintf(stderr, "%s warning: Failed to start a thread, checkpoints are written when taken.\n",
+      __func__);
+  }
+#endif
+
+  return checkpoint;
+}
+
+void checkpoint_take(checkpoint_t *checkpoint, lstm_model_t **model,
+  set_t *set, unsigned int layers, lstm_trainer_t *trainer)
+{
+#ifndef WINDOWS
+  if ( checkpoint->running ) {
+    // An older checkpoint still waiting is replaced
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint_copy(checkpoint->pending, model, set, layers);
+    checkpoint->pending->iteration = trainer != NULL ? trainer->n : 0;
+    checkpoint->pending->has_trainer = 0;
+    if ( checkpoint->training_path != NULL && trainer != NULL ) {
+      checkpoint_copy_trainer(checkpoint->pending, trainer);
+      checkpoint->pending->has_trainer = 1;
+    }
+    checkpoint->has_pending = 1;
+    pthread_cond_signal(&checkpoint->wake);
+    pthread_mutex_unlock(&checkpoint->lock);
+    return;
+  }
+#endif
+
+  checkpoint->failed += checkpoint_write(checkpoint, model, set, layers, trainer,
+    trainer != NULL ? trainer->n : 0);
+}
+
+int checkpoint_free(checkpoint_t *checkpoint)
+{
+  checkpoint_snapshot_t *snapshot;
+  int failed, s, l;
+
+#ifndef WINDOWS
+  if ( checkpoint->running ) {
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->stop = 1;
+    pthread_cond_signal(&checkpoint->wake);
+    pthread_mutex_unlock(&checkpoint->lock);
+    pthread_join(checkpoint->thread, NULL);
+  }
+  pthread_mutex_destroy(&checkpoint->lock);
+  pthread_cond_destroy(&checkpoint->wake);
+#endif
+
+  s = 0;
+  while ( s < 2 ) {
+    snapshot = &checkpoint->snapshots[s];
+    l = 0;
+    while ( l < LSTM_MAX_LAYERS ) {
+      if ( snapshot->model[l] != NULL )
+        lstm_free_model(snapshot->model[l]);
+      if ( snapshot->M[l] != NULL )
+        lstm_free_model(snapshot->M[l]);
+      if ( snapshot->R[l] != NULL )
+        lstm_free_model(snapshot->R[l]);
+      if ( snapshot->state[l] != NULL ) {
+        free_vector(&snapshot->state[l]->h);
+        free_vector(&snapshot->state[l]->c);
+        free(snapshot->state[l]);
+      }
+      ++l;
+    }
+    ++s;
+  }
+
+  l = 0;
+  while ( l < LSTM_MAX_LAYERS ) {
+    if ( checkpoint->base[l] != NULL )
+      lstm_free_model(checkpoint->base[l]);
+    ++l;
+  }
+
+  failed = checkpoint->failed;
+  free(checkpoint->raw_path);
+  free(checkpoint->json_path);
+  free(checkpoint->json_set_name);
+  free(checkpoint->training_path);
+  free(checkpoint);
+  return failed;
+}
@@ -0,0 +1,88 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file checkpoint.h
+    \brief Storing the network in the background during training
+
+    A checkpoint copies the weights to memory, which takes about as
+    long as one training step, and a background thread writes the
+    copy as the raw network and as JSON. If a training checkpoint is
+    asked for, the state of the trainer is copied and written as
+    well, see \ref lstm_trainer_store. Files are written to a
+    temporary name and renamed, so a reader never sees a half written
+    network.
+
+    The network can be kept as a history instead, full bases with
+    deltas against them in between, see \ref checkpoint_init and
+    delta.h.
+
+    If checkpoints are taken faster than they are written, only the
+    latest one waiting is kept. Without threads (WINDOWS) checkpoints
+    are written when taken.
+*/
+
+#ifndef LSTM_CHECKPOINT_H
+#define LSTM_CHECKPOINT_H
+
+#include "lstm.h"
+#include "set.h"
+
+typedef struct checkpoint_t checkpoint_t;
+
+/**
+* Start a checkpoint writer
+*
+* The network is stored to params->store_network_name_raw as
+* params->store_network_dtype, see \ref lstm_store_as, and to
+* params->store_network_name_json as JSON if not NULL, see
+* \ref lstm_store_net_layers_as_json. The training checkpoint is stored to
+* params->store_training_name if not NULL.
+*
+* If params->store_network_delta_every is not 0 a history is kept
+* instead of replacing the raw file. Every that many checkpoints the
+* network is stored in full as <raw name>.<iteration>, the base, and the
+* others as <raw name>.<iteration>.delta against the last base, encoded
+* as params->store_network_delta_encoding, see \ref delta_store. Bases
+* are stored as doubles, and JSON is written with the bases only.
+* @param params the names and formats, copied
+* @return the writer
+*/
+checkpoint_t* checkpoint_init(const lstm_model_parameters_t *params);
+/**
+* Take a checkpoint of the network, to be written in the background
+* @param checkpoint the writer
+* @param model the network
+* @param set The feature-to-index mapping.
+* @param layers number of layers in \p model
+* @param trainer the trainer of \p model, for the training checkpoint
+*/
+void checkpoint_take(checkpoint_t *checkpoint, lstm_model_t **model,
+  set_t *set, unsigned int layers, lstm_trainer_t *trainer);
+/**
+* Wait for the checkpoints taken to be written and stop the writer
+* @param checkpoint the writer
+* @return number of checkpoints that failed to be written
+*/
+int checkpoint_free(checkpoint_t *checkpoint);
+
+#endif
@@ -0,0 +1,389 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "clstm.h"
+#include "lstm.h"
+
+struct clstm_model_t {
+  lstm_model_t **layers;
+  int layer_count;
+  int features;
+  lstm_model_parameters_t params;
+  set_t set;
+  int index[256];     // Character to feature, -1 if unknown
+};
+
+struct clstm_session_t {
+  clstm_model_t *model;
+  lstm_session_t *session;
+  int fed;            // Whether the session has an output to continue from
+};
+
+struct clstm_trainer_t {
+  clstm_model_t *model;
+  lstm_trainer_t *trainer;
+  int *X;
+};
+
+static void clstm_model_index(clstm_model_t *model)
+{
+  int i = 0;
+
+  while ( i < 256 ) {
+    model->index[i] = -1;
+    ++i;
+  }
+
+  model->features = set_get_features(&model->set);
+  i = 0;
+  while ( i < model->features ) {
+    model->index[(unsigned char) set_indx_to_char(&model->set, i)] = i;
+    ++i;
+  }
+}
+
+clstm_model_t* clstm_model_load(const char *path)
+{
+  clstm_model_t *model = e_calloc(1, sizeof(clstm_model_t));
+
+  lstm_init_parameters(&model->params);
+
+  if ( lstm_load(path, &model->set, &model->params, &model->layers) < 0 ) {
+    free(model);
+    return NULL;
+  }
+
+  model->layer_count = model->params.layers;
+  clstm_model_index(model);
+  return model;
+}
+
+clstm_model_t* clstm_model_create(const char *text, size_t length,
+  int layers, int neurons)
+{
+  clstm_model_t *model;
+  size_t i = 0;
+  int p = 0, X, Y, F;
+
+  if ( layers <= 0 || layers > LSTM_MAX_LAYERS || neurons <= 0 ) {
+    fprintf(stderr, "%s error: bad number of layers or neurons\n", __func__);
+    return NULL;
+  }
+
+  model = e_calloc(1, sizeof(clstm_model_t));
+  lstm_init_parameters(&model->params);
+  model->params.layers = layers;
+  model->params.neurons = neurons;
+
+  initialize_set(&model->set);
+  while ( i < length ) {
+    set_insert_symbol(&model->set, text[i]);
+    ++i;
+  }
+  clstm_model_index(model);
+
+  F = model->features;
+  if ( F == 0 ) {
+    fprintf(stderr, "%s error: no features in the text\n", __func__);
+    free(model);
+    return NULL;
+  }
+
+  model->layer_count = layers;
+  model->layers = e_calloc(layers, sizeof(lstm_model_t*));
+
+  while ( p < layers ) {
+    X = p == layers - 1 ? F : neurons;
+    Y = p == 0 ? F : neurons;
+    lstm_init_model(X, neurons, Y, &model->layers[p], 0, &model->params);
+    ++p;
+  }
+
+  return model;
+}
+
+int clstm_model_save(clstm_model_t *model, const char *path)
+{
+  return lstm_store(path, &model->set, model->layers, model->layer_count);
+}
+
+void clstm_model_free(clstm_model_t *model)
+{
+  int p = 0;
+
+  if ( model == NULL )
+    return;
+
+  while ( p < model->layer_count ) {
+    lstm_free_model(model->layers[p]);
+    ++p;
+  }
+  free(model->layers);
+  free(model);
+}
+
+int clstm_model_features(clstm_model_t *model)
+{
+  return model->features;
+}
+
+int clstm_model_feature(clstm_model_t *model, int index)
+{
+  if ( index < 0 || index >= model->features )
+    return -1;
+  return (unsigned char) set_indx_to_char(&model->set, index);
+}
+
+clstm_session_t* clstm_session_create(clstm_model_t *model, unsigned long seed)
+{
+  clstm_session_t *session = e_calloc(1, sizeof(clstm_session_t));
+
+  session->model = model;
+  session->session = lstm_session_init(model->layers, model->layer_count);
+  if ( seed != 0 )
+    sampler_seed(session->session->sampler, seed);
+
+  return session;
+}
+
+void clstm_session_free(clstm_session_t *session)
+{
+  if ( session == NULL )
+    return;
+
+  lstm_session_free(session->session);
+  free(session);
+}
+
+void clstm_session_reset(clstm_session_t *session)
+{
+  lstm_session_reset(session->session);
+  session->fed = 0;
+}
+
+size_t clstm_session_feed(clstm_session_t *session, const char *text, size_t length)
+{
+  size_t i = 0, fed = 0;
+  int index;
+
+  while ( i < length ) {
+    index = session->model->index[(unsigned char) text[i]];
+    if ( index >= 0 ) {
+      lstm_session_step(session->session, index);
+      ++fed;
+    }
+    ++i;
+  }
+
+  if ( fed > 0 )
+    session->fed = 1;
+  return fed;
+}
+
+int clstm_session_step(clstm_session_t *session, char c, double *probs)
+{
+  int index = session->model->index[(unsigned char) c];
+  double *logits;
+
+  if ( index < 0 )
+    return -1;
+
+  logits = lstm_session_step(session->session, index);
+  session->fed = 1;
+
+  if ( probs != NULL )
+    softmax_layers_forward(probs, logits, session->model->features, 1.0);
+
+  return 0;
+}
+
+size_t clstm_generate(clstm_session_t *session, char *out, size_t length)
+{
+  size_t i = 0;
+  int index;
+
+  if ( !session->fed ) {
+    fprintf(stderr, "%s error: nothing has been fed to the session\n", __func__);
+    return 0;
+  }
+
+  while ( i < length ) {
+    index = sampler_sample(session->session->sampler, session->session->logits);
+    out[i] = set_indx_to_char(&session->model->set, index);
+    lstm_session_step(session->session, index);
+    ++i;
+  }
+
+  return i;
+}
+
+size_t clstm_generate_stream(clstm_session_t *session, size_t length,
+  clstm_stream_callback_t callback, void *data)
+{
+  size_t count = 0;
+  int part, n;
+
+  if ( !session->fed ) {
+    fprintf(stderr, "%s error: nothing has been fed to the session\n", __func__);
+    return 0;
+  }
+
+  // Streamed in parts that fit in an int
+  while ( count < length ) {
+    part = length - count > INT_MAX ? INT_MAX : (int) ( length - count );
+    n = lstm_session_stream(session->session, &session->model->set, part, callback, data);
+    count += n;
+    if ( n < part )
+      break;
+  }
+
+  return count;
+}
+
+int clstm_session_set_sampler(clstm_session_t *session, const char *mode,
+  double temperature, int top_k, double top_p)
+{
+  sampler_t *sampler;
+  int m = sampler_mode_from_name(mode);
+
+  if ( m < 0 ) {
+    fprintf(stderr, "%s error: unknown sampling mode: %s\n", __func__, mode);
+    return -1;
+  }
+
+  sampler = sampler_init(session->model->features, m, temperature,
+    top_k, top_p, 0);
+  // Keep drawing from the same random sequence
+  sampler->state = session->session->sampler->state;
+  sampler_free(session->session->sampler);
+  session->session->sampler = sampler;
+  return 0;
+}
+
+size_t clstm_session_snapshot(clstm_session_t *session, int half,
+  void *buffer, size_t size)
+{
+  int type = half ? SNAPSHOT_HALF : SNAPSHOT_DOUBLE;
+
+  if ( buffer == NULL )
+    return lstm_session_snapshot_size(session->session, type);
+  return lstm_session_snapshot(session->session, type, buffer, size);
+}
+
+int clstm_session_restore(clstm_session_t *session, const void *buffer, size_t size)
+{
+  if ( lstm_session_restore(session->session, buffer, size) < 0 )
+    return -1;
+  session->fed = 1;
+  return 0;
+}
+
+int clstm_session_snapshot_store(clstm_session_t *session, int half, const char *path)
+{
+  return lstm_session_snapshot_store(session->session,
+    half ? SNAPSHOT_HALF : SNAPSHOT_DOUBLE, path);
+}
+
+int clstm_session_snapshot_load(clstm_session_t *session, const char *path)
+{
+  if ( lstm_session_snapshot_load(session->session, path) < 0 )
+    return -1;
+  session->fed = 1;
+  return 0;
+}
+
+double clstm_score(clstm_session_t *session, const char *text, size_t length,
+  size_t *count)
+{
+  size_t i = 0, scored = 0;
+  double nll = 0.0;
+  int index;
+
+  while ( i < length ) {
+    index = session->model->index[(unsigned char) text[i]];
+    if ( index >= 0 ) {
+      if ( session->fed ) {
+        nll -= log_softmax(session->session->logits, session->model->features, index);
+        ++scored;
+      }
+      lstm_session_step(session->session, index);
+      session->fed = 1;
+    }
+    ++i;
+  }
+
+  if ( count != NULL )
+    *count = scored;
+  return nll;
+}
+
+clstm_trainer_t* clstm_trainer_create(clstm_model_t *model, const char *text,
+  size_t length, double learning_rate, int mini_batch)
+{
+  clstm_trainer_t *trainer;
+  size_t i = 0;
+  int *X;
+
+  if ( length < 2 || length > (size_t) ((unsigned int) -1) || mini_batch <= 0 ) {
+    fprintf(stderr, "%s error: bad length of text or mini batch size\n", __func__);
+    return NULL;
+  }
+
+  X = e_calloc(length + 1, sizeof(int));
+  while ( i < length ) {
+    X[i] = model->index[(unsigned char) text[i]];
+    if ( X[i] < 0 ) {
+      fprintf(stderr, "%s error: character '%c' (%d) is not a feature of the model\n",
+        __func__, text[i], text[i]);
+      free(X);
+      return NULL;
+    }
+    ++i;
+  }
+  X[length] = X[0];
+
+  model->params.learning_rate = learning_rate;
+  model->params.mini_batch_size = mini_batch;
+
+  trainer = e_calloc(1, sizeof(clstm_trainer_t));
+  trainer->model = model;
+  trainer->X = X;
+  trainer->trainer = lstm_trainer_init(model->layers, &model->params,
+    (unsigned int) length, X, &X[1], model->layer_count);
+
+  return trainer;
+}
+
+double clstm_trainer_step(clstm_trainer_t *trainer)
+{
+  return lstm_trainer_step(trainer->trainer);
+}
+
+void clstm_trainer_free(clstm_trainer_t *trainer)
+{
+  if ( trainer == NULL )
+    return;
+
+  lstm_trainer_free(trainer->trainer);
+  free(trainer->X);
+  free(trainer);
+}
@@ -0,0 +1,205 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file clstm.h
+    \brief The network as a library, libclstm
+
+    A small interface for embedding the network in other programs.
+    Everything is reached through handles, there is no global state:
+    a model holds the weights and features, a session holds the
+    state of one sequence and a trainer the state of a training run.
+
+    Any number of sessions may use the same model at the same time,
+    from different threads. A trainer changes the weights of its model,
+    so sessions must not use a model while it is being trained.
+*/
+
+#ifndef CLSTM_H
+#define CLSTM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct clstm_model_t clstm_model_t;
+typedef struct clstm_session_t clstm_session_t;
+typedef struct clstm_trainer_t clstm_trainer_t;
+
+/**
+* Load a network stored by the program or \ref clstm_model_save
+* @param path the file
+* @return the model, NULL on errors
+*/
+clstm_model_t* clstm_model_load(const char *path);
+/**
+* Create an untrained network, the features are the characters of \p text
+* @param text characters the network will know
+* @param length length of \p text
+* @param layers number of layers
+* @param neurons number of neurons in every layer
+* @return the model, NULL on errors
+*/
+clstm_model_t* clstm_model_create(const char *text, size_t length,
+  int layers, int neurons);
+/**
+* Store a network so that it can be loaded by \ref clstm_model_load or the program (-r)
+* @return 0 on success, negative values on errors
+*/
+int clstm_model_save(clstm_model_t *model, const char *path);
+/** Free a model, its sessions and trainers must have been freed first */
+void clstm_model_free(clstm_model_t *model);
+/** @return the number of features (characters) of the model */
+int clstm_model_features(clstm_model_t *model);
+/** @return the character of feature \p index, -1 if there is no such feature */
+int clstm_model_feature(clstm_model_t *model, int index);
+
+/**
+* Create a session, starting from a zero state
+* @param model the model
+* @param seed seed of the sampling random number generator, 0 for an arbitrary seed
+* @return the session, NULL on errors
+*/
+clstm_session_t* clstm_session_create(clstm_model_t *model, unsigned long seed);
+/** Free a session */
+void clstm_session_free(clstm_session_t *session);
+/** Set the state of a session back to zero */
+void clstm_session_reset(clstm_session_t *session);
+/**
+* Feed characters through the network, characters the model does not know are skipped
+* @return number of characters fed
+*/
+size_t clstm_session_feed(clstm_session_t *session, const char *text, size_t length);
+/**
+* Feed one character and get the probability of every feature to come next
+* @param session the session
+* @param c the character
+* @param probs if not NULL, \ref clstm_model_features values are written here
+* @return 0 on success, -1 if the model does not know \p c (nothing is fed)
+*/
+int clstm_session_step(clstm_session_t *session, char c, double *probs);
+/**
+* Sample characters, each one fed back as the next input.
+* The first one continues from what has been fed so far.
+* @param session the session, something must have been fed
+* @param out \p length characters are written here, it is not terminated
+* @param length number of characters
+* @return number of characters written
+*/
+size_t clstm_generate(clstm_session_t *session, char *out, size_t length);
+/**
+* Called by \ref clstm_generate_stream for every sampled character
+* @param c the character
+* @param prob its probability under the network, at temperature 1
+* @param elapsed seconds since \ref clstm_generate_stream was called
+* @param data passed through from \ref clstm_generate_stream
+* @return 0 to continue, anything else stops the generation
+*/
+typedef int (*clstm_stream_callback_t)(int c, double prob, double elapsed, void *data);
+/**
+* Sample characters like \ref clstm_generate, handing each one to
+* \p callback as soon as it is chosen. The first one needs no step
+* after \ref clstm_session_feed, feed the prompt first to bound the
+* time to the first character.
+* @param session the session, something must have been fed
+* @param length maximum number of characters
+* @param callback called for every character, may stop the generation
+* @param data passed to \p callback
+* @return number of characters handed to \p callback
+*/
+size_t clstm_generate_stream(clstm_session_t *session, size_t length,
+  clstm_stream_callback_t callback, void *data);
+/**
+* Choose how \ref clstm_generate picks characters
+* @param session the session
+* @param mode "multinomial", "greedy", "topk" or "topp"
+* @param temperature softmax temperature, the lower the more conservative
+* @param top_k candidates kept with "topk"
+* @param top_p probability mass kept with "topp"
+* @return 0 on success, -1 on an unknown mode
+*/
+int clstm_session_set_sampler(clstm_session_t *session, const char *mode,
+  double temperature, int top_k, double top_p);
+/**
+* Save the state of a session to memory, see \ref clstm_session_restore
+* @param session the session
+* @param half if not 0 the values are stored in 16 bits instead of 64
+* @param buffer the snapshot is written here, if NULL only its size is returned
+* @param size size of \p buffer
+* @return size of the snapshot, 0 if \p buffer is too small
+*/
+size_t clstm_session_snapshot(clstm_session_t *session, int half,
+  void *buffer, size_t size);
+/**
+* Continue a session from a snapshot taken of a session on the same model
+* @return 0 on success, negative values on errors
+*/
+int clstm_session_restore(clstm_session_t *session, const void *buffer, size_t size);
+/**
+* Store a snapshot of a session in a file, see \ref clstm_session_snapshot
+* @return 0 on success, negative values on errors
+*/
+int clstm_session_snapshot_store(clstm_session_t *session, int half, const char *path);
+/**
+* Continue a session from a snapshot stored in a file
+* @return 0 on success, negative values on errors
+*/
+int clstm_session_snapshot_load(clstm_session_t *session, const char *path);
+/**
+* Feed a text and sum the negative log-likelihood of its characters.
+* The first character is scored given what has been fed before it,
+* unknown characters are skipped.
+* @param session the session
+* @param text the text
+* @param length length of \p text
+* @param count if not NULL, the number of scored characters is written here
+* @return the summed negative log-likelihood, in nats
+*/
+double clstm_score(clstm_session_t *session, const char *text, size_t length,
+  size_t *count);
+
+/**
+* Start training a model on a text
+* @param model the model, every character of \p text must be one of its features
+* @param text the training data, it is copied
+* @param length length of \p text, at least 2
+* @param learning_rate the learning rate
+* @param mini_batch characters per step, backpropagation through time
+* @return the trainer, NULL on errors
+*/
+clstm_trainer_t* clstm_trainer_create(clstm_model_t *model, const char *text,
+  size_t length, double learning_rate, int mini_batch);
+/**
+* Train on the next mini-batch
+* @return the moving average of the loss
+*/
+double clstm_trainer_step(clstm_trainer_t *trainer);
+/** Free a trainer, the model keeps its trained weights */
+void clstm_trainer_free(clstm_trainer_t *trainer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,379 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "delta.h"
+
+static uint64_t delta_bits(double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static double delta_double(uint64_t bits)
+{
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* Largest encoded size of count values */
+static size_t delta_bound(int encoding, size_t count)
+{
+  switch ( encoding ) {
+  case LSTM_DELTA_XOR:
+    // A control byte per two values
+    return count * 8 + ( count + 1 ) / 2;
+  case LSTM_DELTA_Q16:
+    return sizeof(double) + count * 2;
+  default:
+    return sizeof(double) + count;
+  }
+}
+
+static size_t delta_encode(int encoding, const double *V, const double *B,
+  size_t count, unsigned char *out)
+{
+  size_t n = 0, i = 0, control;
+  uint64_t x;
+  double max = 0.0, scale, diff;
+  long levels = encoding == LSTM_DELTA_Q16 ? 32767 : 127, q;
+  int bytes, half, b;
+
+  if ( encoding == LSTM_DELTA_XOR ) {
+    while ( i < count ) {
+      control = n++;
+      out[control] = 0;
+
+      half = 0;
+      while ( half < 2 && i < count ) {
+        x = delta_bits(V[i]) ^ delta_bits(B[i]);
+        bytes = 0;
+        while ( bytes < 8 && ( x >> ( 8 * bytes ) ) != 0 )
+          ++bytes;
+
+        out[control] |= (unsigned char) ( bytes << ( 4 * half ) );
+        b = 0;
+        while ( b < bytes ) {
+          out[n++] = (unsigned char) ( x >> ( 8 * b ) );
+          ++b;
+        }
+        ++half;
+        ++i;
+      }
+    }
+    return n;
+  }
+
+  while ( i < count ) {
+    diff = fabs(V[i] - B[i]);
+    if ( diff > max )
+      max = diff;
+    ++i;
+  }
+  scale = max / levels;
+  memcpy(out, &scale, sizeof(scale));
+  n = sizeof(scale);
+
+  i = 0;
+  while ( i < count ) {
+    q = scale > 0.0 ? lround(( V[i] - B[i] ) / scale) : 0;
+    if ( q > levels )
+      q = levels;
+    if ( q < -levels )
+      q = -levels;
+
+    out[n++] = (unsigned char) ( q & 0xff );
+    if ( encoding == LSTM_DELTA_Q16 )
+      out[n++] = (unsigned char) ( ( q >> 8 ) & 0xff );
+    ++i;
+  }
+  return n;
+}
+
+/* Returns the bytes read, 0 if in does not hold count values */
+static size_t delta_decode(int encoding, double *V, size_t count,
+  const unsigned char *in, size_t length)
+{
+  size_t n = 0, i = 0;
+  uint64_t x;
+  double scale;
+  int bytes, half, b;
+  long q;
+
+  if ( encoding == LSTM_DELTA_XOR ) {
+    while ( i < count ) {
+      unsigned char control;
+
+      if ( n >= length )
+        return 0;
+      control = in[n++];
+
+      half = 0;
+      while ( half < 2 && i < count ) {
+        bytes = ( control >> ( 4 * half ) ) & 0x0f;
+        if ( bytes > 8 || n + bytes > length )
+          return 0;
+
+        x = 0;
+        b = 0;
+        while ( b < bytes ) {
+          x |= (uint64_t) in[n++] << ( 8 * b );
+          ++b;
+        }
+        V[i] = delta_double(delta_bits(V[i]) ^ x);
+        ++half;
+        ++i;
+      }
+    }
+    return n;
+  }
+
+  if ( length != delta_bound(encoding, count) )
+    return 0;
+
+  memcpy(&scale, in, sizeof(scale));
+  n = sizeof(scale);
+  while ( i < count ) {
+    if ( encoding == LSTM_DELTA_Q16 ) {
+      q = (int16_t) ( in[n] | ( in[n + 1] << 8 ) );
+      n += 2;
+    } else {
+      q = (int8_t) in[n];
+      n += 1;
+    }
+    V[i] += q * scale;
+    ++i;
+  }
+  return n;
+}
+
+uint32_t delta_base_crc(lstm_model_t **model, unsigned int layers)
+{
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  uint32_t crc = 0;
+  unsigned int l = 0;
+  int a;
+
+  while ( l < layers ) {
+    lstm_weight_arrays(model[l], arrays, counts);
+    a = 0;
+    while ( a < LSTM_WEIGHT_ARRAYS ) {
+      crc = crc32_update(crc, *arrays[a], counts[a] * sizeof(double));
+      ++a;
+    }
+    ++l;
+  }
+
+  return crc;
+}
+
+int delta_store(const char *path, lstm_model_t **model, lstm_model_t **base,
+  unsigned int layers, int encoding, uint32_t base_crc,
+  unsigned long iteration, unsigned long base_iteration)
+{
+  FILE *fp;
+  lstm_delta_header_t header;
+  lstm_delta_layer_t table[LSTM_MAX_LAYERS];
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  double **base_arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  unsigned char *data;
+  uint64_t length;
+  size_t bound = 0, size = 0;
+  char *tmp_path;
+  unsigned int l;
+  int a, ret;
+
+  if ( layers == 0 || layers > LSTM_MAX_LAYERS ) {
+    fprintf(stderr, "%s error: Can not store a delta of %u layers.\n", __func__, layers);
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memset(table, 0, sizeof(table));
+  memcpy(header.magic, LSTM_DELTA_MAGIC, sizeof(header.magic));
+  header.version = LSTM_DELTA_VERSION;
+  header.encoding = encoding;
+  header.layers = layers;
+  header.base_crc = base_crc;
+  header.base_iteration = base_iteration;
+  header.iteration = iteration;
+
+  l = 0;
+  while ( l < layers ) {
+    table[l].X = model[l]->X;
+    table[l].N = model[l]->N;
+    table[l].Y = model[l]->Y;
+
+    lstm_weight_arrays(model[l], arrays, counts);
+    a = 0;
+    while ( a < LSTM_WEIGHT_ARRAYS ) {
+      bound += sizeof(length) + delta_bound(encoding, counts[a]);
+      ++a;
+    }
+    ++l;
+  }
+
+  data = e_calloc(bound, 1);
+
+  l = 0;
+  while ( l < layers ) {
+    lstm_weight_arrays(model[l], arrays, counts);
+    lstm_weight_arrays(base[l], base_arrays, counts);
+    a = 0;
+    while ( a < LSTM_WEIGHT_ARRAYS ) {
+      length = delta_encode(encoding, *arrays[a], *base_arrays[a], counts[a],
+        &data[size + sizeof(length)]);
+      memcpy(&data[size], &length, sizeof(length));
+      size += sizeof(length) + length;
+      ++a;
+    }
+    ++l;
+  }
+
+  header.size = size;
+  header.crc = crc32_update(crc32_update(crc32_update(0, &header, sizeof(header)),
+    table, layers * sizeof(lstm_delta_layer_t)), data, size);
+
+  tmp_path = temp_file_name(path);
+  fp = fopen(tmp_path, "wb");
+  if ( fp == NULL ) {
+    fprintf(stderr, "%s error: Failed to open file: %s for writing.\n", __func__, tmp_path);
+    free(tmp_path);
+    free(data);
+    return -1;
+  }
+
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(table, sizeof(lstm_delta_layer_t), layers, fp);
+  fwrite(data, 1, size, fp);
+  free(data);
+
+  if ( ferror(fp) | fclose(fp) ) {
+    fprintf(stderr, "%s error: Failed to write %s.\n", __func__, tmp_path);
+    remove(tmp_path);
+    free(tmp_path);
+    return -1;
+  }
+
+  ret = replace_file(tmp_path, path);
+  free(tmp_path);
+  return ret;
+}
+
+int delta_apply(const char *path, lstm_model_t **model, unsigned int layers)
+{
+  FILE *fp;
+  lstm_delta_header_t header;
+  lstm_delta_layer_t table[LSTM_MAX_LAYERS];
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  unsigned char *data;
+  uint64_t length;
+  size_t position = 0;
+  uint32_t crc;
+  unsigned int l;
+  int a;
+
+  fp = fopen(path, "rb");
+  if ( fp == NULL ) {
+    fprintf(stderr, "%s error: Failed to open file: %s for reading.\n", __func__, path);
+    return -1;
+  }
+
+  if ( fread(&header, sizeof(header), 1, fp) != 1 ||
+    memcmp(header.magic, LSTM_DELTA_MAGIC, sizeof(header.magic)) ||
+    header.version != LSTM_DELTA_VERSION || header.encoding > LSTM_DELTA_Q8 ||
+    header.layers != layers ||
+    fread(table, sizeof(lstm_delta_layer_t), layers, fp) != layers ) {
+    fprintf(stderr, "%s error: %s is not a delta of a network of %u layers.\n",
+      __func__, path, layers);
+    fclose(fp);
+    return -1;
+  }
+
+  l = 0;
+  while ( l < layers ) {
+    if ( table[l].X != model[l]->X || table[l].N != model[l]->N ||
+      table[l].Y != model[l]->Y ) {
+      fprintf(stderr, "%s error: Layer %u of %s does not match the network.\n",
+        __func__, l, path);
+      fclose(fp);
+      return -1;
+    }
+    ++l;
+  }
+
+  if ( header.base_crc != delta_base_crc(model, layers) ) {
+    fprintf(stderr, "%s error: %s is a delta against another network, \
+the base stored at iteration %lu.\n", __func__, path, (unsigned long) header.base_iteration);
+    fclose(fp);
+    return -1;
+  }
+
+  data = e_calloc(header.size + 1, 1);
+  if ( fread(data, 1, header.size, fp) != header.size ) {
+    fprintf(stderr, "%s error: %s is truncated.\n", __func__, path);
+    free(data);
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+
+  crc = header.crc;
+  header.crc = 0;
+  if ( crc32_update(crc32_update(crc32_update(0, &header, sizeof(header)),
+    table, layers * sizeof(lstm_delta_layer_t)), data, header.size) != crc ) {
+    fprintf(stderr, "%s error: %s has a bad checksum.\n", __func__, path);
+    free(data);
+    return -1;
+  }
+
+  l = 0;
+  while ( l < layers ) {
+    lstm_weight_arrays(model[l], arrays, counts);
+    a = 0;
+    while ( a < LSTM_WEIGHT_ARRAYS ) {
+      if ( position + sizeof(length) > header.size )
+        break;
+      memcpy(&length, &data[position], sizeof(length));
+      position += sizeof(length);
+      if ( length > header.size - position ||
+        delta_decode(header.encoding, *arrays[a], counts[a], &data[position], length) != length )
+        break;
+      position += length;
+      ++a;
+    }
+    if ( a < LSTM_WEIGHT_ARRAYS ) {
+      fprintf(stderr, "%s error: %s is damaged.\n", __func__, path);
+      free(data);
+      return -1;
+    }
+    ++l;
+  }
+
+  free(data);
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file delta.h
+    \brief Delta checkpoints, the weights stored as the difference to a base
+
+    During training most stores can be deltas against the last full
+    network (the base), which take a fraction of the space:
+
+    - LSTM_DELTA_XOR: the bits of every weight XOR the base, with the
+      leading zero bytes left out. Exact.
+    - LSTM_DELTA_Q16, LSTM_DELTA_Q8: the difference to the base,
+      rounded to 16 or 8 bit integers scaled per weight array. A weight
+      is off by at most half a step, the largest difference in its
+      array divided by 32767 or 127.
+
+    Every delta is against its base, not the previous delta, so any
+    checkpoint is rebuilt from two files and rounding does not add up.
+*/
+
+#ifndef LSTM_DELTA_H
+#define LSTM_DELTA_H
+
+#include "lstm.h"
+
+#define LSTM_DELTA_XOR                        0
+#define LSTM_DELTA_Q16                        1
+#define LSTM_DELTA_Q8                         2
+
+/*
+* Delta file
+*
+* lstm_delta_header_t
+* lstm_delta_layer_t, for each layer (output layer first)
+* For each layer, its weight arrays in the order of \ref lstm_weight_arrays:
+*   uint64_t bytes of the encoded array, followed by the encoded array
+*
+* Values are in the byte order of the machine that stored the file.
+*/
+#define LSTM_DELTA_MAGIC                      "LSTMDLT1"
+#define LSTM_DELTA_VERSION                    1
+
+typedef struct lstm_delta_header_t {
+  char magic[8];              /**< LSTM_DELTA_MAGIC, not terminated */
+  uint32_t version;           /**< LSTM_DELTA_VERSION */
+  uint32_t encoding;          /**< LSTM_DELTA_XOR, LSTM_DELTA_Q16 or LSTM_DELTA_Q8 */
+  uint32_t layers;
+  uint32_t base_crc;          /**< CRC-32 of the weights of the base, see \ref delta_base_crc */
+  uint64_t base_iteration;    /**< Iteration the base was stored at */
+  uint64_t iteration;         /**< Iteration this delta was stored at */
+  uint64_t size;              /**< Bytes after the layer table */
+  uint32_t crc;               /**< CRC-32 of the file, with this field set to 0 */
+  uint32_t reserved;
+} lstm_delta_header_t;
+
+typedef struct lstm_delta_layer_t {
+  uint32_t X;
+  uint32_t N;
+  uint32_t Y;
+  uint32_t reserved;
+} lstm_delta_layer_t;
+
+/**
+* Identify a base network by its weights
+* @param model the network
+* @param layers number of layers
+* @return CRC-32 of all weights, in file order
+*/
+uint32_t delta_base_crc(lstm_model_t **model, unsigned int layers);
+/**
+* Store a network as a delta against a base
+* @param path file to write, replaced through a temporary file
+* @param model the network
+* @param base the base, of the same shape
+* @param layers number of layers
+* @param encoding LSTM_DELTA_XOR, LSTM_DELTA_Q16 or LSTM_DELTA_Q8
+* @param base_crc \ref delta_base_crc of \p base
+* @param iteration iteration of \p model, kept for reference
+* @param base_iteration iteration of \p base, kept for reference
+* @return 0 on success, -1 on errors
+*/
+int delta_store(const char *path, lstm_model_t **model, lstm_model_t **base,
+  unsigned int layers, int encoding, uint32_t base_crc,
+  unsigned long iteration, unsigned long base_iteration);
+/**
+* Rebuild a network from its base and a delta
+* @param path the delta
+* @param model the base on entry, the network of the delta on return. \
+It is left as it is if the delta does not belong to it.
+* @param layers number of layers
+* @return 0 on success, -1 on errors
+*/
+int delta_apply(const char *path, lstm_model_t **model, unsigned int layers);
+
+#endif
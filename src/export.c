@@ -0,0 +1,293 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "export.h"
+
+// Values per line of the weight arrays
+#define EXPORT_VALUES_PER_LINE    4
+
+static void export_array(FILE *fp, const char *name, int layer,
+  const double *values, int count)
+{
+  int i = 0;
+
+  fprintf(fp, "static const NET_ALIGNED double net_l%d_%s[%d] = {", layer, name, count);
+  while ( i < count ) {
+    if ( i % EXPORT_VALUES_PER_LINE == 0 )
+      fprintf(fp, "\n ");
+    fprintf(fp, " %.17g,", values[i]);
+    ++i;
+  }
+  fprintf(fp, "\n};\n");
+}
+
+/*
+* One layer of the forward pass. The input layer gets the index of a
+* one-hot input, so only one column of the input part of its weights
+* is added. Other layers get the outputs of the layer before them.
+* The sums are taken in the same order as in lstm_forward_propagate.
+*/
+static void export_layer(FILE *fp, lstm_model_t *model, int p, int input_layer)
+{
+  int N = model->N, S = model->S, X = model->X, Y = model->Y;
+
+  if ( input_layer )
+    fprintf(fp, "static void net_layer%d(net_state_t *state, int index, double *out)\n", p);
+  else
+    fprintf(fp, "static void net_layer%d(net_state_t *state, const double *in, double *out)\n", p);
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  double hf[%d], hi[%d], ho[%d], hc[%d];\n", N, N, N, N);
+  fprintf(fp, "  double *h = state->h%d, *c = state->c%d;\n", p, p);
+  fprintf(fp, "  int i, n;\n\n");
+  fprintf(fp, "  for ( i = 0; i < %d; ++i ) {\n", N);
+  fprintf(fp, "    const double *wf = &net_l%d_Wf[i * %d], *wi = &net_l%d_Wi[i * %d];\n", p, S, p, S);
+  fprintf(fp, "    const double *wo = &net_l%d_Wo[i * %d], *wc = &net_l%d_Wc[i * %d];\n", p, S, p, S);
+  fprintf(fp, "    double f = net_l%d_bf[i], g = net_l%d_bi[i], o = net_l%d_bo[i], a = net_l%d_bc[i];\n\n", p, p, p, p);
+  fprintf(fp, "    for ( n = 0; n < %d; ++n ) {\n", N);
+  fprintf(fp, "      f += wf[n] * h[n];\n");
+  fprintf(fp, "      g += wi[n] * h[n];\n");
+  fprintf(fp, "      o += wo[n] * h[n];\n");
+  fprintf(fp, "      a += wc[n] * h[n];\n");
+  fprintf(fp, "    }\n");
+  if ( input_layer ) {
+    fprintf(fp, "    if ( index >= 0 ) {\n");
+    fprintf(fp, "      f += wf[%d + index];\n", N);
+    fprintf(fp, "      g += wi[%d + index];\n", N);
+    fprintf(fp, "      o += wo[%d + index];\n", N);
+    fprintf(fp, "      a += wc[%d + index];\n", N);
+    fprintf(fp, "    }\n");
+  } else {
+    fprintf(fp, "    for ( n = 0; n < %d; ++n ) {\n", X);
+    fprintf(fp, "      f += wf[%d + n] * in[n];\n", N);
+    fprintf(fp, "      g += wi[%d + n] * in[n];\n", N);
+    fprintf(fp, "      o += wo[%d + n] * in[n];\n", N);
+    fprintf(fp, "      a += wc[%d + n] * in[n];\n", N);
+    fprintf(fp, "    }\n");
+  }
+  fprintf(fp, "    hf[i] = 1.0 / ( 1.0 + exp(-f) );\n");
+  fprintf(fp, "    hi[i] = 1.0 / ( 1.0 + exp(-g) );\n");
+  fprintf(fp, "    ho[i] = 1.0 / ( 1.0 + exp(-o) );\n");
+  fprintf(fp, "    hc[i] = tanh(a);\n");
+  fprintf(fp, "  }\n\n");
+  fprintf(fp, "  for ( i = 0; i < %d; ++i ) {\n", N);
+  fprintf(fp, "    c[i] = hf[i] * c[i] + hi[i] * hc[i];\n");
+  fprintf(fp, "    h[i] = ho[i] * tanh(c[i]);\n");
+  fprintf(fp, "  }\n\n");
+  fprintf(fp, "  for ( i = 0; i < %d; ++i ) {\n", Y);
+  fprintf(fp, "    const double *wy = &net_l%d_Wy[i * %d];\n", p, N);
+  fprintf(fp, "    double y = net_l%d_by[i];\n", p);
+  fprintf(fp, "    for ( n = 0; n < %d; ++n )\n", N);
+  fprintf(fp, "      y += wy[n] * h[n];\n");
+  fprintf(fp, "    out[i] = y;\n");
+  fprintf(fp, "  }\n");
+  fprintf(fp, "}\n\n");
+}
+
+int lstm_export_c(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *path)
+{
+  FILE *fp;
+  int F = set_get_features(set), p, i, index[256];
+
+  fp = fopen(path, "w");
+  if ( fp == NULL ) {
+    fprintf(stderr, "%s error: Failed to open file: %s for writing.\n",
+      __func__, path);
+    return -1;
+  }
+
+  i = 0;
+  while ( i < 256 ) {
+    index[i] = -1;
+    ++i;
+  }
+  i = 0;
+  while ( i < F ) {
+    index[(unsigned char) set_indx_to_char(set, i)] = i;
+    ++i;
+  }
+
+  fprintf(fp, "/*\n");
+  fprintf(fp, "* An LSTM network of %d layers, %d features, exported with -export_c.\n", layers, F);
+  fprintf(fp, "* Layer 0 is the output layer, layer %d the input layer.\n", layers - 1);
+  fprintf(fp, "*\n");
+  fprintf(fp, "*   net_state_t state;\n");
+  fprintf(fp, "*   net_reset(&state);\n");
+  fprintf(fp, "*   logits = net_step(&state, net_index(c));  // for every character c\n");
+  fprintf(fp, "*   next = net_sample(logits, 1.0, uniform);  // uniform in [0, 1)\n");
+  fprintf(fp, "*\n");
+  fprintf(fp, "* Compile with -DNET_MAIN for a program: ./a.out seed [characters]\n");
+  fprintf(fp, "*/\n");
+  fprintf(fp, "#include <math.h>\n");
+  fprintf(fp, "#include <string.h>\n\n");
+  fprintf(fp, "#if defined(_MSC_VER)\n");
+  fprintf(fp, "#define NET_ALIGNED __declspec(align(64))\n");
+  fprintf(fp, "#else\n");
+  fprintf(fp, "#define NET_ALIGNED __attribute__((aligned(64)))\n");
+  fprintf(fp, "#endif\n\n");
+  fprintf(fp, "#define NET_LAYERS %d\n", layers);
+  fprintf(fp, "#define NET_FEATURES %d\n\n", F);
+
+  fprintf(fp, "typedef struct net_state_t {\n");
+  p = 0;
+  while ( p < layers ) {
+    fprintf(fp, "  double h%d[%d];\n", p, model_layers[p]->N);
+    fprintf(fp, "  double c%d[%d];\n", p, model_layers[p]->N);
+    ++p;
+  }
+  fprintf(fp, "  double logits[%d];\n", F);
+  fprintf(fp, "} net_state_t;\n\n");
+
+  fprintf(fp, "static const unsigned char net_features[%d] = {", F);
+  i = 0;
+  while ( i < F ) {
+    fprintf(fp, "%s%d,", i % 16 ? " " : "\n  ", (unsigned char) set_indx_to_char(set, i));
+    ++i;
+  }
+  fprintf(fp, "\n};\n\n");
+
+  fprintf(fp, "static const short net_indices[256] = {");
+  i = 0;
+  while ( i < 256 ) {
+    fprintf(fp, "%s%d,", i % 16 ? " " : "\n  ", index[i]);
+    ++i;
+  }
+  fprintf(fp, "\n};\n\n");
+
+  p = 0;
+  while ( p < layers ) {
+    lstm_model_t *model = model_layers[p];
+    int N = model->N, S = model->S, Y = model->Y;
+
+    fprintf(fp, "// Layer %d: X = %d, N = %d, Y = %d\n", p, model->X, N, Y);
+    export_array(fp, "Wf", p, model->Wf, N * S);
+    export_array(fp, "Wi", p, model->Wi, N * S);
+    export_array(fp, "Wo", p, model->Wo, N * S);
+    export_array(fp, "Wc", p, model->Wc, N * S);
+    export_array(fp, "bf", p, model->bf, N);
+    export_array(fp, "bi", p, model->bi, N);
+    export_array(fp, "bo", p, model->bo, N);
+    export_array(fp, "bc", p, model->bc, N);
+    export_array(fp, "Wy", p, model->Wy, Y * N);
+    export_array(fp, "by", p, model->by, Y);
+    fprintf(fp, "\n");
+    ++p;
+  }
+
+  p = layers - 1;
+  while ( p >= 0 ) {
+    export_layer(fp, model_layers[p], p, p == layers - 1);
+    --p;
+  }
+
+  fprintf(fp, "void net_reset(net_state_t *state)\n");
+  fprintf(fp, "{\n");
+  fprintf(fp, "  memset(state, 0, sizeof(*state));\n");
+  fprintf(fp, "}\n\n");
+
+  fprintf(fp, "/* Index of a character, -1 if it is not a feature */\n");
+  fprintf(fp, "int net_index(int c)\n");
+  fprintf(fp, "{\n");
+  fprintf(fp, "  return net_indices[(unsigned char) c];\n");
+  fprintf(fp, "}\n\n");
+
+  fprintf(fp, "/* Feed one feature index (-1 feeds a zero input), returns the output logits */\n");
+  fprintf(fp, "const double* net_step(net_state_t *state, int index)\n");
+  fprintf(fp, "{\n");
+  p = layers - 1;
+  while ( p > 0 ) {
+    fprintf(fp, "  double out%d[%d];\n", p, model_layers[p]->Y);
+    --p;
+  }
+  if ( layers > 1 )
+    fprintf(fp, "\n");
+  p = layers - 1;
+  while ( p >= 0 ) {
+    fprintf(fp, "  net_layer%d(state, ", p);
+    if ( p == layers - 1 )
+      fprintf(fp, "index >= 0 && index < NET_FEATURES ? index : -1, ");
+    else
+      fprintf(fp, "out%d, ", p + 1);
+    if ( p == 0 )
+      fprintf(fp, "state->logits);\n");
+    else
+      fprintf(fp, "out%d);\n", p);
+    --p;
+  }
+  fprintf(fp, "  return state->logits;\n");
+  fprintf(fp, "}\n\n");
+
+  fprintf(fp, "/* Sample a character from logits, uniform is in [0, 1) */\n");
+  fprintf(fp, "int net_sample(const double *logits, double temperature, double uniform)\n");
+  fprintf(fp, "{\n");
+  fprintf(fp, "  double probs[NET_FEATURES], max = logits[0], sum = 0.0;\n");
+  fprintf(fp, "  int i;\n\n");
+  fprintf(fp, "  for ( i = 1; i < NET_FEATURES; ++i )\n");
+  fprintf(fp, "    if ( logits[i] > max )\n");
+  fprintf(fp, "      max = logits[i];\n");
+  fprintf(fp, "  for ( i = 0; i < NET_FEATURES; ++i ) {\n");
+  fprintf(fp, "    probs[i] = exp(( logits[i] - max ) / temperature);\n");
+  fprintf(fp, "    sum += probs[i];\n");
+  fprintf(fp, "  }\n");
+  fprintf(fp, "  uniform *= sum;\n");
+  fprintf(fp, "  for ( i = 0; i < NET_FEATURES - 1; ++i ) {\n");
+  fprintf(fp, "    uniform -= probs[i];\n");
+  fprintf(fp, "    if ( uniform < 0.0 )\n");
+  fprintf(fp, "      break;\n");
+  fprintf(fp, "  }\n");
+  fprintf(fp, "  return net_features[i];\n");
+  fprintf(fp, "}\n\n");
+
+  fprintf(fp, "#ifdef NET_MAIN\n");
+  fprintf(fp, "#include <stdio.h>\n");
+  fprintf(fp, "#include <stdlib.h>\n");
+  fprintf(fp, "#include <time.h>\n\n");
+  fprintf(fp, "int main(int argc, char *argv[])\n");
+  fprintf(fp, "{\n");
+  fprintf(fp, "  static net_state_t state;\n");
+  fprintf(fp, "  const double *logits = state.logits;\n");
+  fprintf(fp, "  const char *seed = argc > 1 ? argv[1] : \"\";\n");
+  fprintf(fp, "  int length = argc > 2 ? atoi(argv[2]) : 256, c, i;\n\n");
+  fprintf(fp, "  srand((unsigned) time(NULL));\n");
+  fprintf(fp, "  net_reset(&state);\n");
+  fprintf(fp, "  for ( i = 0; seed[i] != '\\0'; ++i )\n");
+  fprintf(fp, "    logits = net_step(&state, net_index(seed[i]));\n");
+  fprintf(fp, "  fputs(seed, stdout);\n");
+  fprintf(fp, "  for ( i = 0; i < length; ++i ) {\n");
+  fprintf(fp, "    c = net_sample(logits, 1.0, rand() / ( RAND_MAX + 1.0 ));\n");
+  fprintf(fp, "    putchar(c);\n");
+  fprintf(fp, "    logits = net_step(&state, net_index(c));\n");
+  fprintf(fp, "  }\n");
+  fprintf(fp, "  putchar('\\n');\n");
+  fprintf(fp, "  return 0;\n");
+  fprintf(fp, "}\n");
+  fprintf(fp, "#endif\n");
+
+  if ( fclose(fp) != 0 ) {
+    fprintf(stderr, "%s error: Failed to write %s\n", __func__, path);
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,54 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file export.h
+    \brief Export of a trained network as C source
+
+    The weights are written as static const arrays and the forward
+    pass with the sizes of the network as constants, so the result
+    compiles into a program that runs the network without reading
+    any file.
+*/
+
+#ifndef LSTM_EXPORT_H
+#define LSTM_EXPORT_H
+
+#include "lstm.h"
+#include "set.h"
+
+/**
+* Write a network as a standalone C file.
+*
+* The file defines net_state_t, net_reset, net_step, net_index and
+* net_sample, see the comment at its top. Compiled with -DNET_MAIN it
+* also has a main function that samples text from a seed.
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @param set The feature-to-index mapping.
+* @param path the C file
+* @return 0 on success, negative values on errors
+*/
+int lstm_export_c(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *path);
+
+#endif
@@ -33,6 +33,8 @@
 */
 
 #include "layers.h"
+#include "roofline.h"
+#include <string.h>
 
 #ifdef WINDOWS
 #include <stdio.h>
@@ -42,6 +44,8 @@
 void  fully_connected_forward(double* Y, double* A, double* X, double* b, int R, int C)
 {
   int i = 0, n = 0;
+  double begin = ROOFLINE_BEGIN();
+
   while ( i < R ) {
     Y[i] = b[i];
     n = 0;
@@ -52,12 +56,163 @@ void  fully_connected_forward(double* Y, double* A, double* X, double* b, int R,
     ++i;
   }
 
+  ROOFLINE_END(ROOFLINE_FULLY_CONNECTED_FORWARD, begin,
+    2.0 * R * C, 8.0 * ( (double) R * C + C + 2 * R ));
+}
+//    Y = AX + b        &Y (B x R), A,     X (B x C), B,    Rows (for A), Columns (for A), Batch size
+void  fully_connected_forward_batch(double* Y, double* A, double* X, double* b,
+  int R, int C, int B)
+{
+  fully_connected_forward_batch_strided(Y, A, C, X, b, R, C, B);
+}
+//    Y = AX + b        &Y (B x R), A,     Row stride (A), X (B x C), B,  Rows (for A), Columns (for A), Batch size
+void  fully_connected_forward_batch_strided(double* Y, double* A, int lda, double* X,
+  double* b, int R, int C, int B)
+{
+  int i = 0, n, k;
+  double *a, *x, sum, begin = ROOFLINE_BEGIN();
+
+  while ( i < R ) {
+    a = &A[i * lda];
+    k = 0;
+    while ( k < B ) {
+      x = &X[k * C];
+      sum = b[i];
+      n = 0;
+      while ( n < C ) {
+        sum += a[n] * x[n];
+        ++n;
+      }
+      Y[k * R + i] = sum;
+      ++k;
+    }
+    ++i;
+  }
+
+  ROOFLINE_END(ROOFLINE_FULLY_CONNECTED_FORWARD_BATCH, begin,
+    2.0 * R * C * B, 8.0 * ( (double) R * C + (double) B * C + R + (double) B * R ));
+}
+/*
+* Y = AX + b, or Y += AX when b is NULL. Four rows are computed
+* together so that every element of x is loaded once for four rows,
+* with four independent sums in registers.
+*/
+#define FULLY_CONNECTED_FORWARD_ROWS(COLUMNS, x) \
+  while ( i + 4 <= R ) { \
+    double *a0 = &A[i * lda], *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda; \
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0; \
+    n = 0; \
+    while ( n < (COLUMNS) ) { \
+      s0 += a0[n] * x[n]; \
+      s1 += a1[n] * x[n]; \
+      s2 += a2[n] * x[n]; \
+      s3 += a3[n] * x[n]; \
+      ++n; \
+    } \
+    if ( b != NULL ) { \
+      Y[i] = b[i] + s0; \
+      Y[i + 1] = b[i + 1] + s1; \
+      Y[i + 2] = b[i + 2] + s2; \
+      Y[i + 3] = b[i + 3] + s3; \
+    } else { \
+      Y[i] += s0; \
+      Y[i + 1] += s1; \
+      Y[i + 2] += s2; \
+      Y[i + 3] += s3; \
+    } \
+    i += 4; \
+  } \
+  while ( i < R ) { \
+    double *a0 = &A[i * lda], s0 = 0.0; \
+    n = 0; \
+    while ( n < (COLUMNS) ) { \
+      s0 += a0[n] * x[n]; \
+      ++n; \
+    } \
+    Y[i] = ( b != NULL ? b[i] : Y[i] ) + s0; \
+    ++i; \
+  }
+
+/*
+* The number of columns is a constant in these, so the compiler can
+* unroll and vectorize the loop over them. x is a local copy of X that
+* cannot alias Y, it stays in L1 (or registers) for all rows.
+*/
+#define FULLY_CONNECTED_FORWARD_FIXED(COLUMNS) \
+static void fully_connected_forward_##COLUMNS(double* Y, double* A, int lda, \
+  double* X, double* b, int R, int C) \
+{ \
+  double x[COLUMNS], begin = ROOFLINE_BEGIN(); \
+  int i = 0, n; \
+  (void) C; \
+  memcpy(x, X, sizeof(x)); \
+  FULLY_CONNECTED_FORWARD_ROWS(COLUMNS, x) \
+  ROOFLINE_END(ROOFLINE_FULLY_CONNECTED_FORWARD_FIXED, begin, \
+    2.0 * R * (COLUMNS), 8.0 * ( (double) R * (COLUMNS) + (COLUMNS) + 2 * R )); \
+}
+
+FULLY_CONNECTED_FORWARD_FIXED(32)
+FULLY_CONNECTED_FORWARD_FIXED(64)
+FULLY_CONNECTED_FORWARD_FIXED(128)
+FULLY_CONNECTED_FORWARD_FIXED(256)
+FULLY_CONNECTED_FORWARD_FIXED(512)
+
+//    Y = AX + b        &Y,         A,     Row stride (A), X,       b (or NULL), Rows (for A), Columns (for A)
+void  fully_connected_forward_strided(double* Y, double* A, int lda, double* X,
+  double* b, int R, int C)
+{
+  int i = 0, n;
+  double begin = ROOFLINE_BEGIN();
+
+  FULLY_CONNECTED_FORWARD_ROWS(C, X)
+  ROOFLINE_END(ROOFLINE_FULLY_CONNECTED_FORWARD_STRIDED, begin,
+    2.0 * R * C, 8.0 * ( (double) R * C + C + 2 * R ));
+}
+
+fully_connected_forward_t fully_connected_forward_select(int C)
+{
+  switch ( C ) {
+  case 32:
+    return fully_connected_forward_32;
+  case 64:
+    return fully_connected_forward_64;
+  case 128:
+    return fully_connected_forward_128;
+  case 256:
+    return fully_connected_forward_256;
+  case 512:
+    return fully_connected_forward_512;
+  default:
+    return fully_connected_forward_strided;
+  }
+}
+//    Y += AX           &Y,         A,     Row stride (A), X,       Rows (for A), Columns (for A)
+void  fully_connected_accumulate(double* Y, double* A, int lda, double* X, int R, int C)
+{
+  int i = 0, n;
+  double *a, sum, begin = ROOFLINE_BEGIN();
+
+  while ( i < R ) {
+    a = &A[i * lda];
+    sum = 0.0;
+    n = 0;
+    while ( n < C ) {
+      sum += a[n] * X[n];
+      ++n;
+    }
+    Y[i] += sum;
+    ++i;
+  }
+
+  ROOFLINE_END(ROOFLINE_FULLY_CONNECTED_ACCUMULATE, begin,
+    2.0 * R * C, 8.0 * ( (double) R * C + C + 2 * R ));
 }
 //    Y = AX + b        dldY,       A,     X,        &dldA,    &dldX,    &dldb   Rows (A), Columns (A)
 void  fully_connected_backward(double* dldY, double* A, double* X,double* dldA,
   double* dldX, double* dldb, int R, int C)
 {
   int i = 0, n = 0;
+  double begin = ROOFLINE_BEGIN();
 
   // computing dldA
   while ( i < R ) {
@@ -89,11 +244,40 @@ void  fully_connected_backward(double* dldY, double* A, double* X,double* dldA,
 
     ++i;
   }
+
+  // dldA is written, A read, dldY read and copied to dldb
+  ROOFLINE_END(ROOFLINE_FULLY_CONNECTED_BACKWARD, begin,
+    3.0 * R * C, 8.0 * ( 2.0 * R * C + 2 * C + 2 * R ));
 }
 
 double cross_entropy(double* probabilities, int correct)
 {
-  return -log(probabilities[correct]);  
+  double begin = ROOFLINE_BEGIN(), loss = -log(probabilities[correct]);
+
+  ROOFLINE_END(ROOFLINE_CROSS_ENTROPY, begin, 1, 8);
+  return loss;
+}
+
+//    log P[c] where P is the softmax of Y (temperature 1)
+double log_softmax(double* Y, int F, int c)
+{
+  int f = 0;
+  double sum = 0, max = Y[0], begin = ROOFLINE_BEGIN();
+
+  while ( f < F ) {
+    if ( Y[f] > max )
+      max = Y[f];
+    ++f;
+  }
+
+  f = 0;
+  while ( f < F ) {
+    sum += exp(Y[f] - max);
+    ++f;
+  }
+
+  ROOFLINE_END(ROOFLINE_LOG_SOFTMAX, begin, 3.0 * F + 3, 8.0 * F);
+  return Y[c] - max - log(sum);
 }
 
 // Dealing with softmax layer, forward and backward
@@ -101,41 +285,35 @@ double cross_entropy(double* probabilities, int correct)
 void  softmax_layers_forward(double* P, double* Y, int F, double temperature)  
 {
   int f = 0;
-  double sum = 0;
-#ifdef WINDOWS
-  // MSVC is not a C99 compiler, and does not support variable length arrays
-  // MSVC is documented as conforming to C90
-  double *cache = malloc(sizeof(double)*F);
+  double sum = 0, max = Y[0], begin = ROOFLINE_BEGIN();
 
-  if ( cache == NULL ) {
-    fprintf(stderr, "%s.%s.%d malloc(%zu) failed\r\n", 
-      __FILE__, __func__, __LINE__, sizeof(double)*F);
-    exit(1);
+  // P may point to Y, the exponentials are computed in place
+  while ( f < F ) {
+    if ( Y[f] > max )
+      max = Y[f];
+    ++f;
   }
-#else
-  double cache[F];
-#endif
 
+  f = 0;
   while ( f < F ) {
-    cache[f] = exp(Y[f] / temperature);
-    sum += cache[f];
+    P[f] = exp((Y[f] - max) / temperature);
+    sum += P[f];
     ++f;
   }
 
   f = 0;
   while ( f < F ) {
-    P[f] = cache[f] / sum;
+    P[f] /= sum;
     ++f;
   }
 
-#ifdef WINDOWS
-  free(cache);
-#endif
+  ROOFLINE_END(ROOFLINE_SOFTMAX_FORWARD, begin, 5.0 * F, 16.0 * F);
 }
 //                    P,    c,  &dldh, rows
 void  softmax_loss_layer_backward(double* P, int c, double* dldh, int R)
 { 
   int r = 0;
+  double begin = ROOFLINE_BEGIN();
 
   while ( r < R ) {
     dldh[r] = P[r];
@@ -143,6 +321,7 @@ void  softmax_loss_layer_backward(double* P, int c, double* dldh, int R)
   }
 
   dldh[c] -= 1.0;
+  ROOFLINE_END(ROOFLINE_SOFTMAX_BACKWARD, begin, 1, 16.0 * R);
 }
 // Other layers used: sigmoid and tanh
 //  
@@ -150,39 +329,51 @@ void  softmax_loss_layer_backward(double* P, int c, double* dldh, int R)
 void  sigmoid_forward(double* Y, double* X, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
 
   while ( l < L ) {
     Y[l] = 1.0 / ( 1.0 + exp(-X[l]));
     ++l;
   }
 
+  ROOFLINE_END(ROOFLINE_SIGMOID_FORWARD, begin, 4.0 * L, 16.0 * L);
 }
 //    Y = sigmoid(X), dldY, Y, &dldX, length
 void  sigmoid_backward(double* dldY, double* Y, double* dldX, int L) 
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
 
   while ( l < L ) {
     dldX[l] = ( 1.0 - Y[l] ) * Y[l] * dldY[l];
     ++l;
   }
 
+  ROOFLINE_END(ROOFLINE_SIGMOID_BACKWARD, begin, 3.0 * L, 24.0 * L);
 }
 //    Y = tanh(X), &Y, X, length
 void  tanh_forward(double* Y, double* X, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
+
   while ( l < L ) {
     Y[l] = tanh(X[l]);
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_TANH_FORWARD, begin, L, 16.0 * L);
 }
 //    Y = tanh(X), dldY, Y, &dldX, length
 void  tanh_backward(double* dldY, double* Y, double* dldX, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
+
   while ( l < L ) {
     dldX[l] = ( 1.0 - Y[l] * Y[l] ) * dldY[l];
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_TANH_BACKWARD, begin, 3.0 * L, 24.0 * L);
 }
@@ -37,6 +37,43 @@
 */
 void fully_connected_forward(double* Y, double* A, double* X,
 	double* b, int R, int C);
+/**	Y = AX + b, for B inputs at once
+*
+*  A(rows: R, columns: C), X(rows: B, columns: C), Y(rows: B, columns: R)
+*
+*  Each row of A is used against all B inputs before moving on,
+*  so the weights are read once per batch instead of once per input.
+*/
+void fully_connected_forward_batch(double* Y, double* A, double* X,
+	double* b, int R, int C, int B);
+/**	Y = AX + b, for B inputs at once, A being C columns of a wider matrix
+*
+*  Row i of A starts at A[i * lda], so A can point into a matrix
+*  to multiply with a subset of its columns.
+*/
+void fully_connected_forward_batch_strided(double* Y, double* A, int lda,
+	double* X, double* b, int R, int C, int B);
+/**	Y = AX + b, or Y += AX when b is NULL, A being C columns of a wider matrix
+*
+*  Row i of A starts at A[i * lda]. Four rows are computed at a time.
+*/
+void fully_connected_forward_strided(double* Y, double* A, int lda,
+	double* X, double* b, int R, int C);
+/** A kernel computing the same as \ref fully_connected_forward_strided */
+typedef void (*fully_connected_forward_t)(double* Y, double* A, int lda,
+	double* X, double* b, int R, int C);
+/**	The fastest kernel for C columns
+*
+*  For C = 32, 64, 128, 256 and 512 this is a kernel compiled for
+*  exactly that many columns, otherwise \ref fully_connected_forward_strided.
+*/
+fully_connected_forward_t fully_connected_forward_select(int C);
+/**	Y += AX, A being C columns of a wider matrix
+*
+*  Row i of A starts at A[i * lda].
+*/
+void fully_connected_accumulate(double* Y, double* A, int lda, double* X,
+	int R, int C);
 /**		Y = AX + b
 * 
 * A(rows: R, columns: C)
@@ -83,4 +120,11 @@ void tanh_backward(double* dldY, double* Y, double* dldX, int L);
 * @param correct the index that represents the correct observation
 */
 double cross_entropy(double* probabilities, int correct);
+/** Log probability of one output, taken directly from the logits
+* @param Y logits, before softmax
+* @param F len ( Y )
+* @param c the index whose log probability is returned
+* @return log ( softmax ( Y ) [c] ), at temperature 1
+*/
+double log_softmax(double* Y, int F, int c);
 
@@ -22,6 +22,18 @@
 */
 
 #include "lstm.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "roofline.h"
+#include "std_conf.h"
+
+#ifndef WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Arrays of training state in a checkpoint at most, see lstm_trainer_arrays
+#define LSTM_TRAIN_ARRAYS     ( LSTM_MAX_LAYERS * ( 2 * LSTM_WEIGHT_ARRAYS + 2 ) )
 
 void lstm_init_fail(const char * msg)
 {
@@ -29,6 +41,63 @@ void lstm_init_fail(const char * msg)
   exit(-1);
 }
 
+// The generator used for weight initialization, seeded on first use
+static uint64_t* lstm_random_state(lstm_model_parameters_t *params)
+{
+  if ( params->random_state == 0 )
+    random_seed(&params->random_state, params->seed != 0 ? params->seed + 1 : 0);
+  return &params->random_state;
+}
+
+void lstm_init_parameters(lstm_model_parameters_t *params)
+{
+  memset(params, 0, sizeof(*params));
+
+  params->iterations = ITERATIONS;
+  params->epochs = NO_EPOCHS;
+  params->loss_moving_avg = LOSS_MOVING_AVG;
+  params->learning_rate = STD_LEARNING_RATE;
+  params->momentum = STD_MOMENTUM;
+  params->lambda = STD_LAMBDA;
+  params->softmax_temp = SOFTMAX_TEMP;
+  params->sampler = SAMPLER_MULTINOMIAL;
+  params->top_k = STD_TOP_K;
+  params->top_p = STD_TOP_P;
+  params->seed = 0;
+  params->mini_batch_size = MINI_BATCH_SIZE;
+  params->gradient_clip_limit = GRADIENT_CLIP_LIMIT;
+  params->learning_rate_decrease = STD_LEARNING_RATE_DECREASE;
+  params->stateful = STATEFUL;
+  params->beta1 = 0.9;
+  params->beta2 = 0.999;
+  params->gradient_fit = GRADIENTS_FIT;
+  params->gradient_clip = GRADIENTS_CLIP;
+  params->decrease_lr = DECREASE_LR;
+  params->model_regularize = MODEL_REGULARIZE;
+  params->layers = LAYERS;
+  params->neurons = NEURONS;
+  params->optimizer = OPTIMIZE_ADAM;
+  // Interaction configuration with the training of the network
+  params->print_progress = PRINT_PROGRESS;
+  params->print_progress_iterations = PRINT_EVERY_X_ITERATIONS;
+  params->print_progress_sample_output = PRINT_SAMPLE_OUTPUT;
+  params->print_progress_to_file = PRINT_SAMPLE_OUTPUT_TO_FILE;
+  params->print_progress_number_of_chars = NUMBER_OF_CHARS_TO_DISPLAY_DURING_TRAINING;
+  params->print_sample_output_to_file_arg = PRINT_SAMPLE_OUTPUT_TO_FILE_ARG;
+  params->print_sample_output_to_file_name = PRINT_SAMPLE_OUTPUT_TO_FILE_NAME;
+  params->store_progress_every_x_iterations = STORE_PROGRESS_EVERY_X_ITERATIONS;
+  params->store_progress_file_name = PROGRESS_FILE_NAME;
+  params->store_network_name_raw = STD_LOADABLE_NET_NAME;
+  params->store_network_name_json = STD_JSON_NET_NAME;
+  params->store_char_indx_map_name = JSON_KEY_NAME_SET;
+  params->store_network_json_format = STD_JSON_FORMAT;
+  params->store_network_delta_every = STD_DELTA_EVERY;
+  params->store_network_delta_encoding = STD_DELTA_ENCODING;
+  params->store_network_dtype = STD_NETWORK_DTYPE;
+  params->profile = 0;
+  params->verify_network = 0;
+}
+
 // Inputs, Neurons, Outputs, &lstm model, zeros
 int lstm_init_model(int X, int N, int Y, 
   lstm_model_t **model_to_be_set, int zeros, 
@@ -41,6 +110,7 @@ int lstm_init_model(int X, int N, int Y,
   lstm->N = N;
   lstm->S = S;
   lstm->Y = Y;
+  lstm->forward_N = fully_connected_forward_select(N);
 
   lstm->params = params;
 
@@ -51,11 +121,12 @@ int lstm_init_model(int X, int N, int Y,
     lstm->Wo = get_zero_vector(N * S);
     lstm->Wy = get_zero_vector(Y * N);
   } else {
-    lstm->Wf = get_random_vector(N * S, S);
-    lstm->Wi = get_random_vector(N * S, S);
-    lstm->Wc = get_random_vector(N * S, S);
-    lstm->Wo = get_random_vector(N * S, S);
-    lstm->Wy = get_random_vector(Y * N, N);
+    uint64_t *random_state = lstm_random_state(params);
+    lstm->Wf = get_random_vector(N * S, S, random_state);
+    lstm->Wi = get_random_vector(N * S, S, random_state);
+    lstm->Wc = get_random_vector(N * S, S, random_state);
+    lstm->Wo = get_random_vector(N * S, S, random_state);
+    lstm->Wy = get_random_vector(Y * N, N, random_state);
   }
 
   lstm->bf = get_zero_vector(N);
@@ -96,6 +167,16 @@ int lstm_init_model(int X, int N, int Y,
 //					 lstm model to be freed
 void lstm_free_model(lstm_model_t* lstm)
 {
+#ifndef WINDOWS
+  if ( lstm->mapping != NULL ) {
+    munmap(lstm->mapping, lstm->mapping_size);
+    lstm->mapping = NULL;
+    // The weights pointed into the mapping
+    lstm->Wf = lstm->Wi = lstm->Wc = lstm->Wo = lstm->Wy = NULL;
+    lstm->bf = lstm->bi = lstm->bc = lstm->bo = lstm->by = NULL;
+  }
+#endif
+
   free_vector(&lstm->Wf);
   free_vector(&lstm->Wi);
   free_vector(&lstm->Wc);
@@ -573,19 +654,6 @@ void lstm_forward_propagate(lstm_model_t* model, double *input,
   Y = model->Y;
   S = model->S;
 
-#ifdef WINDOWS
-  // MSVC is not a C99 compiler, and does not support variable length arrays
-  // MSVC is documented as conforming to C90
-  double *tmp;
-  if ( init_zero_vector(&tmp, N) ) {
-    fprintf(stderr, "%s.%s.%d init_zero_vector(.., %d) failed\r\n", 
-      __FILE__, __func__, __LINE__, N);
-    exit(1);
-  }
-#else
-  double tmp[N]; // VLA must be supported.. May cause portability problems.. If so use init_zero_vector (will be slower).
-#endif
-
   copy_vector(cache_out->h_old, h_old, N);
   copy_vector(cache_out->c_old, c_old, N);
 
@@ -600,26 +668,32 @@ void lstm_forward_propagate(lstm_model_t* model, double *input,
     ++i;
   }
 
-  // Fully connected + sigmoid layers 
-  fully_connected_forward(cache_out->hf, model->Wf, X_one_hot, model->bf, N, S);
+  // Fully connected + sigmoid layers, the N columns of h_old
+  // with the kernel selected for N and then the inputs
+  model->forward_N(cache_out->hf, model->Wf, S, h_old, model->bf, N, N);
+  fully_connected_accumulate(cache_out->hf, model->Wf + N, S, input, N, S - N);
   sigmoid_forward(cache_out->hf, cache_out->hf, N);
 
-  fully_connected_forward(cache_out->hi, model->Wi, X_one_hot, model->bi, N, S);
+  model->forward_N(cache_out->hi, model->Wi, S, h_old, model->bi, N, N);
+  fully_connected_accumulate(cache_out->hi, model->Wi + N, S, input, N, S - N);
   sigmoid_forward(cache_out->hi, cache_out->hi, N);
 
-  fully_connected_forward(cache_out->ho, model->Wo, X_one_hot, model->bo, N, S);
+  model->forward_N(cache_out->ho, model->Wo, S, h_old, model->bo, N, N);
+  fully_connected_accumulate(cache_out->ho, model->Wo + N, S, input, N, S - N);
   sigmoid_forward(cache_out->ho, cache_out->ho, N);
 
-  fully_connected_forward(cache_out->hc, model->Wc, X_one_hot, model->bc, N, S);
+  model->forward_N(cache_out->hc, model->Wc, S, h_old, model->bc, N, N);
+  fully_connected_accumulate(cache_out->hc, model->Wc + N, S, input, N, S - N);
   tanh_forward(cache_out->hc, cache_out->hc, N);
 
   // c = hf * c_old + hi * hc
+  // (tanh_c_cache holds hi * hc until it is set below)
   copy_vector(cache_out->c, cache_out->hf, N);
   vectors_multiply(cache_out->c, c_old, N);
-  copy_vector(tmp, cache_out->hi, N);
-  vectors_multiply(tmp, cache_out->hc, N);
+  copy_vector(cache_out->tanh_c_cache, cache_out->hi, N);
+  vectors_multiply(cache_out->tanh_c_cache, cache_out->hc, N);
 
-  vectors_add(cache_out->c, tmp, N);
+  vectors_add(cache_out->c, cache_out->tanh_c_cache, N);
 
   // h = ho * tanh_c_cache
   tanh_forward(cache_out->tanh_c_cache, cache_out->c, N);
@@ -627,9 +701,11 @@ void lstm_forward_propagate(lstm_model_t* model, double *input,
   vectors_multiply(cache_out->h, cache_out->tanh_c_cache, N);
 
   // probs = softmax ( Wy*h + by )
-  fully_connected_forward(cache_out->probs, model->Wy, cache_out->h, model->by, Y, N);
+  model->forward_N(cache_out->probs, model->Wy, N, cache_out->h, model->by, Y, N);
   if ( softmax > 0 ) {
-    softmax_layers_forward(cache_out->probs, cache_out->probs, Y, model->params->softmax_temp);
+    // Only training takes the softmax here, its gradient assumes temperature 1.
+    // The temperature (-temp) is applied when sampling, see lstm_sampler_init.
+    softmax_layers_forward(cache_out->probs, cache_out->probs, Y, 1.0);
   } 
 #ifdef INTERLAYER_SIGMOID_ACTIVATION
   if ( softmax <= 0 ) {
@@ -639,11 +715,6 @@ void lstm_forward_propagate(lstm_model_t* model, double *input,
 #endif
 
   copy_vector(cache_out->X, X_one_hot, S);
-
-#ifdef WINDOWS
-  free_vector(&tmp);
-#endif
-
 }
 //							model, y_probabilities, y_correct, the next deltas, state and cache values, &gradients, &the next deltas
 void lstm_backward_propagate(lstm_model_t* model, double* y_probabilities, int y_correct, 
@@ -828,10 +899,29 @@ void lstm_store_net_layers(lstm_model_t** model, FILE *fp, unsigned int layers)
   }
 }
 
+/* One weight array of a layer in the JSON file, R is 0 for a vector */
+static void lstm_json_weights(writer_t *writer, const char *before,
+  const char *name, const double *V, int R, int C, int format)
+{
+  writer_write(writer, before, strlen(before));
+  writer_putc(writer, '"');
+  writer_write(writer, name, strlen(name));
+  writer_write(writer, "\": ", 3);
+
+  if ( format == LSTM_JSON_FLOAT32 )
+    vector_write_float32_json(writer, V, R, C);
+  else if ( R > 0 )
+    vector_write_matrix_json(writer, V, R, C);
+  else
+    vector_write_json(writer, V, C);
+}
+
 void lstm_store_net_layers_as_json(lstm_model_t** model, const char * filename, 
-  const char *set_name, set_t *set, unsigned int layers)
+  const char *set_name, set_t *set, unsigned int layers, int format)
 {
   FILE * fp;
+  writer_t writer;
+  char line[64];
   unsigned int p = 0;
 
   fp = fopen(filename, "w");
@@ -846,58 +936,537 @@ void lstm_store_net_layers_as_json(lstm_model_t** model, const char * filename,
 
   fprintf(fp, ",\n\"LSTM layers\": %d,\n", layers);
 
+  writer_init(&writer, fp);
+
   while ( p < layers ) {
 
     if ( p > 0 ) 
-      fprintf(fp, ",\n");
-
-    fprintf(fp, "\"Layer %d\": {\n", p+1);
-
-    fprintf(fp, "\t\"Wy\": ");
-    vector_store_as_matrix_json(model[p]->Wy, model[p]->Y, model[p]->N, fp);
-    fprintf(fp, ",\n\t\"Wi\": ");
-    vector_store_as_matrix_json(model[p]->Wi, model[p]->N, model[p]->S, fp);
-    fprintf(fp, ",\n\t\"Wc\": ");
-    vector_store_as_matrix_json(model[p]->Wc, model[p]->N, model[p]->S, fp);
-    fprintf(fp, ",\n\t\"Wo\": ");
-    vector_store_as_matrix_json(model[p]->Wo, model[p]->N, model[p]->S, fp);
-    fprintf(fp, ",\n\t\"Wf\": ");
-    vector_store_as_matrix_json(model[p]->Wf, model[p]->N, model[p]->S, fp);
-
-    fprintf(fp, ",\n\t\"by\": ");
-    vector_store_json(model[p]->by, model[p]->Y, fp);
-    fprintf(fp, ",\n\t\"bi\": ");
-    vector_store_json(model[p]->bi, model[p]->N, fp);
-    fprintf(fp, ",\n\t\"bc\": ");
-    vector_store_json(model[p]->bc, model[p]->N, fp);
-    fprintf(fp, ",\n\t\"bf\": ");
-    vector_store_json(model[p]->bf, model[p]->N, fp);
-    fprintf(fp, ",\n\t\"bo\": ");
-    vector_store_json(model[p]->bo, model[p]->N, fp);
-
-    fprintf(fp, "}\n");
+      writer_write(&writer, ",\n", 2);
+
+    snprintf(line, sizeof(line), "\"Layer %d\": {", p+1);
+    writer_write(&writer, line, strlen(line));
+
+    lstm_json_weights(&writer, "\n\t", "Wy", model[p]->Wy, model[p]->Y, model[p]->N, format);
+    lstm_json_weights(&writer, ",\n\t", "Wi", model[p]->Wi, model[p]->N, model[p]->S, format);
+    lstm_json_weights(&writer, ",\n\t", "Wc", model[p]->Wc, model[p]->N, model[p]->S, format);
+    lstm_json_weights(&writer, ",\n\t", "Wo", model[p]->Wo, model[p]->N, model[p]->S, format);
+    lstm_json_weights(&writer, ",\n\t", "Wf", model[p]->Wf, model[p]->N, model[p]->S, format);
+
+    lstm_json_weights(&writer, ",\n\t", "by", model[p]->by, 0, model[p]->Y, format);
+    lstm_json_weights(&writer, ",\n\t", "bi", model[p]->bi, 0, model[p]->N, format);
+    lstm_json_weights(&writer, ",\n\t", "bc", model[p]->bc, 0, model[p]->N, format);
+    lstm_json_weights(&writer, ",\n\t", "bf", model[p]->bf, 0, model[p]->N, format);
+    lstm_json_weights(&writer, ",\n\t", "bo", model[p]->bo, 0, model[p]->N, format);
+
+    writer_write(&writer, "}\n", 2);
 
     ++p;
   }
 
-  fprintf(fp, "}\n");
+  writer_write(&writer, "}\n", 2);
+  writer_flush(&writer);
 
   fclose(fp);
 
 }
 
 // Exits the program if EOF is encountered
-static void e_lstm_fgets(char *str, size_t n, FILE *fp)
+static int e_lstm_fgets(char *str, size_t n, FILE *fp)
 {
   if ( fgets(str,n,fp) == NULL ) {
     fprintf(stderr, "lstm_read error: unexpected EOF. \
 Net-file incompatible with current version.\n"); 
     fflush(stderr);
-    exit(1);
+    return -1;
+  }
+  return 0;
+}
+
+void lstm_weight_arrays(lstm_model_t *model, double ***arrays, size_t *counts)
+{
+  size_t N = model->N, S = model->S, Y = model->Y;
+
+  arrays[0] = &model->Wy; counts[0] = Y * N;
+  arrays[1] = &model->Wi; counts[1] = N * S;
+  arrays[2] = &model->Wc; counts[2] = N * S;
+  arrays[3] = &model->Wo; counts[3] = N * S;
+  arrays[4] = &model->Wf; counts[4] = N * S;
+  arrays[5] = &model->by; counts[5] = Y;
+  arrays[6] = &model->bi; counts[6] = N;
+  arrays[7] = &model->bc; counts[7] = N;
+  arrays[8] = &model->bf; counts[8] = N;
+  arrays[9] = &model->bo; counts[9] = N;
+}
+
+static uint64_t lstm_file_array_size(size_t count)
+{
+  uint64_t bytes = (uint64_t) count * sizeof(double);
+  return ( bytes + LSTM_FILE_ARRAY_ALIGNMENT - 1 )
+    / LSTM_FILE_ARRAY_ALIGNMENT * LSTM_FILE_ARRAY_ALIGNMENT;
+}
+
+static uint64_t lstm_file_align(uint64_t offset)
+{
+  return ( offset + LSTM_FILE_ALIGNMENT - 1 ) / LSTM_FILE_ALIGNMENT * LSTM_FILE_ALIGNMENT;
+}
+
+static uint64_t lstm_file_section_size(uint64_t X, uint64_t N, uint64_t Y)
+{
+  return lstm_file_array_size(Y * N) + 4 * lstm_file_array_size(N * ( X + N ))
+    + lstm_file_array_size(Y) + 4 * lstm_file_array_size(N);
+}
+
+/* Bytes of count weights stored as dtype (without LSTM_DTYPE_ENTROPY) */
+static uint64_t lstm_file_packed_size(unsigned int dtype, uint64_t count)
+{
+  switch ( dtype ) {
+  case LSTM_DTYPE_HALF:
+  case LSTM_DTYPE_BFLOAT16:
+    return count * sizeof(uint16_t);
+  case LSTM_DTYPE_INT8:
+    return sizeof(double) + count;
+  default:
+    return count * sizeof(double);
+  }
+}
+
+static uint64_t lstm_file_packed_section_size(unsigned int dtype,
+  uint64_t X, uint64_t N, uint64_t Y)
+{
+  return lstm_file_packed_size(dtype, Y * N) + 4 * lstm_file_packed_size(dtype, N * ( X + N ))
+    + lstm_file_packed_size(dtype, Y) + 4 * lstm_file_packed_size(dtype, N);
+}
+
+/* Bytes per value, the number of planes of an entropy coded section */
+static unsigned int lstm_file_value_size(unsigned int dtype)
+{
+  return (unsigned int) ( lstm_file_packed_size(dtype, 2) - lstm_file_packed_size(dtype, 1) );
+}
+
+static void lstm_file_pack(unsigned int dtype, const double *V, size_t count,
+  unsigned char *out)
+{
+  double max = 0.0, scale;
+  uint16_t value;
+  long q;
+  size_t i = 0;
+
+  switch ( dtype ) {
+  case LSTM_DTYPE_HALF:
+  case LSTM_DTYPE_BFLOAT16:
+    while ( i < count ) {
+      value = dtype == LSTM_DTYPE_HALF ? float_to_half((float) V[i])
+        : float_to_bfloat16((float) V[i]);
+      memcpy(&out[i * sizeof(value)], &value, sizeof(value));
+      ++i;
+    }
+    break;
+  case LSTM_DTYPE_INT8:
+    while ( i < count ) {
+      if ( fabs(V[i]) > max )
+        max = fabs(V[i]);
+      ++i;
+    }
+    scale = max / 127.0;
+    memcpy(out, &scale, sizeof(scale));
+    out += sizeof(scale);
+
+    i = 0;
+    while ( i < count ) {
+      q = scale > 0.0 ? lround(V[i] / scale) : 0;
+      out[i] = (unsigned char) (signed char) ( q > 127 ? 127 : ( q < -127 ? -127 : q ) );
+      ++i;
+    }
+    break;
+  default:
+    memcpy(out, V, count * sizeof(double));
+    break;
+  }
+}
+
+static void lstm_file_unpack(unsigned int dtype, const unsigned char *in,
+  double *V, size_t count)
+{
+  double scale;
+  uint16_t value;
+  size_t i = 0;
+
+  switch ( dtype ) {
+  case LSTM_DTYPE_HALF:
+  case LSTM_DTYPE_BFLOAT16:
+    while ( i < count ) {
+      memcpy(&value, &in[i * sizeof(value)], sizeof(value));
+      V[i] = dtype == LSTM_DTYPE_HALF ? half_to_float(value) : bfloat16_to_float(value);
+      ++i;
+    }
+    break;
+  case LSTM_DTYPE_INT8:
+    memcpy(&scale, in, sizeof(scale));
+    in += sizeof(scale);
+    while ( i < count ) {
+      V[i] = (signed char) in[i] * scale;
+      ++i;
+    }
+    break;
+  default:
+    memcpy(V, in, count * sizeof(double));
+    break;
+  }
+}
+
+/*
+* Pack the weights of a layer as dtype, entropy coded plane by plane with
+* LSTM_DTYPE_ENTROPY, see lstm_file_header_t. Free the section after use.
+*/
+static unsigned char* lstm_file_pack_layer(const lstm_model_t *model, unsigned int dtype,
+  uint64_t *size)
+{
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  unsigned int type = dtype & ~LSTM_DTYPE_ENTROPY;
+  unsigned int planes = lstm_file_value_size(type), p = 0;
+  uint64_t packed_size = lstm_file_packed_section_size(type, model->X, model->N, model->Y);
+  unsigned char *section = e_calloc((size_t) packed_size, 1), *coded, *plane;
+  size_t offset = 0, length, i;
+  uint32_t coded_size;
+  int a = 0;
+
+  lstm_weight_arrays((lstm_model_t*) model, arrays, counts);
+  while ( a < LSTM_WEIGHT_ARRAYS ) {
+    lstm_file_pack(type, *arrays[a], counts[a], &section[offset]);
+    offset += (size_t) lstm_file_packed_size(type, counts[a]);
+    ++a;
+  }
+
+  if ( !( dtype & LSTM_DTYPE_ENTROPY ) ) {
+    *size = packed_size;
+    return section;
+  }
+
+  length = (size_t) packed_size / planes;
+  plane = e_calloc(length + 1, 1);
+  coded = e_calloc(planes * ( sizeof(coded_size) + entropy_bound(length) ), 1);
+  offset = 0;
+  while ( p < planes ) {
+    i = 0;
+    while ( i < length ) {
+      plane[i] = section[i * planes + p];
+      ++i;
+    }
+    coded_size = (uint32_t) entropy_encode(plane, length, &coded[offset + sizeof(coded_size)]);
+    memcpy(&coded[offset], &coded_size, sizeof(coded_size));
+    offset += sizeof(coded_size) + coded_size;
+    ++p;
+  }
+
+  free(plane);
+  free(section);
+  *size = offset;
+  return coded;
+}
+
+/* Read a layer stored as another type than doubles, see lstm_file_pack_layer */
+static int lstm_read_packed_layer(lstm_model_t *model, FILE *fp,
+  const lstm_file_layer_t *layer, unsigned int dtype)
+{
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  unsigned int type = dtype & ~LSTM_DTYPE_ENTROPY;
+  unsigned int planes = lstm_file_value_size(type), p = 0;
+  uint64_t packed_size = lstm_file_packed_section_size(type, model->X, model->N, model->Y);
+  unsigned char *data, *section, *plane;
+  size_t offset = 0, length, i;
+  uint32_t coded_size;
+  int a = 0, ret = 0;
+
+  data = e_calloc((size_t) layer->size + 1, 1);
+  if ( fseek(fp, (long) layer->offset, SEEK_SET) != 0 ||
+    fread(data, 1, (size_t) layer->size, fp) != layer->size ||
+    crc32_update(0, data, (size_t) layer->size) != layer->crc ) {
+    free(data);
+    return -1;
+  }
+
+  section = data;
+  if ( dtype & LSTM_DTYPE_ENTROPY ) {
+    length = (size_t) packed_size / planes;
+    section = e_calloc((size_t) packed_size, 1);
+    plane = e_calloc(length + 1, 1);
+    while ( p < planes && ret == 0 ) {
+      if ( offset + sizeof(coded_size) > layer->size ) {
+        ret = -1;
+        break;
+      }
+      memcpy(&coded_size, &data[offset], sizeof(coded_size));
+      offset += sizeof(coded_size);
+      if ( coded_size > layer->size - offset ||
+        entropy_decode(&data[offset], coded_size, plane, length) < 0 ) {
+        ret = -1;
+        break;
+      }
+      offset += coded_size;
+
+      i = 0;
+      while ( i < length ) {
+        section[i * planes + p] = plane[i];
+        ++i;
+      }
+      ++p;
+    }
+    if ( offset != layer->size )
+      ret = -1;
+    free(plane);
+    free(data);
+  }
+
+  if ( ret == 0 ) {
+    offset = 0;
+    lstm_weight_arrays(model, arrays, counts);
+    while ( a < LSTM_WEIGHT_ARRAYS ) {
+      lstm_file_unpack(type, &section[offset], *arrays[a], counts[a]);
+      offset += (size_t) lstm_file_packed_size(type, counts[a]);
+      ++a;
+    }
+  }
+
+  free(section);
+  return ret;
+}
+
+/*
+* Copy mapped weights to allocated memory and drop the mapping,
+* for changes that reallocate the weights.
+*/
+static void lstm_model_unmap(lstm_model_t *model)
+{
+#ifndef WINDOWS
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  double *copy;
+  int a = 0;
+
+  if ( model->mapping == NULL )
+    return;
+
+  lstm_weight_arrays(model, arrays, counts);
+  while ( a < LSTM_WEIGHT_ARRAYS ) {
+    copy = e_calloc(counts[a], sizeof(double));
+    memcpy(copy, *arrays[a], counts[a] * sizeof(double));
+    *arrays[a] = copy;
+    ++a;
+  }
+
+  munmap(model->mapping, model->mapping_size);
+  model->mapping = NULL;
+  model->mapping_size = 0;
+#else
+  (void) model;
+#endif
+}
+
+static void lstm_file_pad(FILE *fp, uint64_t bytes)
+{
+  static const char zeros[LSTM_FILE_ALIGNMENT];
+  size_t part;
+
+  while ( bytes > 0 ) {
+    part = bytes > sizeof(zeros) ? sizeof(zeros) : (size_t) bytes;
+    fwrite(zeros, 1, part, fp);
+    bytes -= part;
+  }
+}
+
+/*
+* Point the weights of a layer into its section of the file, mapped
+* copy on write. Returns 0 on success, -1 if it could not be mapped.
+*/
+static int lstm_map_layer(lstm_model_t *model, int fd, const lstm_file_layer_t *layer)
+{
+#ifndef WINDOWS
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  char *section;
+  int a = 0;
+
+  section = mmap(NULL, layer->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+    fd, (off_t) layer->offset);
+  if ( section == MAP_FAILED )
+    return -1;
+
+  model->mapping = section;
+  model->mapping_size = layer->size;
+
+  lstm_weight_arrays(model, arrays, counts);
+  while ( a < LSTM_WEIGHT_ARRAYS ) {
+    free_vector(arrays[a]);
+    *arrays[a] = (double*) section;
+    section += lstm_file_array_size(counts[a]);
+    ++a;
+  }
+  return 0;
+#else
+  (void) model;
+  (void) fd;
+  (void) layer;
+  return -1;
+#endif
+}
+
+/* Read the weights of a layer from its section of the file and check them */
+static int lstm_read_layer(lstm_model_t *model, FILE *fp, const lstm_file_layer_t *layer)
+{
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  uint32_t crc = 0;
+  uint64_t pad;
+  char padding[LSTM_FILE_ARRAY_ALIGNMENT];
+  int a = 0;
+
+  if ( fseek(fp, (long) layer->offset, SEEK_SET) != 0 )
+    return -1;
+
+  lstm_weight_arrays(model, arrays, counts);
+  while ( a < LSTM_WEIGHT_ARRAYS ) {
+    pad = lstm_file_array_size(counts[a]) - counts[a] * sizeof(double);
+    if ( fread(*arrays[a], sizeof(double), counts[a], fp) != counts[a] ||
+      fread(padding, 1, (size_t) pad, fp) != pad )
+      return -1;
+    crc = crc32_update(crc, *arrays[a], counts[a] * sizeof(double));
+    crc = crc32_update(crc, padding, (size_t) pad);
+    ++a;
+  }
+
+  return crc == layer->crc ? 0 : -1;
+}
+
+static int lstm_load_v2(FILE *fp, const char *path, set_t *set,
+  lstm_model_parameters_t *params, lstm_model_t ***model)
+{
+  lstm_file_header_t header;
+  lstm_file_layer_t table[LSTM_MAX_LAYERS];
+  uint64_t file_size = 0;
+  uint32_t crc;
+  unsigned int L, F, l;
+  int mapped = 0, verify, packed, ret = 0;
+
+  rewind(fp);
+  if ( fread(&header, sizeof(header), 1, fp) != 1 ) {
+    fprintf(stderr, "%s error: %s is truncated.\n", __func__, path);
+    return -1;
+  }
+
+  if ( header.version != BINARY_FILE_VERSION ||
+    ( header.dtype & ~LSTM_DTYPE_ENTROPY ) > LSTM_DTYPE_INT8 ||
+    header.alignment != LSTM_FILE_ALIGNMENT ) {
+    fprintf(stderr, "%s error: %s has unsupported version %u, type %u or alignment %u.\n",
+      __func__, path, header.version, header.dtype, header.alignment);
+    return -1;
+  }
+
+  L = header.layers;
+  F = header.features;
+  if ( L == 0 || L > LSTM_MAX_LAYERS || F == 0 || F > sizeof(header.set) ) {
+    fprintf(stderr, "%s error: Failed to load network, bad number of layers or features.\n",
+      __func__);
+    return -1;
+  }
+
+  if ( fread(table, sizeof(lstm_file_layer_t), L, fp) != L ) {
+    fprintf(stderr, "%s error: %s is truncated.\n", __func__, path);
+    return -1;
+  }
+
+  crc = header.crc;
+  header.crc = 0;
+  if ( crc32_update(crc32_update(0, &header, sizeof(header)),
+    table, L * sizeof(lstm_file_layer_t)) != crc ) {
+    fprintf(stderr, "%s error: %s has a bad header checksum.\n", __func__, path);
+    return -1;
+  }
+
+  // Weights stored as another type are read and turned into doubles
+  packed = header.dtype != LSTM_DTYPE_DOUBLE;
+
+#ifndef WINDOWS
+  {
+    struct stat st;
+    if ( fstat(fileno(fp), &st) == 0 ) {
+      file_size = (uint64_t) st.st_size;
+      mapped = 1;
+    }
+  }
+#endif
+
+  l = 0;
+  while ( l < L ) {
+    lstm_file_layer_t *layer = &table[l];
+    if ( layer->X == 0 || layer->N == 0 || layer->Y == 0 ||
+      ( !packed && ( layer->offset % LSTM_FILE_ALIGNMENT ||
+        layer->size != lstm_file_section_size(layer->X, layer->N, layer->Y) ) ) ||
+      ( packed && !( header.dtype & LSTM_DTYPE_ENTROPY ) &&
+        layer->size != lstm_file_packed_section_size(header.dtype, layer->X, layer->N, layer->Y) ) ||
+      ( l + 1 < L && layer->X != table[l + 1].Y ) ||
+      ( mapped && layer->offset + layer->size > file_size ) ) {
+      fprintf(stderr, "%s error: %s has a bad layer %u.\n", __func__, path, l);
+      return -1;
+    }
+    ++l;
+  }
+
+  if ( table[L - 1].X != F || table[0].Y != F ) {
+    fprintf(stderr, "%s error: Failed to load network, features do not match the input layer.\n",
+      __func__);
+    return -1;
+  }
+
+  params->layers = L;
+  params->neurons = table[0].N;
+
+  initialize_set(set);
+  l = 0;
+  while ( l < F ) {
+    set->values[l] = (char) header.set[l];
+    set->free[l] = 0;
+    ++l;
+  }
+
+  *model = e_calloc(L, sizeof(lstm_model_t*));
+
+  // Reading a mapped section to check it costs what mapping saves, so only small files are
+  verify = params->verify_network || file_size <= LSTM_FILE_VERIFY_SIZE;
+
+  l = 0;
+  while ( l < L ) {
+    // Zero weights are allocated untouched, they are replaced below
+    lstm_init_model(table[l].X, table[l].N, table[l].Y, &(*model)[l], 1, params);
+
+    if ( packed ) {
+      ret = lstm_read_packed_layer((*model)[l], fp, &table[l], header.dtype);
+    } else if ( !mapped || lstm_map_layer((*model)[l], fileno(fp), &table[l]) < 0 ) {
+      ret = lstm_read_layer((*model)[l], fp, &table[l]);
+    } else if ( verify && crc32_update(0, (*model)[l]->mapping,
+      (*model)[l]->mapping_size) != table[l].crc ) {
+      ret = -1;
+    }
+
+    if ( ret < 0 ) {
+      fprintf(stderr, "%s error: Failed to read layer %u of %s, truncated or bad checksum.\n",
+        __func__, l, path);
+      while ( l + 1 > 0 ) {
+        lstm_free_model((*model)[l]);
+        --l;
+      }
+      free(*model);
+      *model = NULL;
+      return -1;
+    }
+    ++l;
   }
+
+  return 0;
 }
 
-void lstm_load(const char *path, set_t *set,
+int lstm_load(const char *path, set_t *set,
   lstm_model_parameters_t *params, lstm_model_t ***model)
 {
   FILE * fp;
@@ -911,14 +1480,25 @@ void lstm_load(const char *path, set_t *set,
   int layerOutputs[LSTM_MAX_LAYERS];
   int FileVersion;
 
-  fp = fopen(path, "r");
+  char magic[sizeof(((lstm_file_header_t*) 0)->magic)];
+
+  fp = fopen(path, "rb");
 
   if ( fp == NULL ) {
     printf("%s error: Failed to open file: %s for reading.\n", 
       __func__, path);
-    exit(1);
+    return -1;
+  }
+
+  if ( fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+    !memcmp(magic, LSTM_FILE_MAGIC, sizeof(magic)) ) {
+    int ret = lstm_load_v2(fp, path, set, params, model);
+    fclose(fp);
+    return ret;
   }
 
+  // Version 1, a text header followed by the weights
+  rewind(fp);
   initialize_set(set);
 
   /*
@@ -952,22 +1532,31 @@ void lstm_load(const char *path, set_t *set,
   */
 
   // Read file version
-  e_lstm_fgets(intContainer, sizeof(intContainer), fp);
+  if ( e_lstm_fgets(intContainer, sizeof(intContainer), fp) < 0 ) {
+    fclose(fp);
+    return -1;
+  }
   FileVersion = atoi(intContainer);
   (void) FileVersion; // Not used yet, in this early stage
   // Read NbrFeatures
-  e_lstm_fgets(intContainer, sizeof(intContainer), fp);
+  if ( e_lstm_fgets(intContainer, sizeof(intContainer), fp) < 0 ) {
+    fclose(fp);
+    return -1;
+  }
   F = atoi(intContainer);
 
   // Read NbrLayers
-  e_lstm_fgets(intContainer, sizeof(intContainer), fp);
+  if ( e_lstm_fgets(intContainer, sizeof(intContainer), fp) < 0 ) {
+    fclose(fp);
+    return -1;
+  }
   L = atoi(intContainer);
 
-  if ( L > LSTM_MAX_LAYERS ) {
-    // This is too many layers
-    fprintf(stderr, "%s error: Failed to load network, too many layers.\n", 
+  if ( L <= 0 || L > LSTM_MAX_LAYERS || F <= 0 || F > SET_MAX_CHARS ) {
+    fprintf(stderr, "%s error: Failed to load network, bad number of layers or features.\n", 
       __func__);
-    exit(1);
+    fclose(fp);
+    return -1;
   }
 
   // Setting the number of layers among the parameters
@@ -976,11 +1565,20 @@ void lstm_load(const char *path, set_t *set,
   l = 0;
   while ( l < L ) {
     // Read number of inputs, nodes and ouputs in this layer
-    e_lstm_fgets(intContainer, sizeof(intContainer), fp);
+    if ( e_lstm_fgets(intContainer, sizeof(intContainer), fp) < 0 ) {
+      fclose(fp);
+      return -1;
+    }
     layerInputs[l] = atoi(intContainer);
-    e_lstm_fgets(intContainer, sizeof(intContainer), fp);
+    if ( e_lstm_fgets(intContainer, sizeof(intContainer), fp) < 0 ) {
+      fclose(fp);
+      return -1;
+    }
     layerNodes[l] = atoi(intContainer);
-    e_lstm_fgets(intContainer, sizeof(intContainer), fp);
+    if ( e_lstm_fgets(intContainer, sizeof(intContainer), fp) < 0 ) {
+      fclose(fp);
+      return -1;
+    }
     layerOutputs[l] = atoi(intContainer);
     ++l;
   }
@@ -992,13 +1590,21 @@ void lstm_load(const char *path, set_t *set,
   // Import feature set
   f = 0;
   while ( f < F ) {
-    e_lstm_fgets(intContainer, sizeof(intContainer), fp);
+    if ( e_lstm_fgets(intContainer, sizeof(intContainer), fp) < 0 ) {
+      fclose(fp);
+      return -1;
+    }
     set->values[f] = (char)atoi(intContainer);
     set->free[f] = 0;
     ++f;
   }
 
-  assert(set_get_features(set) == layerInputs[L-1]);
+  if ( set_get_features(set) != layerInputs[L-1] ) {
+    fprintf(stderr, "%s error: Failed to load network, features do not match the input layer.\n",
+      __func__);
+    fclose(fp);
+    return -1;
+  }
 
   *model = (lstm_model_t**) malloc(L*sizeof(lstm_model_t*));
   if ( *model == NULL )
@@ -1017,89 +1623,373 @@ void lstm_load(const char *path, set_t *set,
   lstm_read_net_layers(*model, fp, L);
 
   fclose(fp);
+  return 0;
 }
 
-void lstm_store(const char *path, set_t *set,
-  lstm_model_t **model, unsigned int layers)
+/*
+* The training state of a checkpoint, in file order, see lstm_file_train_t.
+* Returns the number of arrays.
+*/
+static int lstm_trainer_arrays(const lstm_trainer_t *trainer, double **arrays, size_t *counts)
+{
+  double **weights[LSTM_WEIGHT_ARRAYS];
+  size_t weight_counts[LSTM_WEIGHT_ARRAYS];
+  unsigned int p = 0;
+  int a, count = 0;
+
+  while ( p < trainer->layers ) {
+    if ( trainer->M_layers != NULL ) {
+      lstm_weight_arrays(trainer->M_layers[p], weights, weight_counts);
+      a = 0;
+      while ( a < LSTM_WEIGHT_ARRAYS ) {
+        arrays[count] = *weights[a];
+        counts[count++] = weight_counts[a];
+        ++a;
+      }
+
+      lstm_weight_arrays(trainer->R_layers[p], weights, weight_counts);
+      a = 0;
+      while ( a < LSTM_WEIGHT_ARRAYS ) {
+        arrays[count] = *weights[a];
+        counts[count++] = weight_counts[a];
+        ++a;
+      }
+    }
+
+    if ( trainer->stateful_d_next != NULL ) {
+      arrays[count] = trainer->stateful_d_next[p]->h;
+      counts[count++] = trainer->model[p]->N;
+      arrays[count] = trainer->stateful_d_next[p]->c;
+      counts[count++] = trainer->model[p]->N;
+    }
+    ++p;
+  }
+
+  return count;
+}
+
+/*
+* Network file with weights of dtype, followed by the training state if
+* trainer is not NULL (dtype LSTM_DTYPE_DOUBLE only)
+*/
+static int lstm_store_file(const char *path, set_t *set,
+  lstm_model_t **model, unsigned int layers, unsigned int dtype,
+  const lstm_trainer_t *trainer)
 {
   FILE * fp;
-  int f;
+  lstm_file_header_t header;
+  lstm_file_layer_t table[LSTM_MAX_LAYERS];
+  lstm_file_train_t train;
+  double **arrays[LSTM_WEIGHT_ARRAYS];
+  size_t counts[LSTM_WEIGHT_ARRAYS];
+  double *state[LSTM_TRAIN_ARRAYS];
+  size_t state_counts[LSTM_TRAIN_ARRAYS];
+  unsigned char *sections[LSTM_MAX_LAYERS];
+  int state_arrays = 0;
+  uint64_t offset, pad;
+  char *tmp_path;
   int F = set_get_features(set);
+  int f, a;
   unsigned int l;
   unsigned int L = layers;
 
-  fp = fopen(path, "w");
-
-  if ( fp == NULL ) {
-    printf("%s error: Failed to open file: %s for writing.\n", 
-      __func__, path);
-    exit(1);
+  if ( L == 0 || L > LSTM_MAX_LAYERS || F <= 0 || F > (int) sizeof(header.set) ) {
+    fprintf(stderr, "%s error: Can not store a network of %u layers and %d features.\n",
+      __func__, L, F);
+    return -1;
   }
 
   /*
-  * LSTM net file structure
-  * File version   BINARY_FILE_VERSION
-  * NbrFeatures    (F)
-  * NbrLayers      (L)
-  * Inputs  layer  1 (output layer)
-  * Nodes   layer  1
-  * outputs layer  1
-  * Inputs  layer  2
-  * Nodes   layer  2
-  * outputs layer  2
-  * ...
-  * Inputs  layer  L (input layer)
-  * Nodes   layer  L
-  * outputs layer  L
-  * Feature Value  1 (int in ASCII [0-255])
-  * Feature Value  2
-  * ...
-  * Feature Value  F
-  * --- From here on it is a blob of bytes ---
-  * Layer 1: Wy
-  * Layer 1: Wi
-  * Layer 1: Wc
-  * Layer 1: Wo
-  * Layer 1: Wf
-  * Layer 1: by
-  * Layer 1: bi
-  * Layer 1: bc
-  * Layer 1: bf
-  * Layer 1: bo
-  * ...
-  * Layer L: Wy
-  * Layer L: Wi
-  * ...
+  * LSTM net file structure, see lstm_file_header_t.
+  * Each layer gets a section starting on a page boundary.
+  */
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LSTM_FILE_MAGIC, sizeof(header.magic));
+  header.version = BINARY_FILE_VERSION;
+  header.dtype = dtype;
+  header.features = F;
+  header.layers = L;
+  header.alignment = LSTM_FILE_ALIGNMENT;
+
+  f = 0;
+  while ( f < F ) {
+    header.set[f] = (unsigned char) set->values[f];
+    ++f;
+  }
+
+  memset(table, 0, sizeof(table));
+  memset(sections, 0, sizeof(sections));
+  offset = sizeof(header) + L * sizeof(lstm_file_layer_t);
+  if ( dtype == LSTM_DTYPE_DOUBLE )
+    offset = lstm_file_align(offset);
+
+  l = 0;
+  while ( l < L ) {
+    table[l].X = model[l]->X;
+    table[l].N = model[l]->N;
+    table[l].Y = model[l]->Y;
+    table[l].offset = offset;
+
+    if ( dtype != LSTM_DTYPE_DOUBLE ) {
+      // Packed sections follow one another, they are not mapped
+      sections[l] = lstm_file_pack_layer(model[l], dtype, &table[l].size);
+      table[l].crc = crc32_update(0, sections[l], (size_t) table[l].size);
+      offset += table[l].size;
+      ++l;
+      continue;
+    }
+
+    table[l].size = lstm_file_section_size(model[l]->X, model[l]->N, model[l]->Y);
+
+    lstm_weight_arrays(model[l], arrays, counts);
+    a = 0;
+    while ( a < LSTM_WEIGHT_ARRAYS ) {
+      static const char zeros[LSTM_FILE_ARRAY_ALIGNMENT];
+      pad = lstm_file_array_size(counts[a]) - counts[a] * sizeof(double);
+      table[l].crc = crc32_update(table[l].crc, *arrays[a], counts[a] * sizeof(double));
+      table[l].crc = crc32_update(table[l].crc, zeros, (size_t) pad);
+      ++a;
+    }
+
+    offset = lstm_file_align(offset + table[l].size);
+    ++l;
+  }
+
+  header.crc = crc32_update(crc32_update(0, &header, sizeof(header)),
+    table, L * sizeof(lstm_file_layer_t));
+
+  if ( trainer != NULL ) {
+    memset(&train, 0, sizeof(train));
+    memcpy(train.magic, LSTM_TRAIN_MAGIC, sizeof(train.magic));
+    train.version = LSTM_TRAIN_VERSION;
+    train.optimizer = trainer->params->optimizer;
+    train.stateful = trainer->stateful_d_next != NULL;
+    train.i = trainer->i;
+    train.n = trainer->n;
+    train.epoch = trainer->epoch;
+    train.record_iteration = trainer->record_iteration;
+    train.random_state = trainer->params->random_state;
+    train.loss = trainer->loss;
+    train.record_keeper = trainer->record_keeper;
+    train.learning_rate = trainer->params->learning_rate;
+    train.initial_learning_rate = trainer->initial_learning_rate;
+
+    state_arrays = lstm_trainer_arrays(trainer, state, state_counts);
+    a = 0;
+    while ( a < state_arrays ) {
+      train.size += state_counts[a] * sizeof(double);
+      ++a;
+    }
+
+    train.crc = crc32_update(0, &train, sizeof(train));
+    a = 0;
+    while ( a < state_arrays ) {
+      train.crc = crc32_update(train.crc, state[a], state_counts[a] * sizeof(double));
+      ++a;
+    }
+  }
+
+  /*
+  * Written next to the old file and renamed over it, so that a
+  * network mapped from the old file is left intact.
   */
+  tmp_path = temp_file_name(path);
 
-  // Write file version
-  fprintf(fp, "%d\r\n", BINARY_FILE_VERSION);
+  fp = fopen(tmp_path, "wb");
 
-  // Write NbrFeatures
-  fprintf(fp, "%d\r\n", F);
+  if ( fp == NULL ) {
+    printf("%s error: Failed to open file: %s for writing.\n", 
+      __func__, tmp_path);
+    free(tmp_path);
+    l = 0;
+    while ( l < L )
+      free(sections[l++]);
+    return -1;
+  }
 
-  // Write NbrLayers
-  fprintf(fp, "%d\r\n", L);
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(table, sizeof(lstm_file_layer_t), L, fp);
+  offset = sizeof(header) + L * sizeof(lstm_file_layer_t);
 
   l = 0;
   while ( l < L ) {
-    // write number of inputs, nodes and outputs in this layer
-    fprintf(fp, "%d\r\n%d\r\n%d\r\n",
-      model[l]->X, model[l]->N, model[l]->Y);
+    lstm_file_pad(fp, table[l].offset - offset);
+
+    if ( sections[l] != NULL ) {
+      fwrite(sections[l], 1, (size_t) table[l].size, fp);
+      free(sections[l]);
+    } else {
+      lstm_weight_arrays(model[l], arrays, counts);
+      a = 0;
+      while ( a < LSTM_WEIGHT_ARRAYS ) {
+        fwrite(*arrays[a], sizeof(double), counts[a], fp);
+        lstm_file_pad(fp, lstm_file_array_size(counts[a]) - counts[a] * sizeof(double));
+        ++a;
+      }
+    }
+
+    offset = table[l].offset + table[l].size;
     ++l;
   }
 
-  // Write feature set
-  f = 0;
-  while ( f < F ) {
-    fprintf(fp, "%d\r\n", set->values[f]);
-    ++f;
+  if ( trainer != NULL ) {
+    lstm_file_pad(fp, lstm_file_align(offset) - offset);
+    fwrite(&train, sizeof(train), 1, fp);
+    a = 0;
+    while ( a < state_arrays ) {
+      fwrite(state[a], sizeof(double), state_counts[a], fp);
+      ++a;
+    }
+  }
+
+  if ( ferror(fp) ) {
+    fprintf(stderr, "%s error: Failed to write %s.\n", __func__, tmp_path);
+    fclose(fp);
+    remove(tmp_path);
+    free(tmp_path);
+    return -1;
+  }
+
+  if ( fclose(fp) != 0 ) {
+    fprintf(stderr, "%s error: Failed to write %s.\n", __func__, tmp_path);
+    remove(tmp_path);
+    free(tmp_path);
+    return -1;
+  }
+
+  f = replace_file(tmp_path, path);
+  free(tmp_path);
+  return f;
+}
+
+int lstm_store(const char *path, set_t *set,
+  lstm_model_t **model, unsigned int layers)
+{
+  return lstm_store_file(path, set, model, layers, LSTM_DTYPE_DOUBLE, NULL);
+}
+
+int lstm_store_as(const char *path, set_t *set,
+  lstm_model_t **model, unsigned int layers, unsigned int dtype)
+{
+  if ( ( dtype & ~LSTM_DTYPE_ENTROPY ) > LSTM_DTYPE_INT8 ) {
+    fprintf(stderr, "%s error: Unknown type of weights %u.\n", __func__, dtype);
+    return -1;
+  }
+  return lstm_store_file(path, set, model, layers, dtype, NULL);
+}
+
+int lstm_trainer_store(lstm_trainer_t *trainer, set_t *set, const char *path)
+{
+  return lstm_store_file(path, set, trainer->model, trainer->layers,
+    LSTM_DTYPE_DOUBLE, trainer);
+}
+
+int lstm_trainer_resume(lstm_trainer_t *trainer, const char *path)
+{
+  FILE *fp;
+  lstm_file_header_t header;
+  lstm_file_layer_t table[LSTM_MAX_LAYERS];
+  lstm_file_train_t train;
+  double *arrays[LSTM_TRAIN_ARRAYS];
+  size_t counts[LSTM_TRAIN_ARRAYS];
+  uint64_t size = 0, end;
+  uint32_t crc;
+  char *state, *position;
+  int count, a;
+  unsigned int l;
+
+  fp = fopen(path, "rb");
+  if ( fp == NULL ) {
+    fprintf(stderr, "%s error: Failed to open file: %s for reading.\n", __func__, path);
+    return -1;
+  }
+
+  if ( fread(&header, sizeof(header), 1, fp) != 1 ||
+    memcmp(header.magic, LSTM_FILE_MAGIC, sizeof(header.magic)) ||
+    header.dtype != LSTM_DTYPE_DOUBLE || header.layers != trainer->layers ||
+    fread(table, sizeof(lstm_file_layer_t), header.layers, fp) != header.layers ) {
+    fprintf(stderr, "%s error: %s is not a network of %u layers.\n", __func__, path,
+      trainer->layers);
+    fclose(fp);
+    return -1;
+  }
+
+  l = 0;
+  while ( l < header.layers ) {
+    if ( table[l].X != trainer->model[l]->X || table[l].N != trainer->model[l]->N ||
+      table[l].Y != trainer->model[l]->Y ) {
+      fprintf(stderr, "%s error: Layer %u of %s does not match the network.\n",
+        __func__, l, path);
+      fclose(fp);
+      return -1;
+    }
+    ++l;
+  }
+
+  end = table[header.layers - 1].offset + table[header.layers - 1].size;
+  if ( fseek(fp, (long) lstm_file_align(end), SEEK_SET) != 0 ||
+    fread(&train, sizeof(train), 1, fp) != 1 ||
+    memcmp(train.magic, LSTM_TRAIN_MAGIC, sizeof(train.magic)) ) {
+    fprintf(stderr, "%s error: %s has no training state.\n", __func__, path);
+    fclose(fp);
+    return -1;
+  }
+
+  count = lstm_trainer_arrays(trainer, arrays, counts);
+  a = 0;
+  while ( a < count ) {
+    size += counts[a] * sizeof(double);
+    ++a;
   }
 
-  // Write the network weights
-  lstm_store_net_layers(model, fp, L);
+  if ( train.version != LSTM_TRAIN_VERSION ||
+    train.optimizer != (uint32_t) trainer->params->optimizer ||
+    train.stateful != ( trainer->stateful_d_next != NULL ) ||
+    train.i >= trainer->training_points || train.size != size ) {
+    fprintf(stderr, "%s error: The training state of %s does not fit, \
+different optimizer, stateful setting or training data.\n", __func__, path);
+    fclose(fp);
+    return -1;
+  }
 
+  // Read aside first, the trainer is left as it is if the state is damaged
+  state = e_calloc(size + 1, 1);
+  if ( fread(state, 1, size, fp) != size ) {
+    fprintf(stderr, "%s error: %s is truncated.\n", __func__, path);
+    free(state);
+    fclose(fp);
+    return -1;
+  }
   fclose(fp);
+
+  crc = train.crc;
+  train.crc = 0;
+  if ( crc32_update(crc32_update(0, &train, sizeof(train)), state, size) != crc ) {
+    fprintf(stderr, "%s error: %s has a bad checksum.\n", __func__, path);
+    free(state);
+    return -1;
+  }
+
+  position = state;
+  a = 0;
+  while ( a < count ) {
+    memcpy(arrays[a], position, counts[a] * sizeof(double));
+    position += counts[a] * sizeof(double);
+    ++a;
+  }
+  free(state);
+
+  trainer->i = train.i;
+  trainer->n = train.n;
+  trainer->epoch = train.epoch;
+  trainer->record_iteration = train.record_iteration;
+  trainer->loss = train.loss;
+  trainer->record_keeper = train.record_keeper;
+  trainer->initial_learning_rate = train.initial_learning_rate;
+  trainer->params->learning_rate = train.learning_rate;
+  trainer->params->random_state = train.random_state;
+
+  return 0;
 }
 
 int lstm_reinit_model(
@@ -1124,6 +2014,7 @@ int lstm_reinit_model(
   double *newVectorWc;
   double *newVectorWo;
   double *newVectorWy;
+  uint64_t *random_state;
 
   /* Sanity checks.. */
   if ( layers == 0 )
@@ -1142,11 +2033,17 @@ int lstm_reinit_model(
   modelOutputs = model[0];
   modelInputs = model[layers-1];
 
+  // The weights are reallocated, they can not stay mapped from a file
+  lstm_model_unmap(modelOutputs);
+  lstm_model_unmap(modelInputs);
+
+  random_state = lstm_random_state(modelInputs->params);
+
   // Reallocate the vectors that depend on input size
-  newVectorWf = get_random_vector(Nin * Snew, Snew*5);
-  newVectorWi = get_random_vector(Nin * Snew, Snew*5);
-  newVectorWc = get_random_vector(Nin * Snew, Snew*5);
-  newVectorWo = get_random_vector(Nin * Snew, Snew*5);
+  newVectorWf = get_random_vector(Nin * Snew, Snew*5, random_state);
+  newVectorWi = get_random_vector(Nin * Snew, Snew*5, random_state);
+  newVectorWc = get_random_vector(Nin * Snew, Snew*5, random_state);
+  newVectorWo = get_random_vector(Nin * Snew, Snew*5, random_state);
 
   n = 0;
   while ( n < Nin ) {
@@ -1190,7 +2087,7 @@ int lstm_reinit_model(
   modelInputs->Wom = get_zero_vector(Nin * Snew);
 
   // Reallocate vectors that depend on output size
-  newVectorWy = get_random_vector(Ynew * Nout, Nout);
+  newVectorWy = get_random_vector(Ynew * Nout, Nout, random_state);
   n = 0;
   while ( n < Yold ) {
     i = 0;
@@ -1257,329 +2154,855 @@ void lstm_read_net_layers(lstm_model_t** model, FILE *fp, unsigned int layers)
 
 }
 
-void lstm_output_string_layers_to_file(FILE * fp,lstm_model_t ** model_layers, 
-  set_t* char_index_mapping, int first, int numbers_to_display, int layers)
+sampler_t* lstm_sampler_init(lstm_model_t *output_layer)
 {
-  lstm_values_cache_t ***caches_layer;
-  int i = 0, count, index, p = 0, b = 0;
-  int input = set_indx_to_char(char_index_mapping, first);
-  int Y = model_layers[0]->Y;
-  int N = model_layers[0]->N;
-#ifdef WINDOWS
-  double *first_layer_input;
-#else
-  double first_layer_input[Y];
-#endif
-
-  if ( fp == NULL ) 
-    return;
+  lstm_model_parameters_t *params = output_layer->params;
 
-#ifdef WINDOWS
-  first_layer_input = malloc(Y*sizeof(double));
+  return sampler_init(output_layer->Y, params->sampler, params->softmax_temp,
+    params->top_k, params->top_p, params->seed);
+}
 
-  if ( first_layer_input == NULL ) {
-    fprintf(stderr, "%s.%s.%d malloc(%zu) failed\r\n", 
-    __FILE__, __func__, __LINE__, Y*sizeof(double));
-    exit(1);
-  }
-#endif
+lstm_session_t* lstm_session_init(lstm_model_t **model_layers, int layers)
+{
+  int p = 0, b;
+  lstm_session_t *session = e_calloc(1, sizeof(lstm_session_t));
 
-  caches_layer = e_calloc(layers, sizeof(lstm_values_cache_t**));
+  session->model = model_layers;
+  session->layers = layers;
+  session->last_input = -1;
+  session->input = get_zero_vector(model_layers[layers-1]->X);
+  session->sampler = lstm_sampler_init(model_layers[0]);
+  session->caches = e_calloc(layers, sizeof(lstm_values_cache_t**));
 
-  p = 0;
   while ( p < layers ) {
-    caches_layer[p] = e_calloc(2, sizeof(lstm_values_cache_t*));
-
+    session->caches[p] = e_calloc(2, sizeof(lstm_values_cache_t*));
     b = 0;
     while ( b < 2 ) {
-      caches_layer[p][b] = lstm_cache_container_init(
-        model_layers[p]->X, 
-        model_layers[p]->N,
-        model_layers[p]->Y);
+      session->caches[p][b] = lstm_cache_container_init(
+        model_layers[p]->X, model_layers[p]->N, model_layers[p]->Y);
       ++b;
     }
     ++p;
   }
 
-  lstm_cache_container_set_start(caches_layer[0][0], N);
-  lstm_cache_container_set_start(caches_layer[0][0], N);
-
-  while ( i < numbers_to_display ) {
-
-    index = set_char_to_indx(char_index_mapping,input);
-
-    count = 0;
-    while ( count < Y ) {
-      first_layer_input[count] = 0.0;
-      ++count;
-    }
-
-    first_layer_input[index] = 1.0;
-
-    p = layers - 1;
-    lstm_forward_propagate(model_layers[p], first_layer_input, 
-      caches_layer[p][i % 2], caches_layer[p][(i+1)%2], p == 0);
-
-    if ( p > 0 ) {
-      --p;
-      while ( p >= 0 ) {
-        lstm_forward_propagate(model_layers[p], caches_layer[p+1][(i+1)%2]->probs, 
-          caches_layer[p][i % 2], caches_layer[p][(i+1)%2], p == 0);
-        --p;
-      }
-      p = 0;
-    }
+  session->logits = session->caches[0][0]->probs;
 
-    input = set_probability_choice(char_index_mapping, caches_layer[p][(i+1)%2]->probs);
-    fprintf (fp, "%c", input );
+  return session;
+}
 
-    ++i;
-  }
+void lstm_session_free(lstm_session_t *session)
+{
+  int p = 0, b;
 
-  p = 0;
-  while ( p < layers ) {
+  while ( p < session->layers ) {
     b = 0;
     while ( b < 2 ) {
-      lstm_cache_container_free( caches_layer[p][b]);
-      free(caches_layer[p][b]);
+      lstm_cache_container_free(session->caches[p][b]);
+      free(session->caches[p][b]);
       ++b;
     }
-    free(caches_layer[p]);
+    free(session->caches[p]);
     ++p;
   }
 
-  free(caches_layer);
-#ifdef WINDOWS
-  free(first_layer_input);
-#endif
-
+  free(session->caches);
+  free_vector(&session->input);
+  sampler_free(session->sampler);
+  free(session);
 }
 
-
-void lstm_output_string_layers(lstm_model_t ** model_layers, set_t* char_index_mapping,
-  int first, int numbers_to_display, int layers)
+void lstm_session_reset(lstm_session_t *session)
 {
-  lstm_values_cache_t ***caches_layer;
-  int i = 0, count, index, p = 0, b = 0;
-  int input = set_indx_to_char(char_index_mapping, first);
-  int Y = model_layers[0]->Y;
-  int N = model_layers[0]->N;
-#ifdef WINDOWS
-  double *first_layer_input;
-#else
-  double first_layer_input[Y];
-#endif
-
-#ifdef WINDOWS
-  first_layer_input = malloc(Y*sizeof(double));
-
-  if ( first_layer_input == NULL ) {
-    fprintf(stderr, "%s.%s.%d malloc(%zu) failed\r\n", 
-      __FILE__, __func__, __LINE__, Y*sizeof(double));
-    exit(1);
-  }
-#endif
+  int p = 0, b;
 
-  caches_layer = e_calloc(layers, sizeof(lstm_values_cache_t**));
-
-  p = 0;
-  while ( p < layers ) {
-    caches_layer[p] = e_calloc(2, sizeof(lstm_values_cache_t*));
+  while ( p < session->layers ) {
     b = 0;
     while ( b < 2 ) {
-      caches_layer[p][b] = lstm_cache_container_init(
-        model_layers[p]->X, model_layers[p]->N, model_layers[p]->Y); 
+      lstm_cache_container_set_start(session->caches[p][b],
+        session->model[p]->N);
+      vector_set_to_zero(session->caches[p][b]->probs,
+        session->model[p]->Y);
       ++b;
     }
     ++p;
   }
 
-  lstm_cache_container_set_start(caches_layer[0][0], N);
-  lstm_cache_container_set_start(caches_layer[0][0], N);
+  session->t = 0;
+  session->logits = session->caches[0][0]->probs;
+}
 
-  while ( i < numbers_to_display ) {
+double* lstm_session_step(lstm_session_t *session, int index)
+{
+  lstm_model_t **model_layers = session->model;
+  lstm_values_cache_t ***caches = session->caches;
+  int in = session->t % 2, out = ( session->t + 1 ) % 2;
+  int p = session->layers - 1;
+  double begin;
+
+  // Only the previously set entry of the one-hot input needs clearing
+  if ( session->last_input >= 0 )
+    session->input[session->last_input] = 0.0;
+  if ( index >= 0 && index < (int) model_layers[p]->X )
+    session->input[index] = 1.0;
+  else
+    index = -1;
+  session->last_input = index;
+
+  begin = trace_begin();
+  lstm_forward_propagate(model_layers[p], session->input,
+    caches[p][in], caches[p][out], 0);
+  trace_end("forward", p, begin);
+
+  while ( p > 0 ) {
+    --p;
+    begin = trace_begin();
+    lstm_forward_propagate(model_layers[p], caches[p+1][out]->probs,
+      caches[p][in], caches[p][out], 0);
+    trace_end("forward", p, begin);
+  }
 
-    index = set_char_to_indx(char_index_mapping,input);
+  session->t++;
+  session->logits = caches[0][out]->probs;
 
-    count = 0;
-    while ( count < Y ) {
-      first_layer_input[count] = 0.0;
-      ++count;
-    }
+  return session->logits;
+}
+
+int lstm_session_sample(lstm_session_t *session, set_t *char_index_mapping)
+{
+  double begin = trace_begin();
+  int c = set_indx_to_char(char_index_mapping,
+    sampler_sample(session->sampler, session->logits));
+
+  trace_end("sample", -1, begin);
+  return c;
+}
+
+void lstm_session_output_string(lstm_session_t *session, set_t *char_index_mapping,
+  int first, int numbers_to_display, writer_t *writer)
+{
+  int i = 0, input, index = first;
+  double begin = trace_begin();
+
+  while ( i < numbers_to_display ) {
+    trace_poll();
+    lstm_session_step(session, index);
+    input = lstm_session_sample(session, char_index_mapping);
+    writer_putc(writer, (char) input);
 
+    index = set_char_to_indx(char_index_mapping, (char) input);
     if ( index < 0 ) {
+      fprintf(stderr, "%s.%s unexpected input char: '%c', (%d)\r\n",
+        __FILE__, __func__, input, input);
       index = 0;
-      printf("%s.%s unexpected input char: '%c', (%d)\r\n", __FILE__, __func__, input, input);
     }
 
-    first_layer_input[index] = 1.0;
-
-    p = layers - 1;
-    lstm_forward_propagate(model_layers[p], first_layer_input, caches_layer[p][i % 2], caches_layer[p][(i+1)%2], p == 0);
+    ++i;
+  }
 
-    if ( p > 0 ) {
-      --p;
-      while ( p >= 0 ) {
-        lstm_forward_propagate(model_layers[p], 
-          caches_layer[p+1][(i+1)%2]->probs, 
-          caches_layer[p][i % 2], caches_layer[p][(i+1)%2], 
-          p == 0);	
-        --p;
-      }
-      p = 0;
-    }
+  trace_end("generate", -1, begin);
+}
 
-    input = set_probability_choice(char_index_mapping, 
-    caches_layer[p][(i+1)%2]->probs);
-    printf ( "%c", input );
+int lstm_session_prime(lstm_session_t *session, set_t *char_index_mapping,
+  const char *prompt)
+{
+  int i = 0;
+  double begin = trace_begin();
 
+  while ( prompt[i] != '\0' ) {
+    lstm_session_step(session,
+      set_char_to_indx(char_index_mapping, prompt[i]));
     ++i;
   }
 
-  p = 0;
-  while ( p < layers ) {
+  trace_end("prime", -1, begin);
+  return i;
+}
 
-    b = 0;
-    while ( b < 2 ) {
-      lstm_cache_container_free( caches_layer[p][b]);
-      free(caches_layer[p][b]);
-      ++b;
-    }
-    free(caches_layer[p]);
-    ++p;
+/*
+* lstm_session_stream, the probability handed to callback is only computed
+* with with_prob, it costs a pass over the logits. Otherwise it is 0.
+*/
+static int lstm_session_stream_chars(lstm_session_t *session, set_t *char_index_mapping,
+  int length, lstm_stream_callback_t callback, void *data, int with_prob)
+{
+  int i = 0, index, stop;
+  int F = session->model[0]->Y;
+  double start = time_seconds(), prob = 0.0, begin = trace_begin(), sample_begin;
+
+  while ( i < length ) {
+    trace_poll();
+    sample_begin = trace_begin();
+    index = sampler_sample(session->sampler, session->logits);
+    if ( with_prob )
+      prob = exp(log_softmax(session->logits, F, index));
+    trace_end("sample", -1, sample_begin);
+
+    stop = callback(set_indx_to_char(char_index_mapping, index), prob,
+      time_seconds() - start, data);
+
+    lstm_session_step(session, index);
+    ++i;
+
+    if ( stop )
+      break;
   }
 
-  free(caches_layer);
-#ifdef WINDOWS
-  free(first_layer_input);
-#endif
+  trace_end("generate", -1, begin);
+  return i;
 }
 
-void lstm_output_string_from_string(lstm_model_t **model_layers, set_t* char_index_mapping,
-  char * input_string, int layers, int out_length)
+int lstm_session_stream(lstm_session_t *session, set_t *char_index_mapping,
+  int length, lstm_stream_callback_t callback, void *data)
 {
-  lstm_values_cache_t ***caches_layers;
-  int i = 0, count, index, in_len;
-  char input;
-  int Y = model_layers[0]->Y;
+  return lstm_session_stream_chars(session, char_index_mapping, length,
+    callback, data, 1);
+}
 
-  int p = 0;
+static int lstm_stream_to_writer(int c, double prob, double elapsed, void *data)
+{
+  (void) prob;
+  (void) elapsed;
+  writer_putc((writer_t*) data, (char) c);
+  return 0;
+}
+
+void lstm_session_output_from_string(lstm_session_t *session, set_t *char_index_mapping,
+  const char *input_string, int out_length, writer_t *writer)
+{
+  writer_write(writer, input_string, strlen(input_string));
+  lstm_session_prime(session, char_index_mapping, input_string);
+  lstm_session_stream_chars(session, char_index_mapping, out_length + 1,
+    lstm_stream_to_writer, writer, 0);
+}
 
-#ifdef WINDOWS
-  double *first_layer_input = malloc(Y*sizeof(double));
+size_t lstm_state_size(lstm_model_t **model_layers, int layers)
+{
+  size_t size = model_layers[0]->Y;
+  int p = 0;
 
-  if ( first_layer_input == NULL ) {
-    fprintf(stderr, "%s.%s.%d malloc(%zu) failed\r\n", 
-      __FILE__, __func__, __LINE__, Y*sizeof(double));
-    exit(1);
+  while ( p < layers ) {
+    size += 2 * model_layers[p]->N;
+    ++p;
   }
-#else
-  double first_layer_input[Y];
-#endif
 
-  caches_layers = e_calloc(layers, sizeof(lstm_values_cache_t**));
+  return size;
+}
 
-  while ( p < layers ) {
-    caches_layers[p] = e_calloc(2, sizeof(lstm_values_cache_t*));
+void lstm_session_get_state(lstm_session_t *session, double *state)
+{
+  int p = 0, current = session->t % 2;
 
-    i = 0; 
-    while ( i < 2 ) {
-      caches_layers[p][i] = lstm_cache_container_init(
-        model_layers[p]->X, model_layers[0]->N, model_layers[0]->Y);
-      ++i;
-    }
+  while ( p < session->layers ) {
+    int N = session->model[p]->N;
+    copy_vector(state, session->caches[p][current]->h, N);
+    copy_vector(state + N, session->caches[p][current]->c, N);
+    state += 2 * N;
+    ++p;
+  }
+
+  copy_vector(state, session->logits, session->model[0]->Y);
+}
+
+void lstm_session_set_state(lstm_session_t *session, const double *state)
+{
+  int p = 0, current = session->t % 2;
 
+  while ( p < session->layers ) {
+    int N = session->model[p]->N;
+    copy_vector(session->caches[p][current]->h, (double*) state, N);
+    copy_vector(session->caches[p][current]->c, (double*) state + N, N);
+    state += 2 * N;
     ++p;
   }
 
-  in_len = strlen(input_string);
-  i = 0;
+  session->logits = session->caches[0][current]->probs;
+  copy_vector(session->logits, (double*) state, session->model[0]->Y);
+}
 
-  while ( i < in_len ) {
-    printf("%c", input_string[i]);
-    index = set_char_to_indx(char_index_mapping, input_string[i]);
+#define SNAPSHOT_HEADER_SIZE( layers )    ( 16 + 4 * (size_t) ( layers ) )
 
-    count = 0;
-    while ( count < Y ) {
-      first_layer_input[count] = count == index ? 1.0 : 0.0;
-      ++count;
-    }
+size_t lstm_session_snapshot_size(lstm_session_t *session, int type)
+{
+  size_t value_size = type == SNAPSHOT_HALF ? sizeof(uint16_t) : sizeof(double);
 
-    p = layers - 1;
-    lstm_forward_propagate(model_layers[p],
-      first_layer_input,
-      caches_layers[p][i%2],
-      caches_layers[p][(i+1)%2],
-      p == 0);
+  return SNAPSHOT_HEADER_SIZE(session->layers)
+    + lstm_state_size(session->model, session->layers) * value_size;
+}
 
-    if ( p > 0 ) {
-      --p;
-      while ( p >= 0 ) {
-        lstm_forward_propagate(model_layers[p],
-          caches_layers[p+1][(i+1)%2]->probs,
-          caches_layers[p][i%2],
-          caches_layers[p][(i+1)%2],
-          p == 0);	
-        --p;
-      }
-      p = 0;
-    }
+static uint8_t* snapshot_values_write(uint8_t *out, const double *values, int count, int type)
+{
+  int i = 0;
+  uint16_t half;
+
+  if ( type != SNAPSHOT_HALF ) {
+    memcpy(out, values, count * sizeof(double));
+    return out + count * sizeof(double);
+  }
 
+  while ( i < count ) {
+    half = float_to_half((float) values[i]);
+    memcpy(out, &half, sizeof(half));
+    out += sizeof(half);
     ++i;
   }
+  return out;
+}
 
-	input = set_probability_choice(char_index_mapping, 
-    caches_layers[0][i%2]->probs);
+static const uint8_t* snapshot_values_read(const uint8_t *in, double *values, int count, int type)
+{
+  int i = 0;
+  uint16_t half;
 
-  printf("%c", input);
-  i = 0;
-  while ( i < out_length ) {
-    index = set_char_to_indx(char_index_mapping,input);
+  if ( type != SNAPSHOT_HALF ) {
+    memcpy(values, in, count * sizeof(double));
+    return in + count * sizeof(double);
+  }
 
-    count = 0;
-    while ( count < Y ) {
-      first_layer_input[count] = count == index ? 1.0 : 0.0;
-      ++count;
-    }
+  while ( i < count ) {
+    memcpy(&half, in, sizeof(half));
+    values[i] = half_to_float(half);
+    in += sizeof(half);
+    ++i;
+  }
+  return in;
+}
 
-    p = layers - 1;
-    lstm_forward_propagate(model_layers[p], first_layer_input, caches_layers[p][i%2], caches_layers[p][(i+1)%2], p == 0);
+size_t lstm_session_snapshot(lstm_session_t *session, int type,
+  void *buffer, size_t size)
+{
+  uint8_t *out = buffer;
+  size_t needed = lstm_session_snapshot_size(session, type);
+  int p = 0, current = session->t % 2;
+  uint16_t header[2];
+  uint32_t value;
+
+  if ( size < needed )
+    return 0;
+
+  memcpy(out, SNAPSHOT_MAGIC, 4);
+  header[0] = SNAPSHOT_VERSION;
+  header[1] = type == SNAPSHOT_HALF ? SNAPSHOT_HALF : SNAPSHOT_DOUBLE;
+  memcpy(out + 4, header, sizeof(header));
+  value = session->layers;
+  memcpy(out + 8, &value, 4);
+  value = session->model[0]->Y;
+  memcpy(out + 12, &value, 4);
+  out += 16;
+
+  while ( p < session->layers ) {
+    value = session->model[p]->N;
+    memcpy(out, &value, 4);
+    out += 4;
+    ++p;
+  }
 
-    if ( p > 0 ) {
-      --p;
-      while ( p >= 0 ) {
-        lstm_forward_propagate(model_layers[p], caches_layers[p+1][ (i+1) % 2 ]->probs, caches_layers[p][i%2], caches_layers[p][(i+1)%2], p == 0);	
-        --p;
-      }
-      p = 0;
-    }
-    input = set_probability_choice(char_index_mapping, caches_layers[p][(i+1)%2]->probs);
-    printf ( "%c", input );
-    //    set_print(char_index_mapping,caches_layer_one->probs);
-    ++i;
+  p = 0;
+  while ( p < session->layers ) {
+    int N = session->model[p]->N;
+    out = snapshot_values_write(out, session->caches[p][current]->h, N, header[1]);
+    out = snapshot_values_write(out, session->caches[p][current]->c, N, header[1]);
+    ++p;
+  }
+
+  snapshot_values_write(out, session->logits, session->model[0]->Y, header[1]);
+
+  return needed;
+}
+
+int lstm_session_restore(lstm_session_t *session, const void *buffer, size_t size)
+{
+  const uint8_t *in = buffer;
+  int p = 0, current = session->t % 2;
+  uint16_t header[2];
+  uint32_t value;
+
+  if ( size < 16 || memcmp(in, SNAPSHOT_MAGIC, 4) ) {
+    fprintf(stderr, "%s error: not a snapshot\n", __func__);
+    return -1;
   }
 
-  printf("\n");
+  memcpy(header, in + 4, sizeof(header));
+  if ( header[0] != SNAPSHOT_VERSION ||
+    ( header[1] != SNAPSHOT_DOUBLE && header[1] != SNAPSHOT_HALF ) ) {
+    fprintf(stderr, "%s error: unsupported snapshot version %d, type %d\n",
+      __func__, header[0], header[1]);
+    return -1;
+  }
+
+  memcpy(&value, in + 8, 4);
+  if ( value != (uint32_t) session->layers ||
+    size != lstm_session_snapshot_size(session, header[1]) ) {
+    fprintf(stderr, "%s error: the snapshot is of a different network\n", __func__);
+    return -1;
+  }
+  memcpy(&value, in + 12, 4);
+  if ( value != (uint32_t) session->model[0]->Y ) {
+    fprintf(stderr, "%s error: the snapshot is of a different network\n", __func__);
+    return -1;
+  }
+  in += 16;
+
+  while ( p < session->layers ) {
+    memcpy(&value, in, 4);
+    if ( value != (uint32_t) session->model[p]->N ) {
+      fprintf(stderr, "%s error: the snapshot is of a different network\n", __func__);
+      return -1;
+    }
+    in += 4;
+    ++p;
+  }
 
   p = 0;
+  while ( p < session->layers ) {
+    int N = session->model[p]->N;
+    in = snapshot_values_read(in, session->caches[p][current]->h, N, header[1]);
+    in = snapshot_values_read(in, session->caches[p][current]->c, N, header[1]);
+    ++p;
+  }
+
+  session->logits = session->caches[0][current]->probs;
+  snapshot_values_read(in, session->logits, session->model[0]->Y, header[1]);
+
+  return 0;
+}
+
+int lstm_session_snapshot_store(lstm_session_t *session, int type, const char *path)
+{
+  size_t size = lstm_session_snapshot_size(session, type);
+  void *buffer = e_calloc(1, size);
+  FILE *fp;
+  int ret = 0;
+
+  lstm_session_snapshot(session, type, buffer, size);
+
+  fp = fopen(path, "wb");
+  if ( fp == NULL ) {
+    fprintf(stderr, "%s error: Failed to open file: %s for writing.\n",
+      __func__, path);
+    free(buffer);
+    return -1;
+  }
+
+  if ( fwrite(buffer, 1, size, fp) != size )
+    ret = -1;
+  if ( fclose(fp) != 0 )
+    ret = -1;
+  if ( ret < 0 )
+    fprintf(stderr, "%s error: Failed to write %s\n", __func__, path);
+
+  free(buffer);
+  return ret;
+}
+
+int lstm_session_snapshot_load(lstm_session_t *session, const char *path)
+{
+  // A snapshot in doubles is the largest this session can restore
+  size_t size = lstm_session_snapshot_size(session, SNAPSHOT_DOUBLE);
+  void *buffer = e_calloc(1, size + 1);
+  FILE *fp;
+  int ret;
+
+  fp = fopen(path, "rb");
+  if ( fp == NULL ) {
+    fprintf(stderr, "%s error: Failed to open file: %s for reading.\n",
+      __func__, path);
+    free(buffer);
+    return -1;
+  }
+
+  size = fread(buffer, 1, size + 1, fp);
+  fclose(fp);
+
+  ret = lstm_session_restore(session, buffer, size);
+  free(buffer);
+  return ret;
+}
+
+lstm_batch_t* lstm_batch_init(lstm_model_t **model_layers, int layers, int capacity)
+{
+  int p = 0;
+  lstm_batch_t *batch = e_calloc(1, sizeof(lstm_batch_t));
+
+  batch->model = model_layers;
+  batch->layers = layers;
+  batch->capacity = capacity;
+
+  batch->h = e_calloc(layers, sizeof(double*));
+  batch->c = e_calloc(layers, sizeof(double*));
+  batch->X = e_calloc(layers, sizeof(double*));
+  batch->hf = e_calloc(layers, sizeof(double*));
+  batch->hi = e_calloc(layers, sizeof(double*));
+  batch->ho = e_calloc(layers, sizeof(double*));
+  batch->hc = e_calloc(layers, sizeof(double*));
+  batch->out = e_calloc(layers, sizeof(double*));
+
   while ( p < layers ) {
+    int N = model_layers[p]->N;
+
+    batch->h[p] = get_zero_vector(capacity * N);
+    batch->c[p] = get_zero_vector(capacity * N);
+    batch->X[p] = get_zero_vector(capacity * model_layers[p]->S);
+    batch->hf[p] = get_zero_vector(capacity * N);
+    batch->hi[p] = get_zero_vector(capacity * N);
+    batch->ho[p] = get_zero_vector(capacity * N);
+    batch->hc[p] = get_zero_vector(capacity * N);
+    batch->out[p] = get_zero_vector(capacity * model_layers[p]->Y);
+    ++p;
+  }
 
-    i = 0; 
-    while ( i < 2 ) {
-      lstm_cache_container_free( caches_layers[p][i] ); 
-      free(caches_layers[p][i]);
-      ++i;
+  return batch;
+}
+
+void lstm_batch_free(lstm_batch_t *batch)
+{
+  int p = 0;
+
+  while ( p < batch->layers ) {
+    free_vector(&batch->h[p]);
+    free_vector(&batch->c[p]);
+    free_vector(&batch->X[p]);
+    free_vector(&batch->hf[p]);
+    free_vector(&batch->hi[p]);
+    free_vector(&batch->ho[p]);
+    free_vector(&batch->hc[p]);
+    free_vector(&batch->out[p]);
+    ++p;
+  }
+
+  free(batch->h);
+  free(batch->c);
+  free(batch->X);
+  free(batch->hf);
+  free(batch->hi);
+  free(batch->ho);
+  free(batch->hc);
+  free(batch->out);
+  free(batch);
+}
+
+double* lstm_batch_step(lstm_batch_t *batch, const int *indices, int rows)
+{
+  int p = batch->layers - 1, r;
+
+  while ( p >= 0 ) {
+    lstm_model_t *model = batch->model[p];
+    int N = model->N, S = model->S, X = model->X, Y = model->Y;
+    double *x;
+
+    r = 0;
+    while ( r < rows ) {
+      x = &batch->X[p][r * S];
+      copy_vector(x, &batch->h[p][r * N], N);
+
+      if ( p == batch->layers - 1 ) {
+        vector_set_to_zero(&x[N], X);
+        if ( indices[r] >= 0 && indices[r] < X )
+          x[N + indices[r]] = 1.0;
+      } else {
+        copy_vector(&x[N], &batch->out[p+1][r * X], X);
+      }
+      ++r;
     }
 
-    free(caches_layers[p]);
+    fully_connected_forward_batch(batch->hf[p], model->Wf, batch->X[p], model->bf, N, S, rows);
+    sigmoid_forward(batch->hf[p], batch->hf[p], N * rows);
+
+    fully_connected_forward_batch(batch->hi[p], model->Wi, batch->X[p], model->bi, N, S, rows);
+    sigmoid_forward(batch->hi[p], batch->hi[p], N * rows);
+
+    fully_connected_forward_batch(batch->ho[p], model->Wo, batch->X[p], model->bo, N, S, rows);
+    sigmoid_forward(batch->ho[p], batch->ho[p], N * rows);
 
+    fully_connected_forward_batch(batch->hc[p], model->Wc, batch->X[p], model->bc, N, S, rows);
+    tanh_forward(batch->hc[p], batch->hc[p], N * rows);
+
+    // c = hf * c_old + hi * hc
+    vectors_multiply(batch->c[p], batch->hf[p], N * rows);
+    vectors_multiply(batch->hi[p], batch->hc[p], N * rows);
+    vectors_add(batch->c[p], batch->hi[p], N * rows);
+
+    // h = ho * tanh(c)
+    tanh_forward(batch->h[p], batch->c[p], N * rows);
+    vectors_multiply(batch->h[p], batch->ho[p], N * rows);
+
+    fully_connected_forward_batch(batch->out[p], model->Wy, batch->h[p], model->by, Y, N, rows);
+    --p;
+  }
+
+  return batch->out[0];
+}
+
+void lstm_batch_reset_row(lstm_batch_t *batch, int row)
+{
+  int p = 0;
+
+  while ( p < batch->layers ) {
+    int N = batch->model[p]->N;
+    vector_set_to_zero(&batch->h[p][row * N], N);
+    vector_set_to_zero(&batch->c[p][row * N], N);
+    vector_set_to_zero(&batch->out[p][row * batch->model[p]->Y], batch->model[p]->Y);
     ++p;
   }
+}
 
-  free(caches_layers);
-#ifdef WINDOWS
-  free(first_layer_input);
-#endif
+void lstm_batch_copy_row(lstm_batch_t *batch, int dst, int src)
+{
+  int p = 0;
+
+  if ( dst == src )
+    return;
+
+  while ( p < batch->layers ) {
+    int N = batch->model[p]->N, Y = batch->model[p]->Y;
+    copy_vector(&batch->h[p][dst * N], &batch->h[p][src * N], N);
+    copy_vector(&batch->c[p][dst * N], &batch->c[p][src * N], N);
+    copy_vector(&batch->out[p][dst * Y], &batch->out[p][src * Y], Y);
+    ++p;
+  }
+}
+
+void lstm_batch_get_state(lstm_batch_t *batch, int row, double *state)
+{
+  int p = 0, Y = batch->model[0]->Y;
+
+  while ( p < batch->layers ) {
+    int N = batch->model[p]->N;
+    copy_vector(state, &batch->h[p][row * N], N);
+    copy_vector(state + N, &batch->c[p][row * N], N);
+    state += 2 * N;
+    ++p;
+  }
+
+  copy_vector(state, &batch->out[0][row * Y], Y);
+}
+
+void lstm_batch_set_state(lstm_batch_t *batch, int row, const double *state)
+{
+  int p = 0, Y = batch->model[0]->Y;
+
+  while ( p < batch->layers ) {
+    int N = batch->model[p]->N;
+    copy_vector(&batch->h[p][row * N], (double*) state, N);
+    copy_vector(&batch->c[p][row * N], (double*) state + N, N);
+    state += 2 * N;
+    ++p;
+  }
+
+  copy_vector(&batch->out[0][row * Y], (double*) state, Y);
+}
+
+double* lstm_batch_sequence(lstm_batch_t *batch, const int *indices, int count)
+{
+  int p = batch->layers - 1, j, g, r;
+
+  while ( p >= 0 ) {
+    lstm_model_t *model = batch->model[p];
+    int N = model->N, S = model->S, X = model->X, Y = model->Y;
+    double *W[4], *bias[4], *gates[4];
+    double *h_prev, *c_prev;
+
+    W[0] = model->Wf; bias[0] = model->bf; gates[0] = batch->hf[p];
+    W[1] = model->Wi; bias[1] = model->bi; gates[1] = batch->hi[p];
+    W[2] = model->Wo; bias[2] = model->bo; gates[2] = batch->ho[p];
+    W[3] = model->Wc; bias[3] = model->bc; gates[3] = batch->hc[p];
+
+    // Input side of the gates, for all positions
+    g = 0;
+    while ( g < 4 ) {
+      if ( p == batch->layers - 1 ) {
+        // One-hot inputs pick a column of the weights
+        j = 0;
+        while ( j < count ) {
+          double *gate = &gates[g][j * N];
+          copy_vector(gate, bias[g], N);
+          if ( indices[j] >= 0 && indices[j] < X ) {
+            r = 0;
+            while ( r < N ) {
+              gate[r] += W[g][r * S + N + indices[j]];
+              ++r;
+            }
+          }
+          ++j;
+        }
+      } else {
+        fully_connected_forward_batch_strided(gates[g], W[g] + N, S,
+          batch->out[p+1], bias[g], N, X, count);
+      }
+      ++g;
+    }
+
+    // The recurrence, h and c of position j are written to row j
+    h_prev = batch->h[p];
+    c_prev = batch->c[p];
+    j = 0;
+    while ( j < count ) {
+      double *hf = &batch->hf[p][j * N], *hi = &batch->hi[p][j * N];
+      double *ho = &batch->ho[p][j * N], *hc = &batch->hc[p][j * N];
+      double *h = &batch->h[p][j * N], *c = &batch->c[p][j * N];
+
+      model->forward_N(hf, model->Wf, S, h_prev, NULL, N, N);
+      model->forward_N(hi, model->Wi, S, h_prev, NULL, N, N);
+      model->forward_N(ho, model->Wo, S, h_prev, NULL, N, N);
+      model->forward_N(hc, model->Wc, S, h_prev, NULL, N, N);
+      sigmoid_forward(hf, hf, N);
+      sigmoid_forward(hi, hi, N);
+      sigmoid_forward(ho, ho, N);
+      tanh_forward(hc, hc, N);
+
+      // c = hf * c_old + hi * hc
+      r = 0;
+      while ( r < N ) {
+        c[r] = hf[r] * c_prev[r] + hi[r] * hc[r];
+        ++r;
+      }
+
+      // h = ho * tanh(c)
+      tanh_forward(h, c, N);
+      vectors_multiply(h, ho, N);
+
+      h_prev = h;
+      c_prev = c;
+      ++j;
+    }
+
+    fully_connected_forward_batch(batch->out[p], model->Wy, batch->h[p], model->by, Y, N, count);
+    --p;
+  }
+
+  return batch->out[0];
+}
+
+/* A tagged line of output: the sample, a tab and its characters, with \\, \n, \r and \t escaped */
+static void lstm_write_tagged(writer_t *writer, int sample, const char *chars, int len)
+{
+  char tag[16];
+  int i = 0;
+
+  writer_write(writer, tag, snprintf(tag, sizeof(tag), "%d\t", sample));
+  while ( i < len ) {
+    if ( chars[i] == '\\' )
+      writer_write(writer, "\\\\", 2);
+    else if ( chars[i] == '\n' )
+      writer_write(writer, "\\n", 2);
+    else if ( chars[i] == '\r' )
+      writer_write(writer, "\\r", 2);
+    else if ( chars[i] == '\t' )
+      writer_write(writer, "\\t", 2);
+    else
+      writer_putc(writer, chars[i]);
+    ++i;
+  }
+  writer_putc(writer, '\n');
+}
+
+void lstm_batch_output_samples(lstm_model_t **model_layers, int layers,
+  set_t *char_index_mapping, const char *seed, int samples, int out_length,
+  writer_t *writers, writer_t *tagged)
+{
+  lstm_batch_t *batch = lstm_batch_init(model_layers, layers, samples);
+  sampler_t *sampler = lstm_sampler_init(model_layers[0]);
+  int Y = model_layers[0]->Y, i = 0, r, input;
+  int *indices = e_calloc(samples, sizeof(int));
+  char c;
+  double *logits;
+
+  // The seed is only fed through the first row
+  indices[0] = 0;
+  if ( seed[0] == '\0' )
+    lstm_batch_step(batch, indices, 1);
+  while ( seed[i] != '\0' ) {
+    indices[0] = set_char_to_indx(char_index_mapping, seed[i]);
+    lstm_batch_step(batch, indices, 1);
+    ++i;
+  }
+
+  r = 0;
+  while ( r < samples ) {
+    if ( tagged != NULL )
+      lstm_write_tagged(tagged, r, seed, i);
+    else
+      writer_write(&writers[r], seed, i);
+    lstm_batch_copy_row(batch, r, 0);
+    ++r;
+  }
+
+  // All samples draw the first character from the same distribution
+  logits = batch->out[0];
+  if ( out_length > 0 )
+    sampler_alias_build(sampler, logits);
+
+  i = 0;
+  while ( i < out_length ) {
+    r = 0;
+    while ( r < samples ) {
+      if ( i == 0 )
+        input = sampler_alias_draw(sampler);
+      else
+        input = sampler_sample(sampler, &logits[r * Y]);
+      c = set_indx_to_char(char_index_mapping, input);
+      if ( tagged != NULL ) {
+        lstm_write_tagged(tagged, r, &c, 1);
+      } else {
+        writer_putc(&writers[r], c);
+        writer_flush(&writers[r]);
+      }
+      indices[r] = input;
+      ++r;
+    }
+    // Every step reaches the output as it is sampled
+    if ( tagged != NULL )
+      writer_flush(tagged);
+
+    if ( ++i < out_length )
+      logits = lstm_batch_step(batch, indices, samples);
+  }
+
+  lstm_batch_free(batch);
+  sampler_free(sampler);
+  free(indices);
+}
+
+void lstm_output_string_layers_to_file(FILE * fp,lstm_model_t ** model_layers, 
+  set_t* char_index_mapping, int first, int numbers_to_display, int layers)
+{
+  lstm_session_t *session;
+  writer_t writer;
+
+  if ( fp == NULL ) 
+    return;
+
+  session = lstm_session_init(model_layers, layers);
+  writer_init(&writer, fp);
+
+  lstm_session_output_string(session, char_index_mapping, first,
+    numbers_to_display, &writer);
+
+  writer_flush(&writer);
+  lstm_session_free(session);
+}
+
+void lstm_output_string_layers(lstm_model_t ** model_layers, set_t* char_index_mapping,
+  int first, int numbers_to_display, int layers)
+{
+  lstm_output_string_layers_to_file(stdout, model_layers, char_index_mapping,
+    first, numbers_to_display, layers);
+}
+
+void lstm_output_string_from_string(lstm_model_t **model_layers, set_t* char_index_mapping,
+  char * input_string, int layers, int out_length)
+{
+  lstm_session_t *session;
+  writer_t writer;
+
+  session = lstm_session_init(model_layers, layers);
+  writer_init(&writer, stdout);
+
+  lstm_session_output_from_string(session, char_index_mapping, input_string,
+    out_length, &writer);
+  writer_putc(&writer, '\n');
+
+  writer_flush(&writer);
+  lstm_session_free(session);
 }
 
 void lstm_store_progress(const char* filename, unsigned int n, double loss)
@@ -1611,92 +3034,79 @@ void lstm_model_regularization(lstm_model_t* model, lstm_model_t* gradients)
   vectors_add_scalar_multiply(gradients->bf, model->bf, model->N, lambda);
 }
 
-//						model, number of training points, X_train, Y_train
-void lstm_train(lstm_model_t** model_layers, lstm_model_parameters_t *params,
-  set_t* char_index_mapping, unsigned int training_points,
-  int* X_train, int* Y_train, unsigned int layers, double *loss_out)
+/* Reads the clock and counters when profiling, see profile.h */
+static double lstm_profile_clock(profile_t *profile)
 {
-  unsigned int p, i = 0, b = 0, q = 0, e1 = 0, e2 = 0,
-    e3, record_iteration = 0, tmp_count, trailing;
-  unsigned long n = 0, epoch = 0;
-  double loss = -1, loss_tmp = 0.0, record_keeper = 0.0;
-  double initial_learning_rate = params->learning_rate;
-  time_t time_iter;
-  char time_buffer[40];
-  unsigned long iterations = params->iterations;
-  unsigned long epochs = params->epochs;
-  int stateful = params->stateful, decrease_lr = params->decrease_lr;
-  // configuration for output printing during training
-  int print_progress = params->print_progress;
-  int print_progress_iterations = params->print_progress_iterations;
-  int print_progress_sample_output = params->print_progress_sample_output;
-  int print_progress_to_file = params->print_progress_to_file;
-  int print_progress_number_of_chars = params->print_progress_number_of_chars;
-  char *print_progress_to_file_name = params->print_sample_output_to_file_name;
-  char *print_progress_to_file_arg = params->print_sample_output_to_file_arg;
-  int store_progress_every_x_iterations = params->store_progress_every_x_iterations;
-  char *store_progress_file_name = params->store_progress_file_name;
-  int store_network_every = params->store_network_every;
-
-  lstm_values_state_t ** stateful_d_next = NULL;
-  lstm_values_cache_t ***cache_layers;
-  lstm_values_next_cache_t **d_next_layers;
-
-  lstm_model_t **gradient_layers, **gradient_layers_entry,  **M_layers = NULL, **R_layers = NULL;
+  return profile != NULL ? profile_begin(profile) : 0.0;
+}
 
-#ifdef WINDOWS
-  double *first_layer_input = malloc(model_layers[0]->Y*sizeof(double));
+static void lstm_profile_add(profile_t *profile, int phase, double start)
+{
+  if ( profile != NULL )
+    profile_add(profile, phase, start);
+}
 
-  if ( first_layer_input == NULL ) {
-    fprintf(stderr, "%s.%s.%d malloc(%zu) failed\r\n", 
-      __FILE__, __func__, __LINE__, model_layers[0]->Y*sizeof(double));
-    exit(1);
+//						model, number of training points, X_train, Y_train
+lstm_trainer_t* lstm_trainer_init(lstm_model_t **model_layers, lstm_model_parameters_t *params,
+  unsigned int training_points, int *X_train, int *Y_train, unsigned int layers)
+{
+  unsigned int i = 0, p;
+  lstm_trainer_t *trainer = e_calloc(1, sizeof(lstm_trainer_t));
+
+  trainer->model = model_layers;
+  trainer->layers = layers;
+  trainer->params = params;
+  trainer->training_points = training_points;
+  trainer->X_train = X_train;
+  trainer->Y_train = Y_train;
+  trainer->loss = -1;
+  trainer->initial_learning_rate = params->learning_rate;
+  trainer->first_layer_input = get_zero_vector(model_layers[0]->Y);
+
+  if ( params->profile ) {
+    trainer->profile = e_calloc(1, sizeof(profile_t));
+    profile_init(trainer->profile, params->profile);
   }
-#else
-  double first_layer_input[model_layers[0]->Y];
-#endif
 
-  if ( stateful ) {
-    stateful_d_next = e_calloc(layers, sizeof(lstm_values_state_t*));
+  if ( params->stateful ) {
+    trainer->stateful_d_next = e_calloc(layers, sizeof(lstm_values_state_t*));
 
     i = 0;
     while ( i < layers ) {
-      stateful_d_next[i] = e_calloc( training_points/params->mini_batch_size + 1, sizeof(lstm_values_state_t));
-
-      lstm_values_state_init(&stateful_d_next[i], model_layers[i]->N);
+      lstm_values_state_init(&trainer->stateful_d_next[i], model_layers[i]->N);
       ++i;
     }
   }
 
   i = 0;
-  cache_layers = e_calloc(layers, sizeof(lstm_values_cache_t**));
+  trainer->cache_layers = e_calloc(layers, sizeof(lstm_values_cache_t**));
 
   while ( i < layers ) {
-    cache_layers[i] = e_calloc(params->mini_batch_size + 1,
+    trainer->cache_layers[i] = e_calloc(params->mini_batch_size + 1,
       sizeof(lstm_values_cache_t*));
 
     p = 0;
     while ( p < params->mini_batch_size + 1 ) {
-      cache_layers[i][p] = lstm_cache_container_init(
+      trainer->cache_layers[i][p] = lstm_cache_container_init(
         model_layers[i]->X, model_layers[i]->N, model_layers[i]->Y);
-      if ( cache_layers[i][p] == NULL )
-        lstm_init_fail("Failed to allocate memory for the caches\n");		
+      if ( trainer->cache_layers[i][p] == NULL )
+        lstm_init_fail("Failed to allocate memory for the caches\n");
       ++p;
     }
 
     ++i;
   }
 
-  gradient_layers = e_calloc(layers, sizeof(lstm_model_t*) );
+  trainer->gradient_layers = e_calloc(layers, sizeof(lstm_model_t*) );
 
-  gradient_layers_entry = e_calloc(layers, sizeof(lstm_model_t*) );
+  trainer->gradient_layers_entry = e_calloc(layers, sizeof(lstm_model_t*) );
 
-  d_next_layers = e_calloc(layers, sizeof(lstm_values_next_cache_t *));
+  trainer->d_next_layers = e_calloc(layers, sizeof(lstm_values_next_cache_t *));
 
   if ( params->optimizer == OPTIMIZE_ADAM ) {
 
-    M_layers = e_calloc(layers, sizeof(lstm_model_t*) );
-    R_layers = e_calloc(layers, sizeof(lstm_model_t*) );
+    trainer->M_layers = e_calloc(layers, sizeof(lstm_model_t*) );
+    trainer->R_layers = e_calloc(layers, sizeof(lstm_model_t*) );
 
   }
 
@@ -1704,233 +3114,415 @@ void lstm_train(lstm_model_t** model_layers, lstm_model_parameters_t *params,
   while ( i < layers ) {
     lstm_init_model(model_layers[i]->X,
       model_layers[i]->N, model_layers[i]->Y,
-      &gradient_layers[i], 1, params);
+      &trainer->gradient_layers[i], 1, params);
     lstm_init_model(model_layers[i]->X,
       model_layers[i]->N, model_layers[i]->Y,
-      &gradient_layers_entry[i], 1, params);
-    lstm_values_next_cache_init(&d_next_layers[i], 
+      &trainer->gradient_layers_entry[i], 1, params);
+    lstm_values_next_cache_init(&trainer->d_next_layers[i], 
       model_layers[i]->N, model_layers[i]->X);
 
     if ( params->optimizer == OPTIMIZE_ADAM ) {
       lstm_init_model(model_layers[i]->X,
-      model_layers[i]->N, model_layers[i]->Y, &M_layers[i], 1, params);
+      model_layers[i]->N, model_layers[i]->Y, &trainer->M_layers[i], 1, params);
       lstm_init_model(model_layers[i]->X,
-      model_layers[i]->N, model_layers[i]->Y, &R_layers[i], 1, params);
+      model_layers[i]->N, model_layers[i]->Y, &trainer->R_layers[i], 1, params);
     }
 
     ++i;
   }
 
-  i = 0; b = 0;
-  while ( n < iterations ) {
+  return trainer;
+}
 
-    if ( epochs && epoch >= epochs ) {
-      // We have done enough iterations now
-      break;
-    }
+double lstm_trainer_step(lstm_trainer_t *trainer)
+{
+  lstm_model_t **model_layers = trainer->model;
+  lstm_model_parameters_t *params = trainer->params;
+  lstm_values_cache_t ***cache_layers = trainer->cache_layers;
+  lstm_values_next_cache_t **d_next_layers = trainer->d_next_layers;
+  lstm_values_state_t **stateful_d_next = trainer->stateful_d_next;
+  lstm_model_t **gradient_layers = trainer->gradient_layers;
+  lstm_model_t **gradient_layers_entry = trainer->gradient_layers_entry;
+  double *first_layer_input = trainer->first_layer_input;
+  int *X_train = trainer->X_train, *Y_train = trainer->Y_train;
+  unsigned int layers = trainer->layers, training_points = trainer->training_points;
+  unsigned int p, i = trainer->i, b, q, e1 = 0, e2 = 0, e3 = 0, tmp_count, trailing;
+  unsigned long n = trainer->n;
+  int stateful = params->stateful;
+  double loss_tmp = 0.0, start, step_begin = trace_begin(), begin;
+  profile_t *profile = trainer->profile;
+
+  b = i;
+
+  q = 0;
+
+  while ( q < layers ) {
+      if ( stateful ) {
+        if ( q == 0 )
+          lstm_cache_container_set_start(cache_layers[q][0],  model_layers[q]->N);
+        else
+          lstm_next_state_copy(stateful_d_next[q], cache_layers[q][0], model_layers[q]->N, 0);
+      } else {
+        lstm_cache_container_set_start(cache_layers[q][0], model_layers[q]->N);
+      }
+    ++q;
+  }
 
-    b = i;
+  unsigned int check = i % training_points;
 
-    loss_tmp = 0.0;
+  trailing = params->mini_batch_size;
 
-    q = 0;
+  if ( i + params->mini_batch_size >= training_points ) {
+    trailing = training_points - i;
+  }
 
-    while ( q < layers ) {
-        if ( stateful ) {
-          if ( q == 0 )
-            lstm_cache_container_set_start(cache_layers[q][0],  model_layers[q]->N);
-          else
-            lstm_next_state_copy(stateful_d_next[q], cache_layers[q][0], model_layers[q]->N, 0);
-        } else {
-          lstm_cache_container_set_start(cache_layers[q][0], model_layers[q]->N);
-        }
-      ++q;
-    }
+  q = 0;
 
-    unsigned int check = i % training_points;
+  while ( q < trailing ) {
+    e1 = q;
+    e2 = q + 1;
 
-    trailing = params->mini_batch_size;
+    e3 = i % training_points;
 
-    if ( i + params->mini_batch_size >= training_points ) {
-      trailing = training_points - i;
+    tmp_count = 0;
+    while ( tmp_count < model_layers[0]->Y ) {
+      first_layer_input[tmp_count] = 0.0; 
+      ++tmp_count;
     }
 
-    q = 0;
+    first_layer_input[X_train[e3]] = 1.0;
 
-    while ( q < trailing ) {
-      e1 = q;
-      e2 = q + 1;
+    start = lstm_profile_clock(profile);
 
-      e3 = i % training_points;
+    /* Layer numbering starts at the output point of the net */
+    p = layers - 1;
+    begin = trace_begin();
+    lstm_forward_propagate(model_layers[p],
+      first_layer_input,
+      cache_layers[p][e1],
+      cache_layers[p][e2],
+      p == 0);
+    trace_end("forward", p, begin);
 
-      tmp_count = 0;
-      while ( tmp_count < model_layers[0]->Y ) {
-        first_layer_input[tmp_count] = 0.0; 
-        ++tmp_count;
+    if ( p > 0 ) {
+      --p;
+      while ( p <= layers - 1 ) {
+        begin = trace_begin();
+        lstm_forward_propagate(model_layers[p],
+          cache_layers[p+1][e2]->probs,
+          cache_layers[p][e1],
+          cache_layers[p][e2],
+          p == 0);	
+        trace_end("forward", p, begin);
+        --p;
       }
+      p = 0;
+    }
 
-      first_layer_input[X_train[e3]] = 1.0;
+    lstm_profile_add(profile, PROFILE_FORWARD, start);
+    start = lstm_profile_clock(profile);
+    begin = trace_begin();
+    loss_tmp += cross_entropy(cache_layers[p][e2]->probs, Y_train[e3]);
+    trace_end("loss", -1, begin);
+    lstm_profile_add(profile, PROFILE_LOSS, start);
+    ++i; ++q;
+  }
 
-      /* Layer numbering starts at the output point of the net */
-      p = layers - 1;
-      lstm_forward_propagate(model_layers[p],
-        first_layer_input,
-        cache_layers[p][e1],
-        cache_layers[p][e2],
-        p == 0);
+  loss_tmp /= (q+1);
 
-      if ( p > 0 ) {
-        --p;
-        while ( p <= layers - 1 ) {
-          lstm_forward_propagate(model_layers[p],
-            cache_layers[p+1][e2]->probs,
-            cache_layers[p][e1],
-            cache_layers[p][e2],
-            p == 0);	
-          --p;
-        }
-        p = 0;
-      }
+  if ( trainer->loss < 0 )
+    trainer->loss = loss_tmp;
+
+  trainer->loss = loss_tmp * params->loss_moving_avg + (1 - params->loss_moving_avg) * trainer->loss;
 
-      loss_tmp += cross_entropy(cache_layers[p][e2]->probs, Y_train[e3]);
-      ++i; ++q;
+  if ( n == 0 )
+    trainer->record_keeper = trainer->loss;
+
+  if ( trainer->loss < trainer->record_keeper ) {
+    trainer->record_keeper = trainer->loss;
+    trainer->record_iteration = n;
+  }
+
+  if ( stateful ) {
+    p = 0;
+    while ( p < layers ) {
+      lstm_next_state_copy(stateful_d_next[p], cache_layers[p][e2], model_layers[p]->N, 1);
+      ++p;
     }
+  }
 
-    loss_tmp /= (q+1);
+  p = 0;
+  while ( p < layers ) {
+    lstm_zero_the_model(gradient_layers[p]);
+    lstm_zero_d_next(d_next_layers[p], model_layers[p]->X, model_layers[p]->N);
+    ++p;
+  }
 
-    if ( loss < 0 )
-      loss = loss_tmp;
+  while ( q > 0 ) {
+    e1 = q;
+    e2 = q - 1;
 
-    loss = loss_tmp * params->loss_moving_avg + (1 - params->loss_moving_avg) * loss;
+    e3 = ( training_points + i - 1 ) % training_points;
 
-    if ( n == 0 )
-      record_keeper = loss;
+    start = lstm_profile_clock(profile);
 
-    if ( loss < record_keeper ) {
-      record_keeper = loss;
-      record_iteration = n;
+    p = 0;
+    while ( p < layers ) {
+      lstm_zero_the_model(gradient_layers_entry[p]);
+      ++p;
     }
 
-    if ( stateful ) {
-      p = 0;
+    p = 0;
+    begin = trace_begin();
+    lstm_backward_propagate(model_layers[p],
+      cache_layers[p][e1]->probs,
+      Y_train[e3], 
+      d_next_layers[p],
+      cache_layers[p][e1],
+      gradient_layers_entry[0],
+      d_next_layers[p]);
+    trace_end("backward", p, begin);
+
+    if ( p < layers ) {
+      ++p;
       while ( p < layers ) {
-        lstm_next_state_copy(stateful_d_next[p], cache_layers[p][e2], model_layers[p]->N, 1);
+        begin = trace_begin();
+        lstm_backward_propagate(model_layers[p],
+          d_next_layers[p-1]->dldY_pass,
+          -1,
+          d_next_layers[p],
+          cache_layers[p][e1],
+          gradient_layers_entry[p],
+          d_next_layers[p]);
+        trace_end("backward", p, begin);
         ++p;
       }
     }
 
-    p = 0;
+    lstm_profile_add(profile, PROFILE_BACKWARD, start);
+    start = lstm_profile_clock(profile);
+
+    p = 0; 
+
+    begin = trace_begin();
     while ( p < layers ) {
-      lstm_zero_the_model(gradient_layers[p]);
-      lstm_zero_d_next(d_next_layers[p], model_layers[p]->X, model_layers[p]->N);
+      sum_gradients(gradient_layers[p], gradient_layers_entry[p]);
       ++p;
     }
+    trace_end("accumulate", -1, begin);
 
-    while ( q > 0 ) {
-      e1 = q;
-      e2 = q - 1;
+    lstm_profile_add(profile, PROFILE_ACCUMULATE, start);
 
-      e3 = ( training_points + i - 1 ) % training_points;
+    i--; q--;
+  }
 
-      p = 0;
-      while ( p < layers ) {
-        lstm_zero_the_model(gradient_layers_entry[p]);
-        ++p;
-      }
+  assert(check == e3);
+  (void) check;
 
-      p = 0;
-      lstm_backward_propagate(model_layers[p],
-        cache_layers[p][e1]->probs,
-        Y_train[e3], 
-        d_next_layers[p],
-        cache_layers[p][e1],
-        gradient_layers_entry[0],
-        d_next_layers[p]);
-
-      if ( p < layers ) {
-        ++p;
-        while ( p < layers ) {
-          lstm_backward_propagate(model_layers[p],
-            d_next_layers[p-1]->dldY_pass,
-            -1,
-            d_next_layers[p],
-            cache_layers[p][e1],
-            gradient_layers_entry[p],
-            d_next_layers[p]);
-          ++p;
-        }
-      }
+  start = lstm_profile_clock(profile);
 
-      p = 0; 
+  begin = trace_begin();
+  p = 0;
+  while ( p < layers ) {
 
-      while ( p < layers ) {
-        sum_gradients(gradient_layers[p], gradient_layers_entry[p]);
-        ++p;
-      }
+    if ( params->gradient_clip )
+      gradients_clip(gradient_layers[p], params->gradient_clip_limit);
 
-      i--; q--;
-    }
+    if ( params->gradient_fit )
+      gradients_fit(gradient_layers[p], params->gradient_clip_limit);
 
-    assert(check == e3);
+    ++p;
+  }
 
-    p = 0;
+  trace_end("clip", -1, begin);
+  lstm_profile_add(profile, PROFILE_CLIP, start);
+  start = lstm_profile_clock(profile);
+
+  p = 0;
+
+  switch ( params->optimizer ) {
+  case OPTIMIZE_ADAM:
     while ( p < layers ) {
+      begin = trace_begin();
+      gradients_adam_optimizer(
+        model_layers[p],
+        gradient_layers[p],
+        trainer->M_layers[p],
+        trainer->R_layers[p],
+        n);
+      trace_end("optimizer", p, begin);
+      ++p;
+    }
+    break;
+  case OPTIMIZE_GRADIENT_DESCENT:
+    while ( p < layers ) {
+      begin = trace_begin();
+      gradients_decend(model_layers[p], gradient_layers[p]);
+      trace_end("optimizer", p, begin);
+      ++p;
+    }
+    break;
+  default:
+    fprintf( stderr,
+      "Failed to update gradients, no acceptible optimization algorithm provided.\n\
+      lstm_model_parameters_t has a field called 'optimizer'. Set this value to:\n\
+      %d: Adam gradients optimizer algorithm\n\
+      %d: Gradients descent algorithm.\n",
+      OPTIMIZE_ADAM,
+      OPTIMIZE_GRADIENT_DESCENT
+    );
+    exit(1);
+    break;
+  }
 
-      if ( params->gradient_clip )
-        gradients_clip(gradient_layers[p], params->gradient_clip_limit);
+  lstm_profile_add(profile, PROFILE_OPTIMIZER, start);
+  if ( profile != NULL )
+    profile->chars += trailing;
 
-      if ( params->gradient_fit )
-        gradients_fit(gradient_layers[p], params->gradient_clip_limit);
+  if ( b + params->mini_batch_size >= training_points )
+    trainer->epoch++;
 
-      ++p;
+  i = (b + params->mini_batch_size) % training_points;
+
+  if ( i < params->mini_batch_size ) {
+    i = 0;
+  }
+
+  if ( params->decrease_lr ) {
+    params->learning_rate = trainer->initial_learning_rate / ( 1.0 + n / params->learning_rate_decrease );
+  }
+
+  trainer->i = i;
+  trainer->n = n + 1;
+
+  trace_end("step", -1, step_begin);
+  return trainer->loss;
+}
+
+void lstm_trainer_free(lstm_trainer_t *trainer)
+{
+  unsigned int p = 0, i;
+
+  while ( p < trainer->layers ) {
+    lstm_values_next_cache_free(trainer->d_next_layers[p]);
+
+    i = 0;
+    while ( i < trainer->params->mini_batch_size + 1 ) {
+      lstm_cache_container_free(trainer->cache_layers[p][i]);
+      free(trainer->cache_layers[p][i]);
+      ++i;
+    }
+    free(trainer->cache_layers[p]);
+
+    if ( trainer->M_layers != NULL ) {
+      lstm_free_model(trainer->M_layers[p]);
+      lstm_free_model(trainer->R_layers[p]);
     }
 
+    lstm_free_model(trainer->gradient_layers_entry[p]);
+    lstm_free_model(trainer->gradient_layers[p]);
+
+    ++p;
+  }
+
+  if ( trainer->stateful_d_next != NULL ) {
     p = 0;
+    while ( p < trainer->layers ) {
+      free_vector(&trainer->stateful_d_next[p]->c);
+      free_vector(&trainer->stateful_d_next[p]->h);
+      free(trainer->stateful_d_next[p]);
+      ++p;
+    }
+    free(trainer->stateful_d_next);
+  }
 
-    switch ( params->optimizer ) {
-    case OPTIMIZE_ADAM:
-      while ( p < layers ) {
-        gradients_adam_optimizer(
-          model_layers[p],
-          gradient_layers[p],
-          M_layers[p],
-          R_layers[p],
-          n);
-        ++p;
-      }
-      break;
-    case OPTIMIZE_GRADIENT_DESCENT:
-      while ( p < layers ) {
-        gradients_decend(model_layers[p], gradient_layers[p]);
-        ++p;
-      }
-      break;
-    default:
-      fprintf( stderr,
-        "Failed to update gradients, no acceptible optimization algorithm provided.\n\
-        lstm_model_parameters_t has a field called 'optimizer'. Set this value to:\n\
-        %d: Adam gradients optimizer algorithm\n\
-        %d: Gradients descent algorithm.\n",
-        OPTIMIZE_ADAM,
-        OPTIMIZE_GRADIENT_DESCENT
-      );
-      exit(1);
+  free(trainer->cache_layers);
+  free(trainer->d_next_layers);
+  free(trainer->gradient_layers);
+  free(trainer->gradient_layers_entry);
+  free(trainer->M_layers);
+  free(trainer->R_layers);
+  free_vector(&trainer->first_layer_input);
+  if ( trainer->profile != NULL )
+    profile_free(trainer->profile);
+  free(trainer->profile);
+  free(trainer);
+}
+
+void lstm_train(lstm_model_t** model_layers, lstm_model_parameters_t *params,
+  set_t* char_index_mapping, unsigned int training_points,
+  int* X_train, int* Y_train, unsigned int layers, double *loss_out)
+{
+  unsigned long n, epoch;
+  unsigned int b;
+  double loss, learning_rate, start, begin;
+  time_t time_iter;
+  char time_buffer[40];
+  unsigned long iterations = params->iterations;
+  unsigned long epochs = params->epochs;
+  // configuration for output printing during training
+  int print_progress = params->print_progress;
+  int print_progress_iterations = params->print_progress_iterations;
+  int print_progress_sample_output = params->print_progress_sample_output;
+  int print_progress_to_file = params->print_progress_to_file;
+  int print_progress_number_of_chars = params->print_progress_number_of_chars;
+  char *print_progress_to_file_name = params->print_sample_output_to_file_name;
+  char *print_progress_to_file_arg = params->print_sample_output_to_file_arg;
+  int store_progress_every_x_iterations = params->store_progress_every_x_iterations;
+  char *store_progress_file_name = params->store_progress_file_name;
+  int store_network_every = params->store_network_every;
+
+  lstm_trainer_t *trainer;
+  lstm_session_t *sample_session = NULL;
+  writer_t sample_writer;
+  checkpoint_t *checkpoint = NULL;
+
+  trainer = lstm_trainer_init(model_layers, params, training_points,
+    X_train, Y_train, layers);
+
+  if ( params->resume_training_name != NULL &&
+    lstm_trainer_resume(trainer, params->resume_training_name) < 0 )
+    lstm_init_fail("Failed to resume training\n");
+
+  while ( trainer->n < iterations ) {
+
+    if ( epochs && trainer->epoch >= epochs ) {
+      // We have done enough iterations now
       break;
     }
 
+    // Reported as they were during the step
+    n = trainer->n;
+    epoch = trainer->epoch;
+    b = trainer->i;
+    learning_rate = params->learning_rate;
+
+    trace_poll();
+    loss = lstm_trainer_step(trainer);
+
     if ( print_progress && !( n % print_progress_iterations ) ) {
 
+      start = lstm_profile_clock(trainer->profile);
+      begin = trace_begin();
+
       memset(time_buffer, '\0', sizeof time_buffer);
       time(&time_iter);
       strftime(time_buffer, sizeof time_buffer, "%X", localtime(&time_iter));
 
-      printf("%s Iteration: %lu (epoch: %lu), Loss: %lf, record: %lf (iteration: %d), LR: %lf\n",
-        time_buffer, n, epoch, loss, record_keeper, record_iteration, params->learning_rate);
+      printf("%s Iteration: %lu (epoch: %lu), Loss: %lf, record: %lf (iteration: %lu), LR: %lf\n",
+        time_buffer, n, epoch, loss, trainer->record_keeper, trainer->record_iteration, learning_rate);
+
+      if ( sample_session == NULL && ( print_progress_sample_output || print_progress_to_file ) )
+        sample_session = lstm_session_init(model_layers, layers);
 
       if ( print_progress_sample_output ) {
         printf("=====================================================\n");
-        lstm_output_string_layers(model_layers, char_index_mapping, X_train[b],
-          print_progress_number_of_chars, layers);
+        fflush(stdout);
+        writer_init(&sample_writer, stdout);
+        lstm_session_reset(sample_session);
+        lstm_session_output_string(sample_session, char_index_mapping, X_train[b],
+          print_progress_number_of_chars, &sample_writer);
+        writer_flush(&sample_writer);
         printf("\n=====================================================\n");
       }
 
@@ -1939,10 +3531,19 @@ void lstm_train(lstm_model_t** model_layers, lstm_model_parameters_t *params,
           print_progress_to_file_arg);
         if ( fp_progress_output != NULL ) {
           fprintf(fp_progress_output, "%s====== Iteration: %lu, loss: %.5lf ======\n", n==0 ? "" : "\n", n, loss);
-          lstm_output_string_layers_to_file(fp_progress_output, model_layers, char_index_mapping, X_train[b], print_progress_number_of_chars, layers);
+          writer_init(&sample_writer, fp_progress_output);
+          lstm_session_reset(sample_session);
+          lstm_session_output_string(sample_session, char_index_mapping, X_train[b],
+            print_progress_number_of_chars, &sample_writer);
+          writer_flush(&sample_writer);
           fclose(fp_progress_output);
         }
       }
+
+      trace_end("progress", -1, begin);
+      lstm_profile_add(trainer->profile, PROFILE_SAMPLE, start);
+      if ( trainer->profile != NULL )
+        profile_print(trainer->profile, stdout);
 			
       // Flushing stdout
       fflush(stdout);
@@ -1952,74 +3553,85 @@ void lstm_train(lstm_model_t** model_layers, lstm_model_parameters_t *params,
       lstm_store_progress(store_progress_file_name, n, loss);
 
     if ( store_network_every && !(n % store_network_every) ) {
-      lstm_store(
-        params->store_network_name_raw,
-        char_index_mapping,
-        model_layers,
-        layers);
-      lstm_store_net_layers_as_json(model_layers, params->store_network_name_json,
-        params->store_char_indx_map_name, char_index_mapping, layers);
+      start = lstm_profile_clock(trainer->profile);
+      begin = trace_begin();
+      if ( checkpoint == NULL )
+        checkpoint = checkpoint_init(params);
+      // Written in the background, training continues meanwhile
+      checkpoint_take(checkpoint, model_layers, char_index_mapping, layers, trainer);
+      trace_end("checkpoint", -1, begin);
+      lstm_profile_add(trainer->profile, PROFILE_CHECKPOINT, start);
     }
+  }
 
-    if ( b + params->mini_batch_size >= training_points )
-      epoch++;
+  start = lstm_profile_clock(trainer->profile);
+  begin = trace_begin();
+  if ( checkpoint != NULL )
+    checkpoint_free(checkpoint);
 
-    i = (b + params->mini_batch_size) % training_points;
+  // The last steps are not lost when resuming
+  if ( params->store_training_name != NULL )
+    lstm_trainer_store(trainer, char_index_mapping, params->store_training_name);
 
-    if ( i < params->mini_batch_size ) {
-      i = 0;
-    }
-
-    if ( decrease_lr ) {
-      params->learning_rate = initial_learning_rate / ( 1.0 + n / params->learning_rate_decrease );
-      //printf("learning rate: %lf\n", model->params->learning_rate);
-    }
+  if ( checkpoint != NULL || params->store_training_name != NULL ) {
+    trace_end("checkpoint wait", -1, begin);
+    lstm_profile_add(trainer->profile, PROFILE_CHECKPOINT, start);
+  }
 
-    ++n;
+  if ( trainer->profile != NULL ) {
+    printf("Time of training:\n");
+    profile_print(trainer->profile, stdout);
   }
 
   // Reporting the loss value
-  *loss_out = loss;
+  *loss_out = trainer->loss;
 
-  p = 0;
-  while ( p < layers ) {
-    lstm_values_next_cache_free(d_next_layers[p]);
+  if ( sample_session != NULL )
+    lstm_session_free(sample_session);
 
-    i = 0;
-    while ( i < params->mini_batch_size ) {
-      lstm_cache_container_free(cache_layers[p][i]);
-      lstm_cache_container_free(cache_layers[p][i]);
-      ++i;
-    }
+  lstm_trainer_free(trainer);
+}
 
-    if ( params->optimizer == OPTIMIZE_ADAM ) {
-      lstm_free_model(M_layers[p]);
-      lstm_free_model(R_layers[p]);
-    }
+void lstm_benchmark(lstm_model_t** model_layers, lstm_model_parameters_t *params,
+  unsigned int training_points, int* X_train, int* Y_train, unsigned int layers,
+  unsigned long steps)
+{
+  lstm_trainer_t *trainer;
+  roofline_peak_t peak;
+  roofline_t kernels, counts;
+  unsigned long n;
+  double begin, seconds;
 
-    lstm_free_model(gradient_layers_entry[p]);
-    lstm_free_model(gradient_layers[p]);
+  trainer = lstm_trainer_init(model_layers, params, training_points,
+    X_train, Y_train, layers);
 
-    ++p;
+  // Everything allocated for training is what the kernels work on
+  roofline_peak(&peak, e_alloc_total());
+
+  // Warm, then every kernel call timed, then only counted for the time of the steps
+  lstm_trainer_step(trainer);
+
+  roofline_start(ROOFLINE_TIME);
+  n = 0;
+  while ( n < steps ) {
+    lstm_trainer_step(trainer);
+    ++n;
   }
+  roofline_stop(&kernels);
 
-  if ( stateful && stateful_d_next != NULL ) {
-    i = 0;
-    while ( i < layers ) {
-      free(stateful_d_next[i]);
-      ++i;
-    }
-    free(stateful_d_next);
+  roofline_start(ROOFLINE_COUNT);
+  begin = time_seconds();
+  n = 0;
+  while ( n < steps ) {
+    lstm_trainer_step(trainer);
+    ++n;
   }
+  seconds = time_seconds() - begin;
+  roofline_stop(&counts);
 
+  printf("Benchmark of %lu training steps of %d characters, %.3f ms a step:\n",
+    steps, params->mini_batch_size, 1e3 * seconds / steps);
+  roofline_print(&peak, &kernels, &counts, seconds, stdout);
 
-  free(cache_layers);
-  free(gradient_layers);
-  if ( M_layers != NULL )
-    free(M_layers);
-  if ( R_layers != NULL )
-    free(R_layers);
-#ifdef WINDOWS
-  free(first_layer_input);
-#endif
+  lstm_trainer_free(trainer);
 }
@@ -52,6 +52,8 @@
 #include "utilities.h"
 #include "set.h"
 #include "layers.h"
+#include "sampler.h"
+#include "profile.h"
 #include "assert.h"
 
 #define	OPTIMIZE_ADAM                         0
@@ -59,7 +61,101 @@
 
 #define LSTM_MAX_LAYERS                       10
 
-#define BINARY_FILE_VERSION                   1
+#define BINARY_FILE_VERSION                   2
+
+/*
+* Network file, version 2 (version 1 files are still read)
+*
+* lstm_file_header_t
+* lstm_file_layer_t, for each layer (output layer first)
+* --- zeros up to the first LSTM_FILE_ALIGNMENT boundary ---
+* One section per layer, starting at lstm_file_layer_t.offset:
+*   Wy, Wi, Wc, Wo, Wf, by, bi, bc, bf, bo
+*   each padded with zeros to a multiple of LSTM_FILE_ARRAY_ALIGNMENT bytes
+*
+* Values are in the byte order of the machine that stored the file.
+* Sections are page aligned, so a loader can map them straight into
+* memory, see \ref lstm_load.
+*
+* Networks stored with another type than LSTM_DTYPE_DOUBLE, see
+* \ref lstm_store_as, have their sections right after the layer table
+* instead, one after the other. A section holds the same arrays without
+* padding, each value in 16 bits (LSTM_DTYPE_HALF, LSTM_DTYPE_BFLOAT16),
+* or a double scale followed by one signed byte per value
+* (LSTM_DTYPE_INT8, value = byte * scale). With LSTM_DTYPE_ENTROPY the
+* bytes of a section are split into planes, byte i of every value in
+* plane i, and each plane is stored as a uint32_t size followed by the
+* plane coded with \ref entropy_encode.
+*/
+#define LSTM_FILE_MAGIC                       "LSTMNET2"
+#define LSTM_FILE_ALIGNMENT                   4096
+#define LSTM_FILE_ARRAY_ALIGNMENT             64
+/** Mapped files up to this size are checked against their checksums at load */
+#define LSTM_FILE_VERIFY_SIZE                 ( 64 << 20 )
+#define LSTM_DTYPE_DOUBLE                     0
+#define LSTM_DTYPE_HALF                       1
+#define LSTM_DTYPE_BFLOAT16                   2
+#define LSTM_DTYPE_INT8                       3
+#define LSTM_DTYPE_ENTROPY                    0x100   /**< Flag, sections are entropy coded */
+
+/* Weights in the JSON file, see \ref lstm_store_net_layers_as_json */
+#define LSTM_JSON_NUMBERS                     0
+#define LSTM_JSON_FLOAT32                     1
+
+typedef struct lstm_file_header_t {
+  char magic[8];              /**< LSTM_FILE_MAGIC, not terminated */
+  uint32_t version;           /**< BINARY_FILE_VERSION */
+  uint32_t dtype;             /**< Type of the weights, LSTM_DTYPE_DOUBLE, ... possibly | LSTM_DTYPE_ENTROPY */
+  uint32_t features;          /**< Number of features (F) */
+  uint32_t layers;            /**< Number of layers (L) */
+  uint32_t alignment;         /**< Alignment of the sections, LSTM_FILE_ALIGNMENT */
+  uint32_t crc;               /**< CRC-32 of the header and layer table, with this field set to 0 */
+  unsigned char set[256];     /**< Feature values, F are used */
+} lstm_file_header_t;
+
+typedef struct lstm_file_layer_t {
+  uint32_t X;                 /**< Inputs */
+  uint32_t N;                 /**< Neurons */
+  uint32_t Y;                 /**< Outputs */
+  uint32_t crc;               /**< CRC-32 of the section */
+  uint64_t offset;            /**< Start of the section in the file */
+  uint64_t size;              /**< Size of the section in bytes */
+} lstm_file_layer_t;
+
+/*
+* Training checkpoint, a network file followed by the state of the
+* trainer, see \ref lstm_trainer_store
+*
+* --- zeros up to the LSTM_FILE_ALIGNMENT boundary after the last section ---
+* lstm_file_train_t
+* For each layer (output layer first):
+*   Adam moments M and R, in the order of the weights in a section,
+*   if optimizer is OPTIMIZE_ADAM
+*   h and c carried between mini-batches, if stateful
+*
+* Readers of networks (\ref lstm_load) ignore the training state.
+*/
+#define LSTM_TRAIN_MAGIC                      "LSTMTRN1"
+#define LSTM_TRAIN_VERSION                    1
+
+typedef struct lstm_file_train_t {
+  char magic[8];              /**< LSTM_TRAIN_MAGIC, not terminated */
+  uint32_t version;           /**< LSTM_TRAIN_VERSION */
+  uint32_t optimizer;         /**< lstm_model_parameters_t.optimizer */
+  uint32_t stateful;          /**< lstm_model_parameters_t.stateful */
+  uint32_t i;                 /**< Position in the training data */
+  uint64_t n;                 /**< Steps taken */
+  uint64_t epoch;
+  uint64_t record_iteration;
+  uint64_t random_state;      /**< lstm_model_parameters_t.random_state */
+  double loss;
+  double record_keeper;
+  double learning_rate;       /**< Current, possibly decreased, learning rate */
+  double initial_learning_rate;
+  uint64_t size;              /**< Bytes of state after this header */
+  uint32_t crc;               /**< CRC-32 of this header, with this field set to 0, and the state */
+  uint32_t reserved;
+} lstm_file_train_t;
 
 typedef struct lstm_model_parameters_t {
   // For progress monitoring
@@ -79,6 +175,14 @@ typedef struct lstm_model_parameters_t {
   int decrease_lr;
   double learning_rate_decrease;
 
+  // Output sampling, see sampler.h
+  int sampler;
+  int top_k;
+  double top_p;
+  unsigned long seed;
+  // Weight initialization, seeded from seed on first use when zero
+  uint64_t random_state;
+
   // How many layers
   unsigned int layers;
   // How many neurons this layer has
@@ -98,6 +202,14 @@ typedef struct lstm_model_parameters_t {
   char *store_network_name_raw;
   char *store_network_name_json;
   char *store_char_indx_map_name;
+  char *store_training_name;         // Training checkpoint, see lstm_trainer_store, or NULL
+  char *resume_training_name;        // Checkpoint to continue training from, or NULL
+  int  store_network_json_format;   // LSTM_JSON_NUMBERS or LSTM_JSON_FLOAT32
+  unsigned int store_network_dtype;  // How the network file is stored, see lstm_store_as
+  int  verify_network;               // Check mapped network files of any size against their checksums, see lstm_load
+  int  profile;                      // Time the phases of training (PROFILE_TIME) and read counters (PROFILE_COUNTERS), see profile.h
+  unsigned int store_network_delta_every;  // Stores from one full base to the next, 0 always full, see checkpoint_init
+  int  store_network_delta_encoding; // LSTM_DELTA_XOR, LSTM_DELTA_Q16 or LSTM_DELTA_Q8
 
   // General parameters
   unsigned int mini_batch_size;
@@ -112,6 +224,7 @@ typedef struct lstm_model_t
   unsigned int N; /**< Number of neurons */
   unsigned int Y; /**< Number of output nodes */
   unsigned int S; /**< lstm_model_t.X + lstm_model_t.N */
+  fully_connected_forward_t forward_N; /**< Kernel for products with N columns, \see fully_connected_forward_select */
 
   // Parameters
   lstm_model_parameters_t * params;
@@ -127,6 +240,8 @@ typedef struct lstm_model_t
   double* bc;
   double* bo;
   double* by;
+  void *mapping;        /**< File section the weights above point into, NULL if they are allocated */
+  size_t mapping_size;  /**< Size of \ref lstm_model_t.mapping */
 
   // cache
   double* dldh;
@@ -181,6 +296,79 @@ typedef struct lstm_values_next_cache_t {
   double* dldY_pass;
 } lstm_values_next_cache_t;
 
+/** Inference state of a network, allocated once and reused for every step.
+*
+* Holds the double buffered caches of every layer, the one-hot input
+* vector and a sampler with its own random number generator, so stepping
+* and sampling do not touch the heap.
+*/
+typedef struct lstm_session_t {
+  lstm_model_t **model;          /**< The layers, model[0] is the output layer */
+  int layers;                    /**< Number of layers in \ref lstm_session_t.model */
+  unsigned long t;               /**< Steps taken, selects the cache to write to */
+  int last_input;                /**< Index set in \ref lstm_session_t.input, -1 if none */
+  double *input;                 /**< One-hot input, length X of the input layer */
+  sampler_t *sampler;            /**< Chooses the next feature, configured by the output layer parameters */
+  double *logits;                /**< Output layer values of the latest step (before softmax) */
+  lstm_values_cache_t ***caches; /**< caches[layer][2] */
+} lstm_session_t;
+
+/** Several independent sequences run through a network together.
+*
+* Row r of every matrix belongs to sequence r. In a step each gate
+* multiplies its weights [N x S] with the inputs of all rows [S x B]
+* at once, see \ref fully_connected_forward_batch.
+*/
+typedef struct lstm_batch_t {
+  lstm_model_t **model;          /**< The layers, model[0] is the output layer */
+  int layers;                    /**< Number of layers in \ref lstm_batch_t.model */
+  int capacity;                  /**< Maximum number of rows */
+  double **h;                    /**< h[layer], capacity x N */
+  double **c;                    /**< c[layer], capacity x N */
+  double **X;                    /**< X[layer], capacity x S, each row is [h_old, input] */
+  double **hf;                   /**< Gate scratch, capacity x N */
+  double **hi;                   /**< Gate scratch, capacity x N */
+  double **ho;                   /**< Gate scratch, capacity x N */
+  double **hc;                   /**< Gate scratch, capacity x N */
+  double **out;                  /**< out[layer], capacity x Y, out[0] holds the logits */
+} lstm_batch_t;
+
+/** Training state of a network, one \ref lstm_trainer_step per mini-batch.
+*
+* Holds everything that lives between the steps of a training run:
+* the caches of a mini-batch, the gradients, the optimizer moments and
+* the position in the training data.
+*/
+typedef struct lstm_trainer_t {
+  lstm_model_t **model;          /**< The layers, model[0] is the output layer */
+  unsigned int layers;           /**< Number of layers in \ref lstm_trainer_t.model */
+  lstm_model_parameters_t *params; /**< Training parameters, learning_rate is decreased here */
+  unsigned int training_points;  /**< Length of \ref lstm_trainer_t.X_train */
+  int *X_train;                  /**< Input observations */
+  int *Y_train;                  /**< Output observations */
+  unsigned int i;                /**< Position in the training data */
+  unsigned long n;               /**< Steps taken */
+  unsigned long epoch;           /**< Passes over the training data */
+  double loss;                   /**< Moving average of the loss, negative before the first step */
+  double record_keeper;          /**< Lowest \ref lstm_trainer_t.loss so far */
+  unsigned long record_iteration; /**< Step of \ref lstm_trainer_t.record_keeper */
+  double initial_learning_rate;
+  double *first_layer_input;
+  lstm_values_state_t **stateful_d_next;
+  lstm_values_cache_t ***cache_layers;
+  lstm_values_next_cache_t **d_next_layers;
+  lstm_model_t **gradient_layers;
+  lstm_model_t **gradient_layers_entry;
+  lstm_model_t **M_layers;
+  lstm_model_t **R_layers;
+  profile_t *profile;            /**< Time of the phases, NULL unless params->profile */
+} lstm_trainer_t;
+
+/**
+* Set parameters to the defaults of std_conf.h
+* @param params the parameters to be set
+*/
+void lstm_init_parameters(lstm_model_parameters_t *params);
 /**
 * Initialize a new model
 * @param X number of inputs
@@ -209,6 +397,16 @@ void lstm_cache_container_set_start(lstm_values_cache_t *cache, int neurons);
 * @param lstm model to be freed
 */ 
 void lstm_free_model(lstm_model_t *lstm);
+/** Number of weight arrays of a layer, see \ref lstm_weight_arrays */
+#define LSTM_WEIGHT_ARRAYS                    10
+/**
+* The weights of a layer, in the order of the network files:
+* Wy, Wi, Wc, Wo, Wf, by, bi, bc, bf, bo
+* @param model the layer
+* @param arrays set to the addresses of the LSTM_WEIGHT_ARRAYS weight pointers
+* @param counts set to the number of values in each array
+*/
+void lstm_weight_arrays(lstm_model_t *model, double ***arrays, size_t *counts);
 /**
 * Compute the output of a network
 * @param model model to be used, must been initialized with \ref lstm_init_model
@@ -229,25 +427,58 @@ void sum_gradients(lstm_model_t*, lstm_model_t*);
 
 /**
 * Load a previously stored network, generated with \ref lstm_store
+*
+* The weights of a version 2 file are mapped into memory (copy on write,
+* shared between processes until written), except on Windows where they
+* are read. Read weights are checked against the checksums of the file.
+* Mapped weights are checked as well if the file is at most
+* LSTM_FILE_VERIFY_SIZE bytes or params->verify_network is set (-verify),
+* otherwise they are not read at load and corruption in them goes
+* undetected.
 * \see lstm_store
 * @param path path to the model that is to be loaded
 * @param set feature set, will be read from network
 * @param params parameters, some will be read from loaded
 * @param model model reference to be set
+* @return 0 on success, negative values on errors
 */ 
-void lstm_load(const char *path, set_t *set, 
+int lstm_load(const char *path, set_t *set, 
   lstm_model_parameters_t *params, lstm_model_t ***model);
 /**
 * Store a network, can be read again with \ref lstm_load
+*
+* The file is written next to \p path and then renamed to it, so a
+* network that was loaded from \p path and is still mapped is not affected.
 * \see lstm_load
 * @param path path to the model that is to be store
 * @param set feature set, will be stored to the file
 * @param model model reference to be stored
 * @param layers number of layers in the model.\
 \p model is an array, layers is used as a length. 
+* @return 0 on success, negative values on errors
 */ 
-void lstm_store(const char *path, set_t *set,
+int lstm_store(const char *path, set_t *set,
   lstm_model_t **model, unsigned int layers);
+/**
+* Store a network with smaller weights, for distribution. It is read
+* with \ref lstm_load as any network, the weights are turned back into
+* doubles, but it is not mapped.
+*
+* LSTM_DTYPE_HALF and LSTM_DTYPE_BFLOAT16 store 16 bits per weight,
+* LSTM_DTYPE_INT8 8 bits with a scale per weight array (the largest
+* weight / 127). LSTM_DTYPE_ENTROPY added to any of them entropy codes
+* the file as well.
+* \see lstm_store
+* @param path path to the model that is to be store
+* @param set feature set, will be stored to the file
+* @param model model reference to be stored
+* @param layers number of layers in the model
+* @param dtype LSTM_DTYPE_DOUBLE, LSTM_DTYPE_HALF, LSTM_DTYPE_BFLOAT16 or \
+LSTM_DTYPE_INT8, possibly | LSTM_DTYPE_ENTROPY
+* @return 0 on success, negative values on errors
+*/
+int lstm_store_as(const char *path, set_t *set,
+  lstm_model_t **model, unsigned int layers, unsigned int dtype);
 int lstm_reinit_model(
   lstm_model_t** model, unsigned int layers,
   unsigned int previousNbrFeatures, unsigned int newNbrFeatures);
@@ -262,9 +493,12 @@ mapping in the JSON file.
 * @param set feature-to-index set, will be stored to the file
 * @param layers the number of layers this model consists of. \
 \p model is an array, layers is used as a length. 
+* @param format LSTM_JSON_NUMBERS, weights as arrays of numbers, or \
+LSTM_JSON_FLOAT32, weights as {"shape": [R, C], "float32": "<base64>"} \
+which is about a fifth of the size.
 */ 
 void lstm_store_net_layers_as_json(lstm_model_t** model, const char * filename, 
-  const char *set_name, set_t *set, unsigned int layers);
+  const char *set_name, set_t *set, unsigned int layers, int format);
 void lstm_store_progress(const char*, unsigned int, double);
 
 /**
@@ -289,6 +523,66 @@ void lstm_train(lstm_model_t** model, lstm_model_parameters_t*params,
   set_t* set, unsigned int training_points, int *X, int *Y, unsigned int layers,
   double *loss);
 /**
+* Allocate the training state of a network. Nothing is printed or stored
+* while stepping, \ref lstm_train does that around \ref lstm_trainer_step.
+* @param model the network that is trained
+* @param params training parameters
+* @param training_points length of \p X and \p Y
+* @param X input observations
+* @param Y output observations
+* @param layers number of layers in \p model
+* @return the trainer, free it with \ref lstm_trainer_free
+*/
+lstm_trainer_t* lstm_trainer_init(lstm_model_t **model, lstm_model_parameters_t *params,
+  unsigned int training_points, int *X, int *Y, unsigned int layers);
+/**
+* Train on the next mini-batch: forward, backward and one optimizer update.
+* @param trainer the trainer
+* @return the moving average of the loss
+*/
+double lstm_trainer_step(lstm_trainer_t *trainer);
+/** Free a trainer allocated with \ref lstm_trainer_init, the network is kept */
+void lstm_trainer_free(lstm_trainer_t *trainer);
+/**
+* Benchmark training: measure the peak of the machine, see \ref roofline_peak,
+* run \p steps steps with every kernel timed and \p steps more only counted,
+* and print the GFLOP/s, GB/s and share of the roofline of every kernel
+* and of the steps. The network is trained by the steps.
+* @param model the network
+* @param params training parameters
+* @param training_points length of \p X and \p Y
+* @param X input observations
+* @param Y output observations
+* @param layers number of layers in \p model
+* @param steps training steps of each pass
+*/
+void lstm_benchmark(lstm_model_t **model, lstm_model_parameters_t *params,
+  unsigned int training_points, int *X, int *Y, unsigned int layers,
+  unsigned long steps);
+/**
+* Store a training checkpoint: the network, as \ref lstm_store does,
+* followed by everything needed to continue training exactly where
+* it is: Adam moments, step and epoch counters, position in the
+* training data, the (decreased) learning rate, the carried states
+* and the random number generator.
+* @param trainer the trainer
+* @param set The feature-to-index mapping.
+* @param path file to write, replaced through a temporary file
+* @return 0 on success, -1 on errors
+*/
+int lstm_trainer_store(lstm_trainer_t *trainer, set_t *set, const char *path);
+/**
+* Continue training from a checkpoint stored with \ref lstm_trainer_store.
+* The network must have been read from the same file (\ref lstm_load),
+* and the trainer created on it with the same training data.
+* The learning rate of the checkpoint replaces the one in the parameters.
+* @param trainer trainer just created with \ref lstm_trainer_init
+* @param path the checkpoint
+* @return 0 on success, -1 if the file has no training state or it does \
+not fit the trainer
+*/
+int lstm_trainer_resume(lstm_trainer_t *trainer, const char *path);
+/**
 * If you are training on textual data, this function can be used 
 * to sample and output from the network directly to stdout. 
 * \see lstm_init_model
@@ -333,6 +627,238 @@ initialzed with \ref lstm_init_model.
 void lstm_output_string_layers_to_file(FILE * fp,lstm_model_t ** model_layers, 
   set_t* set, int first, int samples_to_display, int layers);
 
+/**
+* Allocate a sampler configured by the parameters of a network
+* (sampler, top_k, top_p, seed and softmax_temp).
+* @param output_layer the output layer of the network, model_layers[0]
+* @return the sampler, free it with \ref sampler_free
+*/
+sampler_t* lstm_sampler_init(lstm_model_t *output_layer);
+/**
+* Allocate a session for running a network one step at a time.
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @return the session, free it with \ref lstm_session_free
+*/
+lstm_session_t* lstm_session_init(lstm_model_t **model_layers, int layers);
+/**
+* Free a session allocated with \ref lstm_session_init
+* @param session session to be freed
+*/
+void lstm_session_free(lstm_session_t *session);
+/**
+* Set the state of all layers to zero, as in a fresh session
+* @param session session to be reset
+*/
+void lstm_session_reset(lstm_session_t *session);
+/**
+* Feed one input through all layers.
+* @param session the session, its state is advanced one step
+* @param index feature index of the input, negative values gives an all zero input
+* @return the output layer values (logits, softmax not applied), \
+valid until the next step
+*/
+double* lstm_session_step(lstm_session_t *session, int index);
+/**
+* Sample a feature from the output of the latest step.
+* @param session the session
+* @param set The feature-to-index mapping.
+* @return the sampled feature value (not the index)
+*/
+int lstm_session_sample(lstm_session_t *session, set_t *set);
+/**
+* Sample output from a session, feeding each sample back as the next input.
+* @param session the session
+* @param set The feature-to-index mapping.
+* @param first index of the first input
+* @param samples_to_display How many observations to write
+* @param writer output destination
+*/
+void lstm_session_output_string(lstm_session_t *session, set_t *set,
+  int first, int samples_to_display, writer_t *writer);
+/**
+* Feed a seed string through the session and then sample output from it.
+* @param session the session
+* @param set The feature-to-index mapping.
+* @param input_string seed string, echoed to \p writer
+* @param out_length How many characters to sample after the seed
+* @param writer output destination
+*/
+void lstm_session_output_from_string(lstm_session_t *session, set_t *set,
+  const char *input_string, int out_length, writer_t *writer);
+
+/**
+* Called by \ref lstm_session_stream for every sampled character.
+* @param c the character
+* @param prob its probability under the network, at temperature 1
+* @param elapsed seconds since the stream started
+* @param data passed through from \ref lstm_session_stream
+* @return 0 to continue, anything else stops the stream
+*/
+typedef int (*lstm_stream_callback_t)(int c, double prob, double elapsed, void *data);
+/**
+* Feed a prompt through the session, nothing is sampled.
+* Characters missing from \p set are fed as an all zero input.
+* @param session the session
+* @param set The feature-to-index mapping.
+* @param prompt the prompt
+* @return number of characters fed
+*/
+int lstm_session_prime(lstm_session_t *session, set_t *set, const char *prompt);
+/**
+* Sample characters one at a time, handing each to \p callback as soon
+* as it is chosen. The first one is sampled from the output of the last
+* step, so it costs no step after \ref lstm_session_prime. Every handed
+* out character is fed back, the session can be continued afterwards.
+* @param session the session, primed
+* @param set The feature-to-index mapping.
+* @param length maximum number of characters
+* @param callback called for every character, may stop the stream
+* @param data passed to \p callback
+* @return number of characters handed to \p callback
+*/
+int lstm_session_stream(lstm_session_t *session, set_t *set, int length,
+  lstm_stream_callback_t callback, void *data);
+
+/**
+* Number of doubles needed to hold the state of a network, as used by \
+\ref lstm_session_get_state and \ref lstm_batch_get_state.
+* The state is h and c of every layer followed by the output logits.
+* @param model_layers the network
+* @param layers how many layers this network has
+*/
+size_t lstm_state_size(lstm_model_t **model_layers, int layers);
+/**
+* Snapshots of a session, see \ref lstm_session_snapshot.
+* A snapshot starts with a header: SNAPSHOT_MAGIC, the version and the
+* type of the values as 16 bit integers, then the number of layers, the
+* number of outputs and the neurons of every layer (output layer first)
+* as 32 bit integers. Then follow h and c of every layer and the output
+* logits. Everything is in the byte order of the machine.
+*/
+#define SNAPSHOT_MAGIC          "LSTS"
+#define SNAPSHOT_VERSION        1
+#define SNAPSHOT_DOUBLE         0   /**< Values stored as 64 bit doubles */
+#define SNAPSHOT_HALF           1   /**< Values stored as 16 bit halfs, \see float_to_half */
+
+/**
+* Size in bytes of a snapshot of \p session
+* @param session the session
+* @param type \ref SNAPSHOT_DOUBLE or \ref SNAPSHOT_HALF
+*/
+size_t lstm_session_snapshot_size(lstm_session_t *session, int type);
+/**
+* Write the state of a session to memory, so that it can be
+* continued later with \ref lstm_session_restore.
+* @param session the session
+* @param type \ref SNAPSHOT_DOUBLE or \ref SNAPSHOT_HALF
+* @param buffer the snapshot is written here
+* @param size size of \p buffer
+* @return bytes written, 0 if \p buffer is too small
+*/
+size_t lstm_session_snapshot(lstm_session_t *session, int type,
+  void *buffer, size_t size);
+/**
+* Set the state of a session from a snapshot
+* @param session the session, its network must have the layer sizes of the snapshot
+* @param buffer the snapshot
+* @param size size of \p buffer
+* @return 0 on success, negative values on errors
+*/
+int lstm_session_restore(lstm_session_t *session, const void *buffer, size_t size);
+/**
+* Store a snapshot of a session in a file
+* \see lstm_session_snapshot
+* @return 0 on success, negative values on errors
+*/
+int lstm_session_snapshot_store(lstm_session_t *session, int type, const char *path);
+/**
+* Set the state of a session from a snapshot stored in a file
+* \see lstm_session_restore
+* @return 0 on success, negative values on errors
+*/
+int lstm_session_snapshot_load(lstm_session_t *session, const char *path);
+/**
+* Copy the current state of a session to \p state
+* \see lstm_state_size
+*/
+void lstm_session_get_state(lstm_session_t *session, double *state);
+/**
+* Continue a session from a state, previously copied with \
+\ref lstm_session_get_state or \ref lstm_batch_get_state
+*/
+void lstm_session_set_state(lstm_session_t *session, const double *state);
+
+/**
+* Allocate state for running up to \p capacity sequences together.
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @param capacity maximum number of rows
+* @return the batch, free it with \ref lstm_batch_free
+*/
+lstm_batch_t* lstm_batch_init(lstm_model_t **model_layers, int layers, int capacity);
+/**
+* Free a batch allocated with \ref lstm_batch_init
+*/
+void lstm_batch_free(lstm_batch_t *batch);
+/**
+* Feed one input per row through all layers.
+* @param batch the batch, rows [0, rows) are advanced one step
+* @param indices feature index of the input for each row, negative \
+values gives an all zero input
+* @param rows number of rows to step, at most the capacity
+* @return the logits, rows x Y of the output layer, valid until the next step
+*/
+double* lstm_batch_step(lstm_batch_t *batch, const int *indices, int rows);
+/** Set the state of a row to zero */
+void lstm_batch_reset_row(lstm_batch_t *batch, int row);
+/** Copy the state of row \p src to row \p dst */
+void lstm_batch_copy_row(lstm_batch_t *batch, int dst, int src);
+/**
+* Copy the state of a row to \p state
+* \see lstm_state_size
+*/
+void lstm_batch_get_state(lstm_batch_t *batch, int row, double *state);
+/**
+* Set the state of a row from \p state
+* \see lstm_state_size
+*/
+void lstm_batch_set_state(lstm_batch_t *batch, int row, const double *state);
+/**
+* Feed a sequence of inputs, starting from the state in row 0.
+*
+* The network is run one layer at a time. The input side of every gate
+* is computed for all positions together, then the recurrence runs over
+* the positions. Row j ends up holding the state after position j.
+* @param batch the batch, capacity must be at least \p count
+* @param indices feature index of the input at each position
+* @param count number of positions
+* @return the logits, count x Y of the output layer, valid until the next step
+*/
+double* lstm_batch_sequence(lstm_batch_t *batch, const int *indices, int count);
+/**
+* Sample several continuations of one seed.
+*
+* The seed is fed once, then its state is copied to one row per sample
+* and all samples are advanced together with \ref lstm_batch_step.
+* Output is flushed after every step, so every sample is streamed as it
+* is sampled: to a writer of its own, or as tagged lines to one writer.
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @param set The feature-to-index mapping.
+* @param seed input seed, echoed to every sample, may be empty
+* @param samples number of continuations
+* @param out_length How many characters to sample after the seed
+* @param writers one output destination per sample, \p samples of them, \
+or NULL to write to \p tagged
+* @param tagged used when \p writers is NULL: a line per sample and step, \
+the sample, a tab and the characters, with \\, newline, carriage return \
+and tab written as \\\\, \\n, \\r and \\t
+*/
+void lstm_batch_output_samples(lstm_model_t **model_layers, int layers,
+  set_t *set, const char *seed, int samples, int out_length, writer_t *writers,
+  writer_t *tagged);
+
 void lstm_read_net_layers(lstm_model_t** model, FILE *fp, unsigned int layers);
 void lstm_store_net_layers(lstm_model_t** model, FILE *fp, unsigned int layers);
 #endif
@@ -13,20 +13,50 @@
 #include "set.h"
 #include "layers.h"
 #include "utilities.h"
+#include "server.h"
+#include "beam_search.h"
+#include "speculative.h"
+#include "score.h"
+#include "export.h"
+#include "prefix_cache.h"
+#include "delta.h"
+#include "trace.h"
 
 #include "std_conf.h"
 
-#define ITERATIONS  100000000
-#define NO_EPOCHS   0 
 
 lstm_model_t *model = NULL, *layer1 = NULL, *layer2 = NULL;
 lstm_model_t **model_layers;
 lstm_model_parameters_t params;
 set_t set;
 
+lstm_model_t **draft_layers;
+lstm_model_parameters_t draft_params;
+set_t draft_set;
+
 static int write_output_directly_bytes = 0;
 static char *read_network = NULL;
 static char *seed = NULL;
+static char *serve_address = NULL;
+static int serve_batch = SERVE_MAX_BATCH;
+static int prefix_cache_mb = PREFIX_CACHE_MB;
+static int beam_width = 0;
+static double beam_length_penalty = BEAM_LENGTH_PENALTY;
+static int beam_stop = -1;
+static char *draft_network = NULL;
+static int draft_proposal = SPECULATIVE_PROPOSAL;
+static int samples = 0;
+static char *samples_out = NULL;
+static char *score_file = NULL;
+static char *score_out = NULL;
+static int threads = 0;
+static char *score_lines = NULL;
+static int score_lines_policy = SCORE_STATE_RESET;
+static int score_lines_rows = SCORE_LINES_ROWS;
+static char *export_c = NULL;
+static char *reconstruct = NULL;
+static char *pack = NULL;
+static unsigned long bench = 0;
 static int store_after_training = 0;
 static char save_model_folder_raw[256];
 static char save_model_folder_json[256];
@@ -35,9 +65,10 @@ void store_the_net_layers(int signo)
 {
   if ( SIGINT == signo ) {
     if ( model_layers != NULL ) {
-      lstm_store(params.store_network_name_raw, &set,
-      model_layers, params.layers);
-      lstm_store_net_layers_as_json(model_layers, params.store_network_name_json, JSON_KEY_NAME_SET, &set, params.layers);
+      lstm_store_as(params.store_network_name_raw, &set,
+      model_layers, params.layers, params.store_network_dtype);
+      lstm_store_net_layers_as_json(model_layers, params.store_network_name_json, JSON_KEY_NAME_SET, &set, params.layers,
+        params.store_network_json_format);
       printf("\nStored the net as: '%s'\nYou can use that file in the .html interface.\n", 
       params.store_network_name_json );
       printf("The net in its raw format is stored as: '%s'.\nYou can use that with the -r flag \
@@ -68,12 +99,48 @@ void usage(char *argv[]) {
   printf("    -mb : mini batch size.\r\n");
   printf("    -dl : decrease the learning rate over time, according to lr(n+1) <- lr(n) / (1 + n/value).\r\n");
   printf("    -st : number of iterations between how the network is stored during training. If 0 only stored once after training.\r\n");
-  printf("    -out: number of characters to output directly, note: a network and a datafile must be provided.\r\n");
+  printf("    -ckpt: Training checkpoint, stored with the network and after training. Holds the optimizer state, counters and position in the data.\r\n");
+  printf("    -resume: Continue training exactly where a training checkpoint (-ckpt) left off. The network is read from it, as with -r.\r\n");
+  printf("    -delta: Keep every stored network (-st) as <name>.<iteration>, in full every value stores and as a .delta against that in between.\r\n");
+  printf("    -delta_type: xor (default, exact), q16 or q8, how deltas are written. q16 and q8 round the changes, and are 4 and 8 times smaller.\r\n");
+  printf("    -reconstruct: Don't train, rebuild the network of the .delta given by the value from its base (-r), stored without the .delta suffix.\r\n");
+  printf("    -out: number of characters to output directly, note: a network must be provided (-r), datafile is not considered.\r\n");
   printf("    -L  : Number of layers, may not exceed %d\r\n", LSTM_MAX_LAYERS);
   printf("    -N  : Number of neurons in every layer\r\n");
   printf("    -vr : Verbosity level. Set to zero and only the loss function after and not during training will be printed.\n");
   printf("    -c  : Don't train, only generate output. Seed given by the value. If -r is used, datafile is not considered.\r\n");
   printf("    -s  : Save folder, where models are stored (binary and JSON).\r\n");
+  printf("    -json: numbers (default) or float32, how weights are written to the JSON file. float32 is base64, about 3.5 times smaller.\r\n");
+  printf("    -prof: 1 to time the phases of training, printed with the progress and after training, 2 to read hardware counters as well (Linux). Default 0.\r\n");
+  printf("    -bench: Don't train, run the value training steps and report the GFLOP/s, GB/s and share of the machine's peak of every kernel.\r\n");
+  printf("    -trace: Record a timeline of training or generation to the file given by the value, as Chrome trace JSON. Written at exit and on SIGUSR1.\r\n");
+  printf("    -dtype: double (default), fp16, bf16 or int8, how weights are stored in the network file. 4 or 8 times smaller, for distribution.\r\n");
+  printf("    -compress: 1 to entropy code the network file as well, 0 (default) not to. Such files are read, not mapped.\r\n");
+  printf("    -verify: 1 to check a network read with -r against its checksums also when it is mapped and larger than %d MB. Default 0.\r\n",
+    LSTM_FILE_VERIFY_SIZE >> 20);
+  printf("    -pack: Don't train, store the network (-r) as the file given by the value, with -dtype and -compress.\r\n");
+  printf("    --serve: Don't train, serve the network read with -r. Value is a TCP port on localhost or unix:<path>.\r\n");
+  printf("    -batch: Maximum number of requests run through the network together when serving, default %d.\r\n", SERVE_MAX_BATCH);
+  printf("    -pcache: Memory budget in MB for cached seed prefix states when serving, default %d. 0 disables it.\r\n", PREFIX_CACHE_MB);
+  printf("    -beam: Generate with beam search instead of sampling, value is the number of beams. Used with -c or -out.\r\n");
+  printf("    -lp : Length penalty of beam search, hypotheses are ranked by log probability / ((5 + length) / 6)^value, default %.1f.\r\n", BEAM_LENGTH_PENALTY);
+  printf("    -stop: Character that ends a beam search hypothesis, e.g. '.'. By default hypotheses end after -out (or 256) characters.\r\n");
+  printf("    -draft: A smaller network trained on the same features, proposes characters that the network read with -r checks. Used with -c or -out.\r\n");
+  printf("    -k  : Number of characters the draft network proposes at a time, default %d.\r\n", SPECULATIVE_PROPOSAL);
+  printf("    -samples: Number of continuations of the seed to sample together. Used with -c or -out.\r\n");
+  printf("    -samples_out: Write sample i to <value>i.txt as it is generated, instead of to stdout as lines <sample><tab><characters>.\r\n");
+  printf("    -sample: How output characters are chosen: multinomial (default), greedy, topk or topp.\r\n");
+  printf("    -topk: Sample among the value most probable characters, default %d.\r\n", STD_TOP_K);
+  printf("    -topp: Sample among the most probable characters that together have this probability, default %.1f.\r\n", STD_TOP_P);
+  printf("    -temp: Softmax temperature when sampling, the lower the more conservative, default %.1f.\r\n", SOFTMAX_TEMP);
+  printf("    -seed: Seed of the sampling random number generator, for reproducible output.\r\n");
+  printf("    -score: Don't train, report the cross-entropy, bits per character and perplexity of the network (-r) on the file given by the value.\r\n");
+  printf("    -score_out: Write the log probability of every scored character to this file, as 32 bit floats.\r\n");
+  printf("    -threads: Number of threads used when scoring, default is the number of cores.\r\n");
+  printf("    -score_lines: Don't train, write the mean negative log-likelihood of every line read from the file given by the value (- for stdin).\r\n");
+  printf("    -state: reset (default) or carry, whether every line starts from a zero state or continues from the previous line.\r\n");
+  printf("    -rows: Number of lines each thread runs through the network together, default %d.\r\n", SCORE_LINES_ROWS);
+  printf("    -export_c: Don't train, write the network (-r) as a standalone C file given by the value.\r\n");
   printf("\r\n");
   printf("Check std_conf.h to see what default values are used, these are set during compilation.\r\n");
   printf("\r\n");
@@ -92,6 +159,11 @@ void parse_input_args(int argc, char** argv)
 
     if ( !strcmp(argv[a], "-r") ) {
       read_network = argv[a + 1];
+    } else if ( !strcmp(argv[a], "-ckpt") ) {
+      params.store_training_name = argv[a + 1];
+    } else if ( !strcmp(argv[a], "-resume") ) {
+      read_network = argv[a + 1];
+      params.resume_training_name = argv[a + 1];
     } else if ( !strcmp(argv[a], "-lr") ) {
       params.learning_rate = atof(argv[a + 1]);
       if ( params.learning_rate == 0.0 ) {
@@ -131,6 +203,14 @@ void parse_input_args(int argc, char** argv)
 
       params.store_network_name_raw = save_model_folder_raw;
       params.store_network_name_json = save_model_folder_json;
+    } else if ( !strcmp(argv[a], "-json") ) {
+      if ( !strcmp(argv[a+1], "numbers") ) {
+        params.store_network_json_format = LSTM_JSON_NUMBERS;
+      } else if ( !strcmp(argv[a+1], "float32") ) {
+        params.store_network_json_format = LSTM_JSON_FLOAT32;
+      } else {
+        usage(argv);
+      }
     } else if ( !strcmp(argv[a], "-out") ) {
       write_output_directly_bytes = atoi(argv[a+1]);
       if ( write_output_directly_bytes <= 0 ) {
@@ -150,12 +230,194 @@ void parse_input_args(int argc, char** argv)
       params.print_progress = !!atoi(argv[a+1]);
     } else if ( !strcmp(argv[a], "-c") ) {
       seed = argv[a+1];
+    } else if ( !strcmp(argv[a], "--serve") ) {
+      serve_address = argv[a+1];
+    } else if ( !strcmp(argv[a], "-batch") ) {
+      serve_batch = atoi(argv[a+1]);
+      if ( serve_batch <= 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-pcache") ) {
+      prefix_cache_mb = atoi(argv[a+1]);
+      if ( prefix_cache_mb < 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-beam") ) {
+      beam_width = atoi(argv[a+1]);
+      if ( beam_width <= 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-lp") ) {
+      beam_length_penalty = atof(argv[a+1]);
+    } else if ( !strcmp(argv[a], "-stop") ) {
+      beam_stop = (unsigned char) argv[a+1][0];
+    } else if ( !strcmp(argv[a], "-draft") ) {
+      draft_network = argv[a+1];
+    } else if ( !strcmp(argv[a], "-k") ) {
+      draft_proposal = atoi(argv[a+1]);
+      if ( draft_proposal <= 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-samples") ) {
+      samples = atoi(argv[a+1]);
+      if ( samples <= 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-samples_out") ) {
+      samples_out = argv[a+1];
+    } else if ( !strcmp(argv[a], "-sample") ) {
+      params.sampler = sampler_mode_from_name(argv[a+1]);
+      if ( params.sampler < 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-topk") ) {
+      params.sampler = SAMPLER_TOP_K;
+      params.top_k = atoi(argv[a+1]);
+      if ( params.top_k <= 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-topp") ) {
+      params.sampler = SAMPLER_TOP_P;
+      params.top_p = atof(argv[a+1]);
+      if ( params.top_p <= 0.0 || params.top_p > 1.0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-temp") ) {
+      params.softmax_temp = atof(argv[a+1]);
+      if ( params.softmax_temp <= 0.0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-seed") ) {
+      params.seed = strtoul(argv[a+1], NULL, 10);
+    } else if ( !strcmp(argv[a], "-score") ) {
+      score_file = argv[a+1];
+    } else if ( !strcmp(argv[a], "-score_out") ) {
+      score_out = argv[a+1];
+    } else if ( !strcmp(argv[a], "-threads") ) {
+      threads = atoi(argv[a+1]);
+      if ( threads <= 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-score_lines") ) {
+      score_lines = argv[a+1];
+    } else if ( !strcmp(argv[a], "-state") ) {
+      if ( !strcmp(argv[a+1], "reset") ) {
+        score_lines_policy = SCORE_STATE_RESET;
+      } else if ( !strcmp(argv[a+1], "carry") ) {
+        score_lines_policy = SCORE_STATE_CARRY;
+      } else {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-rows") ) {
+      score_lines_rows = atoi(argv[a+1]);
+      if ( score_lines_rows <= 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-export_c") ) {
+      export_c = argv[a+1];
+    } else if ( !strcmp(argv[a], "-delta") ) {
+      params.store_network_delta_every = (unsigned int) atoi(argv[a+1]);
+    } else if ( !strcmp(argv[a], "-delta_type") ) {
+      if ( !strcmp(argv[a+1], "xor") ) {
+        params.store_network_delta_encoding = LSTM_DELTA_XOR;
+      } else if ( !strcmp(argv[a+1], "q16") ) {
+        params.store_network_delta_encoding = LSTM_DELTA_Q16;
+      } else if ( !strcmp(argv[a+1], "q8") ) {
+        params.store_network_delta_encoding = LSTM_DELTA_Q8;
+      } else {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-reconstruct") ) {
+      reconstruct = argv[a+1];
+    } else if ( !strcmp(argv[a], "-dtype") ) {
+      unsigned int entropy = params.store_network_dtype & LSTM_DTYPE_ENTROPY;
+      if ( !strcmp(argv[a+1], "double") ) {
+        params.store_network_dtype = LSTM_DTYPE_DOUBLE | entropy;
+      } else if ( !strcmp(argv[a+1], "fp16") ) {
+        params.store_network_dtype = LSTM_DTYPE_HALF | entropy;
+      } else if ( !strcmp(argv[a+1], "bf16") ) {
+        params.store_network_dtype = LSTM_DTYPE_BFLOAT16 | entropy;
+      } else if ( !strcmp(argv[a+1], "int8") ) {
+        params.store_network_dtype = LSTM_DTYPE_INT8 | entropy;
+      } else {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-compress") ) {
+      if ( atoi(argv[a+1]) )
+        params.store_network_dtype |= LSTM_DTYPE_ENTROPY;
+      else
+        params.store_network_dtype &= ~LSTM_DTYPE_ENTROPY;
+    } else if ( !strcmp(argv[a], "-pack") ) {
+      pack = argv[a+1];
+    } else if ( !strcmp(argv[a], "-prof") ) {
+      params.profile = atoi(argv[a+1]);
+    } else if ( !strcmp(argv[a], "-verify") ) {
+      params.verify_network = atoi(argv[a + 1]);
+    } else if ( !strcmp(argv[a], "-bench") ) {
+      bench = (unsigned long) atol(argv[a + 1]);
+      if ( bench == 0 ) {
+        usage(argv);
+      }
+    } else if ( !strcmp(argv[a], "-trace") ) {
+      trace_init(argv[a+1]);
     }
 
     a += 2;
   }
 }
 
+/*
+* Sample several continuations of the seed together. Each sample is
+* streamed to a file of its own, or to stdout as tagged lines, see
+* lstm_batch_output_samples.
+*/
+static int output_samples(const char *seed_string, int out_length)
+{
+  writer_t *writers = NULL, tagged;
+  char filename[256];
+  int i = 0;
+
+  if ( samples_out == NULL ) {
+    writer_init(&tagged, stdout);
+    lstm_batch_output_samples(model_layers, params.layers, &set, seed_string,
+      samples, out_length, NULL, &tagged);
+    return 0;
+  }
+
+  writers = e_calloc(samples, sizeof(writer_t));
+  while ( i < samples ) {
+    FILE *fp;
+
+    snprintf(filename, sizeof(filename), "%s%d.txt", samples_out, i);
+    fp = fopen(filename, "w");
+    if ( fp == NULL ) {
+      fprintf(stderr, "%s error: could not open '%s' for sample %d\n",
+        __func__, filename, i);
+      while ( i > 0 ) {
+        --i;
+        fclose(writers[i].fp);
+      }
+      free(writers);
+      return -1;
+    }
+
+    writer_init(&writers[i], fp);
+    ++i;
+  }
+
+  lstm_batch_output_samples(model_layers, params.layers, &set, seed_string,
+    samples, out_length, writers, NULL);
+
+  i = 0;
+  while ( i < samples ) {
+    fclose(writers[i].fp);
+    ++i;
+  }
+
+  free(writers);
+  return 0;
+}
+
 static char * prettyPrintBytes(size_t bytes)
 {
   static char buffer[128];
@@ -177,49 +439,97 @@ static char * prettyPrintBytes(size_t bytes)
   return buffer;
 }
 
+/*
+* Reads the whole datafile into memory in one go.
+* Returns NULL if the file could not be read.
+*/
+static char * read_datafile(const char *path, unsigned int *size)
+{
+  FILE *fp;
+  long len;
+  char *data;
+
+  fp = fopen(path, "r");
+  if ( fp == NULL )
+    return NULL;
+
+  if ( fseek(fp, 0, SEEK_END) != 0 || ( len = ftell(fp) ) < 0 ) {
+    fclose(fp);
+    return NULL;
+  }
+  rewind(fp);
+
+  data = malloc(len + 1);
+  if ( data == NULL ) {
+    fclose(fp);
+    return NULL;
+  }
+
+  // In text mode fewer bytes than len may be read (CRLF translation)
+  *size = (unsigned int) fread(data, 1, len, fp);
+  data[*size] = '\0';
+
+  fclose(fp);
+  return data;
+}
+
+/*
+* Score a text file with the network, optionally writing the
+* log probability of every character to score_out.
+*/
+static int score_text_file(const char *path)
+{
+  lstm_score_result_t result;
+  unsigned int length = 0;
+  char *text = read_datafile(path, &length);
+  float *log_probs = NULL;
+  double bpc;
+
+  if ( text == NULL ) {
+    printf("Could not open file: %s\n", path);
+    return -1;
+  }
+
+  if ( score_out != NULL && length > 1 )
+    log_probs = e_calloc(length - 1, sizeof(float));
+
+  lstm_score(model_layers, params.layers, &set, text, length,
+    threads > 0 ? threads : cpu_count(), SCORE_WARMUP, log_probs, &result);
+
+  if ( result.count == 0 ) {
+    printf("Nothing to score in %s\n", path);
+  } else {
+    bpc = result.nll / result.count / log(2.0);
+    printf("Scored %lu characters of %s\n", result.count, path);
+    printf("Cross-entropy: %lf nats (%lf per character)\n",
+      result.nll, result.nll / result.count);
+    printf("Bits per character: %lf\n", bpc);
+    printf("Perplexity: %lf\n", exp(result.nll / result.count));
+  }
+
+  if ( log_probs != NULL ) {
+    FILE *fp = fopen(score_out, "wb");
+    if ( fp == NULL ) {
+      printf("Could not open file: %s\n", score_out);
+      return -1;
+    }
+    fwrite(log_probs, sizeof(float), length - 1, fp);
+    fclose(fp);
+    free(log_probs);
+  }
+
+  free(text);
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
-  int c;
   unsigned int p = 0;
   unsigned int file_size = 0, sz = 0;
   int *X_train, *Y_train;
-  FILE * fp;
-
-  memset(&params, 0, sizeof(params));
-
-  params.iterations = ITERATIONS;
-  params.epochs = NO_EPOCHS;
-  params.loss_moving_avg = LOSS_MOVING_AVG;
-  params.learning_rate = STD_LEARNING_RATE;
-  params.momentum = STD_MOMENTUM;
-  params.lambda = STD_LAMBDA;
-  params.softmax_temp = SOFTMAX_TEMP;
-  params.mini_batch_size = MINI_BATCH_SIZE;
-  params.gradient_clip_limit = GRADIENT_CLIP_LIMIT;
-  params.learning_rate_decrease = STD_LEARNING_RATE_DECREASE;
-  params.stateful = STATEFUL;
-  params.beta1 = 0.9;
-  params.beta2 = 0.999;
-  params.gradient_fit = GRADIENTS_FIT;
-  params.gradient_clip = GRADIENTS_CLIP;
-  params.decrease_lr = DECREASE_LR;
-  params.model_regularize = MODEL_REGULARIZE;
-  params.layers = LAYERS;
-  params.neurons = NEURONS;
-  params.optimizer = OPTIMIZE_ADAM;
-  // Interaction configuration with the training of the network
-  params.print_progress = PRINT_PROGRESS;
-  params.print_progress_iterations = PRINT_EVERY_X_ITERATIONS;
-  params.print_progress_sample_output = PRINT_SAMPLE_OUTPUT;
-  params.print_progress_to_file = PRINT_SAMPLE_OUTPUT_TO_FILE;
-  params.print_progress_number_of_chars = NUMBER_OF_CHARS_TO_DISPLAY_DURING_TRAINING;
-  params.print_sample_output_to_file_arg = PRINT_SAMPLE_OUTPUT_TO_FILE_ARG;
-  params.print_sample_output_to_file_name = PRINT_SAMPLE_OUTPUT_TO_FILE_NAME;
-  params.store_progress_every_x_iterations = STORE_PROGRESS_EVERY_X_ITERATIONS;
-  params.store_progress_file_name = PROGRESS_FILE_NAME;
-  params.store_network_name_raw = STD_LOADABLE_NET_NAME;
-  params.store_network_name_json = STD_JSON_NET_NAME;
-  params.store_char_indx_map_name = JSON_KEY_NAME_SET;
+  char *data;
+
+  lstm_init_parameters(&params);
 
   srand( time ( NULL ) );
 
@@ -230,84 +540,209 @@ int main(int argc, char *argv[])
 
   parse_input_args(argc, argv);
 
+  if ( ( write_output_directly_bytes || serve_address != NULL || score_file != NULL ||
+    score_lines != NULL || export_c != NULL || reconstruct != NULL || pack != NULL ) && read_network == NULL ) {
+    usage(argv);
+  }
+
   initialize_set(&set);
 
-  fp = fopen(argv[1], "r");
-  if ( fp == NULL ) {
-    printf("Could not open file: %s\n", argv[1]);
-    return -1;
-  }
+  if ( serve_address != NULL ) {
+    // Serving, the datafile is not considered
+    prefix_cache_t *cache = NULL;
 
-  while ( ( c = fgetc(fp) ) != EOF ) {
-    set_insert_symbol(&set, (char)c );
-    ++file_size;
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+
+    if ( prefix_cache_mb > 0 )
+      cache = prefix_cache_init(lstm_state_size(model_layers, params.layers),
+        (size_t) prefix_cache_mb * 1024 * 1024, PREFIX_CACHE_INTERVAL);
+
+    return lstm_serve(model_layers, params.layers, &set, serve_address, serve_batch, cache);
   }
 
-  fclose(fp);
+  if ( score_lines != NULL ) {
+    // Scoring lines, the datafile is not considered
+    FILE *in = stdin;
+    writer_t writer;
 
-  X_train = calloc(file_size+1, sizeof(int));
-  if ( X_train == NULL )
-    return -1;
+    if ( strcmp(score_lines, "-") ) {
+      in = fopen(score_lines, "rb");
+      if ( in == NULL ) {
+        printf("Could not open file: %s\n", score_lines);
+        return -1;
+      }
+    }
 
-  X_train[file_size] = X_train[0];
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+    writer_init(&writer, stdout);
+    lstm_score_lines(model_layers, params.layers, &set, in, &writer,
+      threads > 0 ? threads : cpu_count(), score_lines_rows, score_lines_policy);
 
-  Y_train = &X_train[1];
+    if ( in != stdin )
+      fclose(in);
+    free(model_layers);
+    return 0;
+  }
 
-  fp = fopen(argv[1], "r");
-  while ( ( c = fgetc(fp) ) != EOF ) 
-    X_train[sz++] = set_char_to_indx(&set,c);
-  fclose(fp);
+  if ( export_c != NULL ) {
+    // Exporting, the datafile is not considered
+    int ret;
 
-  if ( read_network != NULL ) {
-    int FRead;
-    int FReadNewAfterDataFile;
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+    ret = lstm_export_c(model_layers, params.layers, &set, export_c);
+    if ( ret == 0 )
+      printf("Exported the net: %s as %s\n", read_network, export_c);
+    free(model_layers);
+    return ret;
+  }
 
-    initialize_set(&set);
+  if ( pack != NULL ) {
+    // Storing the network for distribution, the datafile is not considered
+    int ret;
 
-    lstm_load(read_network, &set, &params, &model_layers);
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+    ret = lstm_store_as(pack, &set, model_layers, params.layers, params.store_network_dtype);
+    if ( ret == 0 )
+      printf("Stored the net: %s as %s\n", read_network, pack);
+    free(model_layers);
+    return ret;
+  }
 
-    if ( seed == NULL ) {
+  if ( reconstruct != NULL ) {
+    // Rebuilding a network from its base (-r) and a delta
+    char path[256];
+    size_t length = strlen(reconstruct);
+    int ret;
+
+    if ( length > 6 && !strcmp(&reconstruct[length - 6], ".delta") )
+      snprintf(path, sizeof(path), "%.*s", (int) ( length - 6 ), reconstruct);
+    else
+      snprintf(path, sizeof(path), "%s.net", reconstruct);
+
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+    ret = delta_apply(reconstruct, model_layers, params.layers);
+    if ( ret == 0 )
+      ret = lstm_store(path, &set, model_layers, params.layers);
+    if ( ret == 0 )
+      printf("Rebuilt the net: %s from %s as %s\n", reconstruct, read_network, path);
+    free(model_layers);
+    return ret;
+  }
 
-      FRead = set_get_features(&set);
+  if ( score_file != NULL ) {
+    // Scoring, the datafile is not considered
+    int ret;
 
-      // Read from datafile, see if new features appear
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+    ret = score_text_file(score_file);
+    free(model_layers);
+    return ret;
+  }
 
-      fp = fopen(argv[1], "r");
-      if ( fp == NULL ) {
-        printf("Could not open file: %s\n", argv[1]);
+  if ( read_network != NULL &&
+    ( seed != NULL || write_output_directly_bytes ) ) {
+    // Only generating output, the datafile is not considered
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+
+    if ( samples > 0 ) {
+      if ( output_samples(seed != NULL ? seed : "",
+        write_output_directly_bytes ? write_output_directly_bytes : 256) < 0 )
+        return -1;
+    } else if ( beam_width > 0 ) {
+      writer_t writer;
+
+      writer_init(&writer, stdout);
+      lstm_beam_search(model_layers, params.layers, &set,
+        seed != NULL ? seed : "", beam_width,
+        write_output_directly_bytes ? write_output_directly_bytes : 256,
+        beam_length_penalty, beam_stop, &writer);
+      writer_putc(&writer, '\n');
+      writer_flush(&writer);
+    } else if ( draft_network != NULL ) {
+      writer_t writer;
+
+      if ( lstm_load(draft_network, &draft_set, &draft_params, &draft_layers) < 0 )
+        return -1;
+      if ( memcmp(draft_set.values, set.values, sizeof(set.values)) ) {
+        printf("The draft network '%s' does not have the same features as '%s'\n",
+          draft_network, read_network);
         return -1;
       }
 
-      while ( ( c = fgetc(fp) ) != EOF ) {
-        set_insert_symbol(&set, (char)c );
-      }
+      writer_init(&writer, stdout);
+      lstm_speculative_output(model_layers, params.layers, draft_layers,
+        draft_params.layers, &set, seed != NULL ? seed : "", draft_proposal,
+        write_output_directly_bytes ? write_output_directly_bytes : 256, &writer);
+      writer_putc(&writer, '\n');
+      writer_flush(&writer);
+      free(draft_layers);
+    } else if ( write_output_directly_bytes ) {
+      lstm_output_string_layers(model_layers, &set, 0,
+        write_output_directly_bytes, params.layers);
+    } else {
+      lstm_output_string_from_string(model_layers, &set, seed, params.layers, 256);
+    }
+
+    free(model_layers);
+    return 0;
+  }
 
-      fclose(fp);
+  data = read_datafile(argv[1], &file_size);
+  if ( data == NULL ) {
+    printf("Could not open file: %s\n", argv[1]);
+    return -1;
+  }
+
+  if ( read_network != NULL ) {
+    int FRead;
+    int FReadNewAfterDataFile;
+
+    if ( lstm_load(read_network, &set, &params, &model_layers) < 0 )
+      return -1;
+
+    FRead = set_get_features(&set);
+
+    // Read from datafile, see if new features appear
+    sz = 0;
+    while ( sz < file_size ) {
+      set_insert_symbol(&set, data[sz]);
+      ++sz;
+    }
 
-      FReadNewAfterDataFile = set_get_features(&set);
+    FReadNewAfterDataFile = set_get_features(&set);
 
-      if ( FReadNewAfterDataFile > FRead ) {
-        // New features appeared. Must change 
-        // first and last layer.
-        printf("New features detected in datafile.\nLoaded network worked with %d features\
+    if ( FReadNewAfterDataFile > FRead ) {
+      // New features appeared. Must change 
+      // first and last layer.
+      printf("New features detected in datafile.\nLoaded network worked with %d features\
 , now there is %d features in total.\n\
 Reallocating space in network input and output layer to accommodate this new feature set.\n",
-          FRead, FReadNewAfterDataFile);
+        FRead, FReadNewAfterDataFile);
 
-        lstm_reinit_model(
-          model_layers,
-          params.layers,
-          FRead,
-          FReadNewAfterDataFile
-        );
-
-      }
+      lstm_reinit_model(
+        model_layers,
+        params.layers,
+        FRead,
+        FReadNewAfterDataFile
+      );
 
     }
 
-    if ( seed == NULL )
-      printf("Loaded the net: %s\n", read_network);
+    printf("Loaded the net: %s\n", read_network);
   } else {
+    sz = 0;
+    while ( sz < file_size ) {
+      set_insert_symbol(&set, data[sz]);
+      ++sz;
+    }
+
     /* Allocating space for a new model */
     model_layers = calloc(params.layers, sizeof(lstm_model_t*));
 
@@ -345,17 +780,23 @@ Reallocating space in network input and output layer to accommodate this new fea
     }
   }
 
-  if ( write_output_directly_bytes && read_network != NULL ) {
-
-    lstm_output_string_layers(model_layers, &set, set_indx_to_char(&set, 0), write_output_directly_bytes, params.layers);
+  // The feature set is final now, map the datafile to indices
+  X_train = calloc(file_size+1, sizeof(int));
+  if ( X_train == NULL )
+    return -1;
 
-    free(model_layers);
-    free(X_train);
-    return 0;
-  } else if ( write_output_directly_bytes && read_network == NULL ) {
-    usage(argv);
+  sz = 0;
+  while ( sz < file_size ) {
+    X_train[sz] = set_char_to_indx(&set, data[sz]);
+    ++sz;
   }
 
+  X_train[file_size] = X_train[0];
+
+  Y_train = &X_train[1];
+
+  free(data);
+
   if ( seed != NULL ) {
     // output directly
     lstm_output_string_from_string(model_layers, &set, seed, params.layers, 256);
@@ -379,6 +820,14 @@ Reallocating space in network input and output layer to accommodate this new fea
     printf("Training parameters: Backprop Through Time: %d, LR: %lf, Mo: %lf, LA: %lf, LR-decrease: %lf.\n",
       MINI_BATCH_SIZE, params.learning_rate, params.momentum, params.lambda, params.learning_rate_decrease);
 
+    if ( bench > 0 ) {
+      lstm_benchmark(model_layers, &params, file_size, X_train, Y_train,
+        params.layers, bench);
+      free(model_layers);
+      free(X_train);
+      return 0;
+    }
+
     signal(SIGINT, store_the_net_layers);
 
     lstm_train(
@@ -393,10 +842,10 @@ Reallocating space in network input and output layer to accommodate this new fea
     );
 
     if ( store_after_training ) {
-      lstm_store(params.store_network_name_raw, &set,
-      model_layers, params.layers);
+      lstm_store_as(params.store_network_name_raw, &set,
+      model_layers, params.layers, params.store_network_dtype);
       lstm_store_net_layers_as_json(model_layers, params.store_network_name_json,
-        JSON_KEY_NAME_SET, &set, params.layers); 
+        JSON_KEY_NAME_SET, &set, params.layers, params.store_network_json_format);
     }
 
     printf("Loss after training: %lf\n", loss);
@@ -0,0 +1,186 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "prefix_cache.h"
+
+prefix_cache_t* prefix_cache_init(size_t state_size, size_t budget, size_t interval)
+{
+  prefix_cache_t *cache = e_calloc(1, sizeof(prefix_cache_t));
+
+  cache->state_size = state_size;
+  cache->budget = budget;
+  cache->interval = interval > 0 ? interval : 1;
+
+  return cache;
+}
+
+static void prefix_cache_free_nodes(prefix_cache_node_t *node)
+{
+  while ( node != NULL ) {
+    prefix_cache_node_t *sibling = node->sibling;
+
+    prefix_cache_free_nodes(node->child);
+    free(node->state);
+    free(node);
+    node = sibling;
+  }
+}
+
+void prefix_cache_free(prefix_cache_t *cache)
+{
+  prefix_cache_free_nodes(cache->root.child);
+  free(cache);
+}
+
+static void prefix_cache_lru_unlink(prefix_cache_t *cache, prefix_cache_node_t *node)
+{
+  if ( node->lru_prev != NULL )
+    node->lru_prev->lru_next = node->lru_next;
+  else
+    cache->lru_head = node->lru_next;
+
+  if ( node->lru_next != NULL )
+    node->lru_next->lru_prev = node->lru_prev;
+  else
+    cache->lru_tail = node->lru_prev;
+
+  node->lru_prev = node->lru_next = NULL;
+}
+
+static void prefix_cache_lru_touch(prefix_cache_t *cache, prefix_cache_node_t *node)
+{
+  if ( cache->lru_head == node )
+    return;
+
+  if ( node->lru_prev != NULL || node->lru_next != NULL || cache->lru_tail == node )
+    prefix_cache_lru_unlink(cache, node);
+
+  node->lru_next = cache->lru_head;
+  if ( cache->lru_head != NULL )
+    cache->lru_head->lru_prev = node;
+  cache->lru_head = node;
+  if ( cache->lru_tail == NULL )
+    cache->lru_tail = node;
+}
+
+static prefix_cache_node_t* prefix_cache_child(prefix_cache_node_t *node, char symbol)
+{
+  prefix_cache_node_t *child = node->child;
+
+  while ( child != NULL && child->symbol != symbol )
+    child = child->sibling;
+
+  return child;
+}
+
+// Drop the state of the least recently used node, and the nodes no longer needed
+static void prefix_cache_evict(prefix_cache_t *cache)
+{
+  prefix_cache_node_t *node = cache->lru_tail;
+
+  prefix_cache_lru_unlink(cache, node);
+  free(node->state);
+  node->state = NULL;
+  cache->used -= cache->state_size * sizeof(double);
+
+  while ( node != &cache->root && node->state == NULL && node->child == NULL ) {
+    prefix_cache_node_t *parent = node->parent;
+    prefix_cache_node_t **link = &parent->child;
+
+    while ( *link != node )
+      link = &(*link)->sibling;
+    *link = node->sibling;
+
+    free(node);
+    cache->used -= sizeof(prefix_cache_node_t);
+    node = parent;
+  }
+}
+
+size_t prefix_cache_lookup(prefix_cache_t *cache, const char *prompt,
+  size_t len, double *state)
+{
+  prefix_cache_node_t *node = &cache->root, *found = NULL;
+  size_t depth = 0, found_depth = 0;
+
+  while ( depth < len &&
+    ( node = prefix_cache_child(node, prompt[depth]) ) != NULL ) {
+    ++depth;
+    if ( node->state != NULL ) {
+      found = node;
+      found_depth = depth;
+    }
+  }
+
+  if ( found == NULL ) {
+    cache->misses++;
+    return 0;
+  }
+
+  copy_vector(state, found->state, (int) cache->state_size);
+  prefix_cache_lru_touch(cache, found);
+  cache->hits++;
+  cache->saved += found_depth;
+
+  return found_depth;
+}
+
+void prefix_cache_insert(prefix_cache_t *cache, const char *prompt,
+  size_t len, const double *state)
+{
+  prefix_cache_node_t *node = &cache->root, *child;
+  size_t depth = 0;
+  size_t state_bytes = cache->state_size * sizeof(double);
+
+  if ( len == 0 || state_bytes + len * sizeof(prefix_cache_node_t) > cache->budget )
+    return;
+
+  while ( depth < len ) {
+    child = prefix_cache_child(node, prompt[depth]);
+    if ( child == NULL ) {
+      child = e_calloc(1, sizeof(prefix_cache_node_t));
+      child->symbol = prompt[depth];
+      child->parent = node;
+      child->sibling = node->child;
+      node->child = child;
+      cache->used += sizeof(prefix_cache_node_t);
+    }
+    node = child;
+    ++depth;
+  }
+
+  if ( node->state == NULL ) {
+    node->state = malloc(state_bytes);
+    if ( node->state == NULL ) {
+      fprintf(stderr, "%s error: failed to allocate %zu bytes\n", __func__, state_bytes);
+      exit(1);
+    }
+    memcpy(node->state, state, state_bytes);
+    cache->used += state_bytes;
+  }
+
+  prefix_cache_lru_touch(cache, node);
+
+  while ( cache->used > cache->budget && cache->lru_tail != node )
+    prefix_cache_evict(cache);
+}
@@ -0,0 +1,95 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file prefix_cache.h
+    \brief Cache of network states for prompt prefixes
+
+    Prompts are stored in a trie. A node can hold the state of the
+    network (see \ref lstm_state_size) after the prompt prefix that
+    leads to it has been fed. A new prompt resumes from the deepest
+    cached prefix instead of feeding it again.
+
+    The cached states are evicted in least recently used order
+    when the memory budget is exceeded.
+*/
+
+#ifndef LSTM_PREFIX_CACHE_H
+#define LSTM_PREFIX_CACHE_H
+
+#include "lstm.h"
+#include "set.h"
+
+typedef struct prefix_cache_node_t {
+  char symbol;                           /**< Last character of the prefix */
+  struct prefix_cache_node_t *parent;
+  struct prefix_cache_node_t *child;     /**< First child */
+  struct prefix_cache_node_t *sibling;   /**< Next child of the parent */
+  double *state;                         /**< Network state after the prefix, or NULL */
+  struct prefix_cache_node_t *lru_prev;  /**< More recently used */
+  struct prefix_cache_node_t *lru_next;  /**< Less recently used */
+} prefix_cache_node_t;
+
+typedef struct prefix_cache_t {
+  prefix_cache_node_t root;
+  size_t state_size;           /**< Doubles in each state */
+  size_t budget;               /**< Memory budget in bytes, nodes and states */
+  size_t used;                 /**< Memory used in bytes */
+  size_t interval;             /**< States are kept every interval characters of a prompt */
+  prefix_cache_node_t *lru_head;
+  prefix_cache_node_t *lru_tail;
+  unsigned long hits;          /**< Lookups that found a prefix */
+  unsigned long misses;        /**< Lookups that found nothing */
+  unsigned long saved;         /**< Characters not fed thanks to the cache */
+} prefix_cache_t;
+
+/**
+* Allocate an empty cache
+* @param state_size doubles in each state, see \ref lstm_state_size
+* @param budget memory budget in bytes
+* @param interval while feeding a prompt, a state is kept every \
+interval characters
+*/
+prefix_cache_t* prefix_cache_init(size_t state_size, size_t budget, size_t interval);
+/** Free a cache and all its states */
+void prefix_cache_free(prefix_cache_t *cache);
+/**
+* Find the deepest cached prefix of a prompt
+* @param cache the cache
+* @param prompt the prompt
+* @param len length of \p prompt, prefixes up to this length are considered
+* @param state set to the cached state, if one is found
+* @return length of the cached prefix, 0 if none was found
+*/
+size_t prefix_cache_lookup(prefix_cache_t *cache, const char *prompt,
+  size_t len, double *state);
+/**
+* Keep the state after a prompt prefix, evicting old states if needed
+* @param cache the cache
+* @param prompt the prompt
+* @param len length of the prefix \p state belongs to
+* @param state network state after the prefix
+*/
+void prefix_cache_insert(prefix_cache_t *cache, const char *prompt,
+  size_t len, const double *state);
+
+#endif
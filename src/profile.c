@@ -0,0 +1,216 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "profile.h"
+#include "utilities.h"
+#include <string.h>
+
+#if defined(__linux__) && !defined(WINDOWS)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PROFILE_PERF_EVENTS
+#endif
+
+static const char *profile_names[PROFILE_PHASES] = {
+  "forward",
+  "loss",
+  "backward",
+  "accumulate",
+  "clip",
+  "optimizer",
+  "sample",
+  "checkpoint"
+};
+
+#ifdef PROFILE_PERF_EVENTS
+static const uint64_t profile_configs[PROFILE_EVENTS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES
+};
+
+/*
+* Open the counters of this thread as one group, cycles leading, so they
+* are read with one read(). Returns 0 or -1.
+*/
+static int profile_open_counters(int *fd)
+{
+  struct perf_event_attr attr;
+  int e = 0;
+
+  while ( e < PROFILE_EVENTS ) {
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = profile_configs[e];
+    attr.disabled = e == 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    fd[e] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, e == 0 ? -1 : fd[0], 0);
+    if ( fd[e] < 0 ) {
+      while ( e > 0 ) {
+        close(fd[--e]);
+        fd[e] = -1;
+      }
+      return -1;
+    }
+    ++e;
+  }
+
+  ioctl(fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return 0;
+}
+#endif
+
+/* Read the counters to values, left as they are if they can not be read */
+static void profile_read_counters(const profile_t *profile, uint64_t *values)
+{
+#ifdef PROFILE_PERF_EVENTS
+  uint64_t group[1 + PROFILE_EVENTS];
+
+  if ( read(profile->fd[0], group, sizeof(group)) == (ssize_t) sizeof(group) &&
+    group[0] == PROFILE_EVENTS )
+    memcpy(values, &group[1], PROFILE_EVENTS * sizeof(uint64_t));
+#else
+  (void) profile;
+  (void) values;
+#endif
+}
+
+void profile_init(profile_t *profile, int level)
+{
+  int e = 0;
+
+  memset(profile, 0, sizeof(*profile));
+  while ( e < PROFILE_EVENTS )
+    profile->fd[e++] = -1;
+
+  if ( level >= PROFILE_COUNTERS ) {
+#ifdef PROFILE_PERF_EVENTS
+    profile_open_counters(profile->fd);
+#endif
+    if ( profile->fd[0] < 0 )
+      fprintf(stderr, "%s warning: Hardware counters are not available, only time is measured.\n",
+        __func__);
+  }
+
+  profile->start = time_seconds();
+}
+
+void profile_free(profile_t *profile)
+{
+  int e = 0;
+
+  while ( e < PROFILE_EVENTS ) {
+#ifdef PROFILE_PERF_EVENTS
+    if ( profile->fd[e] >= 0 )
+      close(profile->fd[e]);
+#endif
+    profile->fd[e++] = -1;
+  }
+}
+
+double profile_begin(profile_t *profile)
+{
+  if ( profile->fd[0] >= 0 )
+    profile_read_counters(profile, profile->begin);
+  return time_seconds();
+}
+
+void profile_add(profile_t *profile, int phase, double start)
+{
+  uint64_t end[PROFILE_EVENTS];
+  int e = 0;
+
+  profile->seconds[phase] += time_seconds() - start;
+  profile->calls[phase]++;
+
+  if ( profile->fd[0] >= 0 ) {
+    memcpy(end, profile->begin, sizeof(end));
+    profile_read_counters(profile, end);
+    while ( e < PROFILE_EVENTS ) {
+      profile->events[phase][e] += end[e] - profile->begin[e];
+      ++e;
+    }
+  }
+}
+
+/* A row of the table, calls left empty if NULL */
+static void profile_print_row(FILE *fp, const char *name, const unsigned long *calls,
+  double seconds, double total, unsigned long chars)
+{
+  if ( calls != NULL )
+    fprintf(fp, "%-12s %12lu", name, *calls);
+  else
+    fprintf(fp, "%-12s %12s", name, "");
+  fprintf(fp, " %10.3f %6.1f%% %12.0f\n", seconds,
+    total > 0.0 ? 100.0 * seconds / total : 0.0,
+    seconds > 0.0 ? chars / seconds : 0.0);
+}
+
+/* Instructions per cycle and misses per thousand instructions of every phase */
+static void profile_print_counters(const profile_t *profile, FILE *fp)
+{
+  const uint64_t *events;
+  double instructions;
+  int p = 0;
+
+  fprintf(fp, "%-12s %14s %14s %6s %12s %12s\n", "phase", "cycles", "instructions",
+    "IPC", "LLC miss/ki", "branch mi/ki");
+  while ( p < PROFILE_PHASES ) {
+    events = profile->events[p];
+    instructions = (double) events[PROFILE_INSTRUCTIONS];
+    fprintf(fp, "%-12s %14llu %14llu %6.2f %12.2f %12.2f\n", profile_names[p],
+      (unsigned long long) events[PROFILE_CYCLES],
+      (unsigned long long) events[PROFILE_INSTRUCTIONS],
+      events[PROFILE_CYCLES] > 0 ? instructions / events[PROFILE_CYCLES] : 0.0,
+      instructions > 0.0 ? 1000.0 * events[PROFILE_LLC_MISSES] / instructions : 0.0,
+      instructions > 0.0 ? 1000.0 * events[PROFILE_BRANCH_MISSES] / instructions : 0.0);
+    ++p;
+  }
+}
+
+void profile_print(const profile_t *profile, FILE *fp)
+{
+  double total = time_seconds() - profile->start, other = total;
+  int p = 0;
+
+  fprintf(fp, "%-12s %12s %10s %7s %12s\n", "phase", "calls", "seconds", "share", "chars/s");
+  while ( p < PROFILE_PHASES ) {
+    profile_print_row(fp, profile_names[p], &profile->calls[p], profile->seconds[p],
+      total, profile->chars);
+    other -= profile->seconds[p];
+    ++p;
+  }
+  profile_print_row(fp, "other", NULL, other > 0.0 ? other : 0.0, total, profile->chars);
+  profile_print_row(fp, "total", NULL, total, total, profile->chars);
+
+  if ( profile->fd[0] >= 0 )
+    profile_print_counters(profile, fp);
+}
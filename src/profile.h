@@ -0,0 +1,93 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+/*! \file profile.h
+    \brief Where the time of training goes
+
+    Wall time and call counts per phase of \ref lstm_trainer_step and
+    \ref lstm_train, turned on with lstm_model_parameters_t.profile
+    (-prof). The clock is only read when profiling.
+
+    At PROFILE_COUNTERS the hardware counters of the training thread
+    are read as well (Linux, perf_event_open): cycles, instructions,
+    last level cache misses and branch misses, reported as instructions
+    per cycle and misses per thousand instructions of every phase. Where
+    the counters can not be opened (no PMU, perf_event_paranoid) only the
+    time is measured.
+*/
+
+#ifndef LSTM_PROFILE_H
+#define LSTM_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PROFILE_TIME                          1   /**< Level: wall time and calls */
+#define PROFILE_COUNTERS                      2   /**< Level: hardware counters as well */
+
+#define PROFILE_FORWARD                       0   /**< Forward propagation, a call per character */
+#define PROFILE_LOSS                          1   /**< Cross entropy, a call per character */
+#define PROFILE_BACKWARD                      2   /**< Backward propagation, a call per character */
+#define PROFILE_ACCUMULATE                    3   /**< Summing the gradients, a call per character */
+#define PROFILE_CLIP                          4   /**< Clipping the gradients, a call per step */
+#define PROFILE_OPTIMIZER                     5   /**< Updating the weights, a call per step */
+#define PROFILE_SAMPLE                        6   /**< Progress output and samples */
+#define PROFILE_CHECKPOINT                    7   /**< Copying the network to store it, and waiting for it */
+#define PROFILE_PHASES                        8
+
+#define PROFILE_CYCLES                        0
+#define PROFILE_INSTRUCTIONS                  1
+#define PROFILE_LLC_MISSES                    2
+#define PROFILE_BRANCH_MISSES                 3
+#define PROFILE_EVENTS                        4
+
+typedef struct profile_t {
+  double seconds[PROFILE_PHASES];
+  unsigned long calls[PROFILE_PHASES];
+  unsigned long chars;                /**< Characters trained on */
+  double start;                       /**< \ref time_seconds at \ref profile_init */
+  int fd[PROFILE_EVENTS];             /**< Hardware counters, fd[0] leads the group, -1 if not read */
+  uint64_t begin[PROFILE_EVENTS];     /**< Counters at \ref profile_begin */
+  uint64_t events[PROFILE_PHASES][PROFILE_EVENTS];
+} profile_t;
+
+/**
+* Start profiling, all phases at zero
+* @param profile the profile
+* @param level PROFILE_TIME or PROFILE_COUNTERS
+*/
+void profile_init(profile_t *profile, int level);
+/** Stop reading the counters, the profile itself is the caller's */
+void profile_free(profile_t *profile);
+/** Start a call of a phase, returns the start to pass to \ref profile_add */
+double profile_begin(profile_t *profile);
+/** Count a call of \p phase that started at \p start, see \ref profile_begin */
+void profile_add(profile_t *profile, int phase, double start);
+/**
+* Print the time of every phase, the share of the time since \ref profile_init
+* and the characters trained per second of that phase. The rest of the time is
+* shown as other. With counters, the instructions per cycle and misses per
+* thousand instructions of every phase follow.
+*/
+void profile_print(const profile_t *profile, FILE *fp);
+
+#endif
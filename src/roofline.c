@@ -0,0 +1,326 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "roofline.h"
+#include "utilities.h"
+#include <string.h>
+
+#ifdef _MSC_VER
+#define ROOFLINE_THREAD_LOCAL  __declspec(thread)
+#else
+#define ROOFLINE_THREAD_LOCAL  __thread
+#endif
+
+// Independent multiply-add chains of the FLOP loop, enough to fill the pipelines
+#define ROOFLINE_CHAINS        32
+// Seconds every peak is measured for, at least
+#define ROOFLINE_PEAK_SECONDS  0.2
+// Smallest working set the bandwidth is measured over, in bytes
+#define ROOFLINE_SMALLEST_SET  ( 24 * 1024 )
+
+int roofline_level = 0;
+
+static const char *roofline_names[ROOFLINE_KERNELS] = {
+  "fully_connected_forward",
+  "fully_connected_forward_batch",
+  "fully_connected_forward_strided",
+  "fully_connected_forward_fixed",
+  "fully_connected_accumulate",
+  "fully_connected_backward",
+  "cross_entropy",
+  "log_softmax",
+  "softmax_layers_forward",
+  "softmax_loss_layer_backward",
+  "sigmoid_forward",
+  "sigmoid_backward",
+  "tanh_forward",
+  "tanh_backward",
+  "vectors_add",
+  "vectors_add_scalar",
+  "vectors_scalar_multiply",
+  "vectors_add_scalar_multiply",
+  "vectors_substract",
+  "vectors_substract_scalar_multiply",
+  "vectors_multiply",
+  "vectors_div",
+  "vector_sqrt",
+  "copy_vector",
+  "vector_set_to_zero",
+  "one_norm",
+  "vectors_fit",
+  "vectors_clip"
+};
+
+static ROOFLINE_THREAD_LOCAL roofline_t roofline_local;
+// Seconds between two back to back reads of the clock, taken off every timed call
+static double roofline_overhead = 0.0;
+
+void roofline_start(int level)
+{
+  double begin;
+  int i = 0;
+
+  memset(&roofline_local, 0, sizeof(roofline_local));
+
+  if ( level >= ROOFLINE_TIME ) {
+    begin = time_seconds();
+    while ( i < 1000 ) {
+      time_seconds();
+      ++i;
+    }
+    roofline_overhead = ( time_seconds() - begin ) / 1001;
+  }
+
+  roofline_level = level;
+}
+
+void roofline_stop(roofline_t *counts)
+{
+  roofline_level = 0;
+  memcpy(counts, &roofline_local, sizeof(*counts));
+}
+
+double roofline_clock(void)
+{
+  return time_seconds();
+}
+
+void roofline_add(int kernel, double begin, double flops, double bytes)
+{
+  roofline_kernel_t *k = &roofline_local.kernels[kernel];
+  double seconds;
+
+  k->calls++;
+  k->flops += flops;
+  k->bytes += bytes;
+
+  if ( roofline_level >= ROOFLINE_TIME ) {
+    seconds = time_seconds() - begin - roofline_overhead;
+    k->seconds += seconds > 0.0 ? seconds : 0.0;
+  }
+}
+
+/*
+* Multiply-adds on the ROOFLINE_CHAINS independent sums of s, 2 * ROOFLINE_CHAINS
+* operations an iteration. The sums are kept in s so that no call can be left out.
+*/
+static void roofline_flop_loop(double *s, long iterations)
+{
+  double a = 0.999999, c = 1e-6;
+  long i = 0;
+  int k;
+
+  while ( i < iterations ) {
+    k = 0;
+    while ( k < ROOFLINE_CHAINS ) {
+      s[k] = s[k] * a + c;
+      ++k;
+    }
+    ++i;
+  }
+}
+
+/* a = b + s * c, over n doubles, 24 bytes an element */
+static void roofline_triad(double *a, const double *b, const double *c, size_t n)
+{
+  size_t i = 0;
+
+  while ( i < n ) {
+    a[i] = b[i] + 1.000001 * c[i];
+    ++i;
+  }
+}
+
+void roofline_peak(roofline_peak_t *peak, size_t working_set)
+{
+  volatile double sink;
+  double s[ROOFLINE_CHAINS], *a, *b, *c, begin, seconds, best;
+  long iterations = 1 << 12;
+  size_t n, reps, size, r = 0;
+  int set;
+
+  while ( r < ROOFLINE_CHAINS ) {
+    s[r] = r * 1e-3;
+    ++r;
+  }
+
+  // Double the work until it takes long enough to time
+  do {
+    iterations *= 2;
+    begin = time_seconds();
+    roofline_flop_loop(s, iterations);
+    seconds = time_seconds() - begin;
+  } while ( seconds < ROOFLINE_PEAK_SECONDS / 4 );
+
+  best = seconds;
+  r = 0;
+  while ( r < 3 ) {
+    begin = time_seconds();
+    roofline_flop_loop(s, iterations);
+    seconds = time_seconds() - begin;
+    if ( seconds < best )
+      best = seconds;
+    ++r;
+  }
+  peak->flops = 2.0 * ROOFLINE_CHAINS * iterations / best;
+
+  // Working sets from ROOFLINE_SMALLEST_SET up by factors of 4, the last the whole working_set
+  if ( working_set < ROOFLINE_SMALLEST_SET )
+    working_set = ROOFLINE_SMALLEST_SET;
+  peak->sets = 0;
+  size = ROOFLINE_SMALLEST_SET;
+  while ( peak->sets < ROOFLINE_SETS - 1 && size < working_set ) {
+    peak->working_set[peak->sets++] = size;
+    size *= 4;
+  }
+  peak->working_set[peak->sets++] = working_set;
+
+  // Not counted by e_calloc, it is not memory of the network
+  n = working_set / ( 3 * sizeof(double) );
+  a = calloc(n, sizeof(double));
+  b = calloc(n, sizeof(double));
+  c = calloc(n, sizeof(double));
+  if ( a == NULL || b == NULL || c == NULL ) {
+    fprintf(stderr, "%s error: Failed to allocate %zu bytes to measure the bandwidth.\n",
+      __func__, working_set);
+    exit(1);
+  }
+
+  set = 0;
+  while ( set < peak->sets ) {
+    n = peak->working_set[set] / ( 3 * sizeof(double) );
+    roofline_triad(a, b, c, n);
+
+    reps = 1;
+    do {
+      reps *= 2;
+      begin = time_seconds();
+      r = 0;
+      while ( r < reps ) {
+        roofline_triad(a, b, c, n);
+        // Every pass reads what the last one wrote, so none can be left out
+        roofline_triad(b, a, c, n);
+        r += 2;
+      }
+      seconds = time_seconds() - begin;
+    } while ( seconds < ROOFLINE_PEAK_SECONDS / 4 );
+    peak->bytes[set] = 24.0 * n * reps / seconds;
+    ++set;
+  }
+  sink = a[0] + b[0] + s[0];
+  (void) sink;
+
+  free(a);
+  free(b);
+  free(c);
+}
+
+/* Bandwidth of the smallest working set measured that holds \p size bytes */
+static double roofline_bandwidth(const roofline_peak_t *peak, double size)
+{
+  int set = 0;
+
+  while ( set < peak->sets - 1 && peak->working_set[set] < size )
+    ++set;
+  return peak->bytes[set];
+}
+
+/* Seconds the roofline allows: the operations at peak FLOP/s or the bytes at the bandwidth of a call */
+static double roofline_bound(const roofline_peak_t *peak, const roofline_kernel_t *k,
+  int *compute_bound)
+{
+  double compute = k->flops / peak->flops, memory;
+
+  memory = k->calls > 0 ? k->bytes / roofline_bandwidth(peak, k->bytes / k->calls) : 0.0;
+  if ( compute_bound != NULL )
+    *compute_bound = compute >= memory;
+  return compute > memory ? compute : memory;
+}
+
+/* Sums of all kernels, and the seconds they are allowed */
+static void roofline_sum(const roofline_peak_t *peak, const roofline_t *counts,
+  roofline_kernel_t *sum, double *bound)
+{
+  const roofline_kernel_t *k;
+  int i = 0;
+
+  memset(sum, 0, sizeof(*sum));
+  *bound = 0.0;
+  while ( i < ROOFLINE_KERNELS ) {
+    k = &counts->kernels[i];
+    sum->calls += k->calls;
+    sum->flops += k->flops;
+    sum->bytes += k->bytes;
+    sum->seconds += k->seconds;
+    *bound += roofline_bound(peak, k, NULL);
+    ++i;
+  }
+}
+
+/* A row of the table, without bound if \p bound_by is NULL */
+static void roofline_print_row(FILE *fp, const char *name, const roofline_kernel_t *k,
+  double seconds, double total, double bound, const char *bound_by)
+{
+  fprintf(fp, "%-34s %10lu %10.4f %10.4f %7.3f %6.1f%% %9.3f %9.3f %6.1f%%%s%s\n",
+    name, k->calls, k->flops * 1e-9, k->bytes * 1e-9,
+    k->bytes > 0.0 ? k->flops / k->bytes : 0.0,
+    total > 0.0 ? 100.0 * seconds / total : 0.0,
+    seconds > 0.0 ? k->flops * 1e-9 / seconds : 0.0,
+    seconds > 0.0 ? k->bytes * 1e-9 / seconds : 0.0,
+    seconds > 0.0 ? 100.0 * bound / seconds : 0.0, bound_by != NULL ? " " : "",
+    bound_by != NULL ? bound_by : "");
+}
+
+void roofline_print(const roofline_peak_t *peak, const roofline_t *kernels,
+  const roofline_t *steps, double seconds, FILE *fp)
+{
+  const roofline_kernel_t *k;
+  roofline_kernel_t sum;
+  double bound;
+  int i = 0, compute_bound = 0;
+
+  fprintf(fp, "Peak of one thread: %.3f GFLOP/s, GB/s by working set:", peak->flops * 1e-9);
+  while ( i < peak->sets ) {
+    fprintf(fp, " %zu KB %.3f%s", peak->working_set[i] / 1024, peak->bytes[i] * 1e-9,
+      i + 1 < peak->sets ? "," : "\n");
+    ++i;
+  }
+  fprintf(fp, "%-34s %10s %10s %10s %7s %7s %9s %9s %7s %s\n", "kernel", "calls",
+    "GFLOP", "GB", "FLOP/B", "time", "GFLOP/s", "GB/s", "roof", "bound");
+
+  roofline_sum(peak, kernels, &sum, &bound);
+  i = 0;
+  while ( i < ROOFLINE_KERNELS ) {
+    k = &kernels->kernels[i];
+    if ( k->calls > 0 ) {
+      roofline_print_row(fp, roofline_names[i], k, k->seconds, sum.seconds,
+        roofline_bound(peak, k, &compute_bound), compute_bound ? "compute" : "memory");
+    }
+    ++i;
+  }
+  roofline_print_row(fp, "all kernels", &sum, sum.seconds, sum.seconds, bound, NULL);
+
+  // Counted without timing the calls, over the wall time of the steps
+  roofline_sum(peak, steps, &sum, &bound);
+  roofline_print_row(fp, "training steps", &sum, seconds, seconds, bound, NULL);
+}
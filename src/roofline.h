@@ -0,0 +1,146 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+/*! \file roofline.h
+    \brief Floating-point operations and bytes of the kernels
+
+    The kernels of layers.c and utilities.c count the floating-point
+    operations they do and the bytes they read and write, from their
+    R, C and L, into counters of the calling thread. Counting is off
+    unless started with \ref roofline_start, then a call costs a compare.
+
+    Operations are additions, subtractions, multiplications and
+    divisions, exp, tanh, sqrt and log count as one each and comparisons
+    not at all. Bytes are every array of the kernel read once and
+    written once, as if nothing were in cache when it is called.
+
+    The benchmark (-bench) compares what the kernels reach in training
+    with a peak measured on the machine, see \ref roofline_peak, as on
+    a roofline: a kernel can at best do its operations at the peak
+    FLOP/s or move its bytes at the peak bandwidth, whichever takes
+    longer.
+*/
+
+#ifndef LSTM_ROOFLINE_H
+#define LSTM_ROOFLINE_H
+
+#include <stdio.h>
+
+#define ROOFLINE_COUNT                        1   /**< Level: operations, bytes and calls */
+#define ROOFLINE_TIME                         2   /**< Level: the time of every call as well */
+
+#define ROOFLINE_FULLY_CONNECTED_FORWARD             0
+#define ROOFLINE_FULLY_CONNECTED_FORWARD_BATCH       1
+#define ROOFLINE_FULLY_CONNECTED_FORWARD_STRIDED     2
+#define ROOFLINE_FULLY_CONNECTED_FORWARD_FIXED       3   /**< The kernels for fixed C */
+#define ROOFLINE_FULLY_CONNECTED_ACCUMULATE          4
+#define ROOFLINE_FULLY_CONNECTED_BACKWARD            5
+#define ROOFLINE_CROSS_ENTROPY                       6
+#define ROOFLINE_LOG_SOFTMAX                         7
+#define ROOFLINE_SOFTMAX_FORWARD                     8
+#define ROOFLINE_SOFTMAX_BACKWARD                    9
+#define ROOFLINE_SIGMOID_FORWARD                     10
+#define ROOFLINE_SIGMOID_BACKWARD                    11
+#define ROOFLINE_TANH_FORWARD                        12
+#define ROOFLINE_TANH_BACKWARD                       13
+#define ROOFLINE_VECTORS_ADD                         14
+#define ROOFLINE_VECTORS_ADD_SCALAR                  15
+#define ROOFLINE_VECTORS_SCALAR_MULTIPLY             16  /**< And vectors_mutliply_scalar */
+#define ROOFLINE_VECTORS_ADD_SCALAR_MULTIPLY         17
+#define ROOFLINE_VECTORS_SUBSTRACT                   18
+#define ROOFLINE_VECTORS_SUBSTRACT_SCALAR_MULTIPLY   19
+#define ROOFLINE_VECTORS_MULTIPLY                    20
+#define ROOFLINE_VECTORS_DIV                         21
+#define ROOFLINE_VECTOR_SQRT                         22
+#define ROOFLINE_COPY_VECTOR                         23
+#define ROOFLINE_VECTOR_SET_TO_ZERO                  24
+#define ROOFLINE_ONE_NORM                            25
+#define ROOFLINE_VECTORS_FIT                         26
+#define ROOFLINE_VECTORS_CLIP                        27
+#define ROOFLINE_KERNELS                             28
+
+/** 0, ROOFLINE_COUNT or ROOFLINE_TIME, set by \ref roofline_start */
+extern int roofline_level;
+
+/** Start of a kernel call, the time when timing and 0 otherwise */
+#define ROOFLINE_BEGIN() \
+  ( roofline_level >= ROOFLINE_TIME ? roofline_clock() : 0.0 )
+/** End of a kernel call that started at \p begin, see \ref ROOFLINE_BEGIN */
+#define ROOFLINE_END(kernel, begin, flops, bytes) \
+  do { \
+    if ( roofline_level ) \
+      roofline_add((kernel), (begin), (double) (flops), (double) (bytes)); \
+  } while ( 0 )
+
+typedef struct roofline_kernel_t {
+  unsigned long calls;
+  double flops;
+  double bytes;
+  double seconds;                     /**< 0 unless timed */
+} roofline_kernel_t;
+
+/** The counters of a thread */
+typedef struct roofline_t {
+  roofline_kernel_t kernels[ROOFLINE_KERNELS];
+} roofline_t;
+
+/** Working sets the bandwidth is measured over */
+#define ROOFLINE_SETS                                 8
+
+/** What the machine reaches, on one thread */
+typedef struct roofline_peak_t {
+  double flops;                       /**< FLOP/s */
+  int sets;                           /**< Working sets measured */
+  size_t working_set[ROOFLINE_SETS];  /**< Bytes, smallest first */
+  double bytes[ROOFLINE_SETS];        /**< Bytes/s over the working sets */
+} roofline_peak_t;
+
+/**
+* Zero the counters of the calling thread and start counting
+* @param level ROOFLINE_COUNT, or ROOFLINE_TIME to time every call too
+*/
+void roofline_start(int level);
+/** Stop counting, the counters of the calling thread are copied to \p counts */
+void roofline_stop(roofline_t *counts);
+/** \ref time_seconds, used by \ref ROOFLINE_BEGIN */
+double roofline_clock(void);
+/** Count a call of \p kernel, use \ref ROOFLINE_END */
+void roofline_add(int kernel, double begin, double flops, double bytes);
+/**
+* Measure the peak of this thread: FLOP/s of independent multiply-adds,
+* compiled as the kernels are, and bytes/s of a triad, a = b + s * c,
+* over working sets growing by factors of 4 up to \p working_set bytes,
+* the memory of the network. A kernel is held to the bandwidth of the
+* smallest working set that holds the bytes of one of its calls, which
+* is the cache those bytes fit in.
+*/
+void roofline_peak(roofline_peak_t *peak, size_t working_set);
+/**
+* Print GFLOP/s, GB/s and the share of the roofline reached by every
+* kernel called in \p kernels, counted with ROOFLINE_TIME, and by
+* \p steps training steps counted with ROOFLINE_COUNT that took
+* \p seconds.
+*/
+void roofline_print(const roofline_peak_t *peak, const roofline_t *kernels,
+  const roofline_t *steps, double seconds, FILE *fp);
+
+#endif
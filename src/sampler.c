@@ -0,0 +1,310 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "sampler.h"
+#include "utilities.h"
+
+void sampler_seed(sampler_t *sampler, unsigned long seed)
+{
+  random_seed(&sampler->state, seed);
+}
+
+double sampler_uniform(sampler_t *sampler)
+{
+  return random_uniform(&sampler->state);
+}
+
+sampler_t* sampler_init(int F, int mode, double temperature, int top_k,
+  double top_p, unsigned long seed)
+{
+  sampler_t *sampler = e_calloc(1, sizeof(sampler_t));
+
+  sampler->F = F;
+  sampler->mode = mode;
+  sampler->temperature = temperature > 0.0 ? temperature : 1.0;
+  sampler->top_k = top_k > 0 && top_k < F ? top_k : F;
+  sampler->top_p = top_p;
+  sampler->probs = get_zero_vector(F);
+  sampler->order = e_calloc(F, sizeof(int));
+  sampler->alias_prob = get_zero_vector(F);
+  sampler->alias = e_calloc(F, sizeof(int));
+
+  sampler_seed(sampler, seed);
+
+  return sampler;
+}
+
+void sampler_free(sampler_t *sampler)
+{
+  free_vector(&sampler->probs);
+  free_vector(&sampler->alias_prob);
+  free(sampler->order);
+  free(sampler->alias);
+  free(sampler);
+}
+
+static int sampler_argmax(const double *values, int F)
+{
+  int i = 1, best = 0;
+
+  while ( i < F ) {
+    if ( values[i] > values[best] )
+      best = i;
+    ++i;
+  }
+
+  return best;
+}
+
+// Partial selection, afterwards order[0, k) holds the k largest keys
+static void sampler_select(int *order, const double *keys, int n, int k)
+{
+  int lo = 0, hi = n - 1, i, j, tmp;
+  double pivot;
+
+  while ( lo < hi ) {
+    pivot = keys[order[(lo + hi) / 2]];
+    i = lo;
+    j = hi;
+
+    while ( i <= j ) {
+      while ( keys[order[i]] > pivot )
+        ++i;
+      while ( keys[order[j]] < pivot )
+        --j;
+      if ( i <= j ) {
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+        ++i;
+        --j;
+      }
+    }
+
+    if ( k - 1 <= j )
+      hi = j;
+    else if ( k - 1 >= i )
+      lo = i;
+    else
+      break;
+  }
+}
+
+/*
+* The candidates of the distribution to draw from. Afterwards
+* order[0, count) holds the candidates and probs their unnormalized
+* weights, summing to sampler->total.
+*/
+static int sampler_candidates(sampler_t *sampler, const double *logits)
+{
+  int F = sampler->F, count = F, i = 0, n;
+  double inv_temp = 1.0 / sampler->temperature, max, sum = 0.0;
+  double *probs = sampler->probs;
+  int *order = sampler->order;
+
+  while ( i < F ) {
+    order[i] = i;
+    ++i;
+  }
+
+  if ( sampler->mode == SAMPLER_TOP_K ) {
+    count = sampler->top_k;
+    sampler_select(order, logits, F, count);
+  }
+
+  max = logits[order[0]];
+  i = 1;
+  while ( i < count ) {
+    if ( logits[order[i]] > max )
+      max = logits[order[i]];
+    ++i;
+  }
+
+  i = 0;
+  while ( i < count ) {
+    n = order[i];
+    probs[n] = exp((logits[n] - max) * inv_temp);
+    sum += probs[n];
+    ++i;
+  }
+
+  if ( sampler->mode == SAMPLER_TOP_P && sampler->top_p > 0.0 && sampler->top_p < 1.0 ) {
+    // Keep the k most probable of the remaining order[count, count + rest)
+    // while they fall short of the mass, doubling k, and halve k once
+    // they hold more than is missing
+    double target = sampler->top_p * sum, kept = 0.0, mass;
+    int k = 1, rest = F;
+
+    count = 0;
+    while ( rest > 0 && kept < target ) {
+      if ( k > rest )
+        k = rest;
+      if ( k < rest )
+        sampler_select(order + count, probs, rest, k);
+
+      mass = 0.0;
+      i = count;
+      while ( i < count + k ) {
+        mass += probs[order[i]];
+        ++i;
+      }
+
+      if ( kept + mass < target || k == 1 ) {
+        kept += mass;
+        count += k;
+        rest -= k;
+        k *= 2;
+      } else {
+        rest = k;
+        k /= 2;
+      }
+    }
+    sum = kept;
+  }
+
+  sampler->total = sum;
+  return count;
+}
+
+int sampler_sample(sampler_t *sampler, const double *logits)
+{
+  int count, i = 0;
+  double random_value, cumulative = 0.0;
+
+  if ( sampler->mode == SAMPLER_GREEDY )
+    return sampler_argmax(logits, sampler->F);
+
+  count = sampler_candidates(sampler, logits);
+  random_value = sampler_uniform(sampler) * sampler->total;
+
+  while ( i < count ) {
+    cumulative += sampler->probs[sampler->order[i]];
+    if ( cumulative > random_value )
+      return sampler->order[i];
+    ++i;
+  }
+
+  return sampler->order[count - 1];
+}
+
+int sampler_choice(sampler_t *sampler, const double *probs, int F)
+{
+  double random_value = sampler_uniform(sampler), sum = 0.0;
+  int i = 0;
+
+  while ( i < F ) {
+    sum += probs[i];
+    if ( sum > random_value )
+      return i;
+    ++i;
+  }
+
+  return F - 1;
+}
+
+void sampler_alias_build(sampler_t *sampler, const double *logits)
+{
+  int F = sampler->F, count, i, small = 0, large, s, l;
+  double *scaled = sampler->alias_prob;
+  int *stack = sampler->order;
+
+  if ( sampler->mode == SAMPLER_GREEDY ) {
+    // Every draw is the argmax
+    l = sampler_argmax(logits, F);
+    i = 0;
+    while ( i < F ) {
+      scaled[i] = 0.0;
+      sampler->alias[i] = l;
+      ++i;
+    }
+    return;
+  }
+
+  count = sampler_candidates(sampler, logits);
+
+  // Scaled weights, non-candidates have none
+  i = 0;
+  while ( i < F ) {
+    scaled[i] = 0.0;
+    sampler->alias[i] = i;
+    ++i;
+  }
+  i = 0;
+  while ( i < count ) {
+    scaled[sampler->order[i]] = sampler->probs[sampler->order[i]] * F / sampler->total;
+    ++i;
+  }
+
+  // Vose's method, small entries are stacked from the front, large from the back
+  large = F;
+  i = 0;
+  while ( i < F ) {
+    if ( scaled[i] < 1.0 )
+      stack[small++] = i;
+    else
+      stack[--large] = i;
+    ++i;
+  }
+
+  while ( small > 0 && large < F ) {
+    s = stack[--small];
+    l = stack[large];
+    sampler->alias[s] = l;
+    scaled[l] -= 1.0 - scaled[s];
+    if ( scaled[l] < 1.0 ) {
+      ++large;
+      stack[small++] = l;
+    }
+  }
+
+  // What is left is one up to rounding
+  while ( large < F )
+    scaled[stack[large++]] = 1.0;
+  while ( small > 0 )
+    scaled[stack[--small]] = 1.0;
+}
+
+int sampler_alias_draw(sampler_t *sampler)
+{
+  double u = sampler_uniform(sampler) * sampler->F;
+  int i = (int) u;
+
+  if ( i >= sampler->F )
+    i = sampler->F - 1;
+
+  return u - i < sampler->alias_prob[i] ? i : sampler->alias[i];
+}
+
+int sampler_mode_from_name(const char *name)
+{
+  if ( !strcmp(name, "multinomial") )
+    return SAMPLER_MULTINOMIAL;
+  if ( !strcmp(name, "greedy") )
+    return SAMPLER_GREEDY;
+  if ( !strcmp(name, "topk") )
+    return SAMPLER_TOP_K;
+  if ( !strcmp(name, "topp") )
+    return SAMPLER_TOP_P;
+  return -1;
+}
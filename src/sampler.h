@@ -0,0 +1,107 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file sampler.h
+    \brief Choosing the next feature from the network output
+
+    A sampler turns the logits of the output layer into the index
+    of the next feature. Every sampler has a random number generator
+    of its own, so samplers in different sessions do not share state.
+*/
+
+#ifndef LSTM_SAMPLER_H
+#define LSTM_SAMPLER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#define SAMPLER_MULTINOMIAL                   0
+#define SAMPLER_GREEDY                        1
+#define SAMPLER_TOP_K                         2
+#define SAMPLER_TOP_P                         3
+
+typedef struct sampler_t {
+  int mode;             /**< One of the SAMPLER_* defines */
+  int F;                /**< Number of features */
+  int top_k;            /**< Candidates kept with \ref SAMPLER_TOP_K */
+  double top_p;         /**< Probability mass kept with \ref SAMPLER_TOP_P */
+  double temperature;   /**< Logits are divided by this before softmax */
+  uint64_t state;       /**< xorshift64* state, never zero */
+  double total;         /**< Sum of the candidate weights in \ref sampler_t.probs */
+  double *probs;        /**< Candidate weights, length F */
+  int *order;           /**< Candidate indices, length F */
+  double *alias_prob;   /**< Alias table, length F */
+  int *alias;           /**< Alias table, length F */
+} sampler_t;
+
+/**
+* Allocate a sampler.
+* @param F number of features, the length of the logits
+* @param mode one of the SAMPLER_* defines
+* @param temperature the logits are divided by this value, the lower the spikier
+* @param top_k candidates kept with \ref SAMPLER_TOP_K
+* @param top_p probability mass kept with \ref SAMPLER_TOP_P
+* @param seed seed of the random number generator, 0 picks one
+* @return the sampler, free it with \ref sampler_free
+*/
+sampler_t* sampler_init(int F, int mode, double temperature, int top_k,
+  double top_p, unsigned long seed);
+/** Free a sampler allocated with \ref sampler_init */
+void sampler_free(sampler_t *sampler);
+/** Reseed the random number generator, 0 picks a seed */
+void sampler_seed(sampler_t *sampler, unsigned long seed);
+/** Uniformly distributed value in [0, 1) */
+double sampler_uniform(sampler_t *sampler);
+/**
+* Choose the next feature.
+* @param sampler the sampler
+* @param logits output layer values, length F
+* @return feature index
+*/
+int sampler_sample(sampler_t *sampler, const double *logits);
+/**
+* Draw from an explicit distribution.
+* @param sampler the sampler, only its random number generator is used
+* @param probs probabilities, summing to one
+* @param F length of \p probs
+* @return index
+*/
+int sampler_choice(sampler_t *sampler, const double *probs, int F);
+/**
+* Build an alias table of the distribution \ref sampler_sample would draw from,
+* so that repeated draws with \ref sampler_alias_draw take constant time.
+* @param sampler the sampler
+* @param logits output layer values, length F
+*/
+void sampler_alias_build(sampler_t *sampler, const double *logits);
+/** Draw from the table built by \ref sampler_alias_build */
+int sampler_alias_draw(sampler_t *sampler);
+/**
+* Parse a sampler name: multinomial, greedy, topk or topp.
+* @return one of the SAMPLER_* defines, negative if unknown
+*/
+int sampler_mode_from_name(const char *name);
+
+#endif
@@ -0,0 +1,549 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "score.h"
+#include "trace.h"
+
+#ifndef WINDOWS
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define SCORE_LINES_MAX_THREADS     256
+
+typedef struct score_chunk_t {
+  lstm_session_t *session;
+  set_t *set;
+  const char *text;
+  size_t begin;             // First scored character
+  size_t end;               // One past the last scored character
+  size_t warmup;
+  float *log_probs;
+  lstm_score_result_t result;
+} score_chunk_t;
+
+static void score_chunk(score_chunk_t *chunk)
+{
+  lstm_session_t *session = chunk->session;
+  int Y = session->model[0]->Y, target;
+  size_t i = chunk->begin > chunk->warmup + 1 ? chunk->begin - 1 - chunk->warmup : 0;
+  double *logits, log_prob, begin = trace_begin();
+
+  while ( i + 1 < chunk->begin ) {
+    lstm_session_step(session, set_char_to_indx(chunk->set, chunk->text[i]));
+    ++i;
+  }
+
+  i = chunk->begin;
+  while ( i < chunk->end ) {
+    logits = lstm_session_step(session, set_char_to_indx(chunk->set, chunk->text[i - 1]));
+    target = set_char_to_indx(chunk->set, chunk->text[i]);
+
+    if ( target >= 0 && target < Y ) {
+      log_prob = log_softmax(logits, Y, target);
+      chunk->result.nll -= log_prob;
+      chunk->result.count++;
+    } else {
+      log_prob = NAN;
+    }
+
+    if ( chunk->log_probs != NULL )
+      chunk->log_probs[i - 1] = (float) log_prob;
+    ++i;
+  }
+
+  trace_end("score chunk", -1, begin);
+}
+
+#ifndef WINDOWS
+static void *score_chunk_thread(void *arg)
+{
+  trace_thread_name("score");
+  score_chunk((score_chunk_t*) arg);
+  return NULL;
+}
+#endif
+
+int lstm_score(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *text, size_t length, int threads, size_t warmup,
+  float *log_probs, lstm_score_result_t *result)
+{
+  score_chunk_t *chunks;
+  size_t per_chunk;
+  int c = 0;
+#ifndef WINDOWS
+  pthread_t *workers;
+#endif
+
+  result->nll = 0.0;
+  result->count = 0;
+
+  if ( length < 2 )
+    return 0;
+
+  if ( threads <= 0 )
+    threads = 1;
+  if ( (size_t) threads > length - 1 )
+    threads = (int) (length - 1);
+
+  chunks = e_calloc(threads, sizeof(score_chunk_t));
+  per_chunk = (length - 1 + threads - 1) / threads;
+
+  while ( c < threads ) {
+    chunks[c].session = lstm_session_init(model_layers, layers);
+    chunks[c].set = set;
+    chunks[c].text = text;
+    chunks[c].begin = 1 + c * per_chunk < length ? 1 + c * per_chunk : length;
+    chunks[c].end = chunks[c].begin + per_chunk < length ? chunks[c].begin + per_chunk : length;
+    chunks[c].warmup = warmup;
+    chunks[c].log_probs = log_probs;
+    ++c;
+  }
+
+#ifdef WINDOWS
+  c = 0;
+  while ( c < threads ) {
+    score_chunk(&chunks[c]);
+    ++c;
+  }
+#else
+  workers = e_calloc(threads, sizeof(pthread_t));
+
+  c = 1;
+  while ( c < threads ) {
+    if ( pthread_create(&workers[c], NULL, score_chunk_thread, &chunks[c]) != 0 ) {
+      fprintf(stderr, "%s error: could not start a thread\n", __func__);
+      exit(1);
+    }
+    ++c;
+  }
+
+  score_chunk(&chunks[0]);
+
+  c = 1;
+  while ( c < threads ) {
+    pthread_join(workers[c], NULL);
+    ++c;
+  }
+
+  free(workers);
+#endif
+
+  // Summed in chunk order, so the result does not depend on scheduling
+  c = 0;
+  while ( c < threads ) {
+    result->nll += chunks[c].result.nll;
+    result->count += chunks[c].result.count;
+    lstm_session_free(chunks[c].session);
+    ++c;
+  }
+
+  free(chunks);
+  return 0;
+}
+
+#define SCORE_LINES_READ_CHUNK      (1 << 20)
+
+typedef struct score_record_t {
+  const char *text;
+  size_t length;
+  size_t count;             // Characters found in the feature set
+  double nll;
+} score_record_t;
+
+typedef struct score_worker_t {
+  lstm_batch_t *batch;
+  set_t *set;
+  int policy;
+  int newline;              // Feature index of '\n', input before a record
+  int *record;              // Record index of each row
+  size_t *pos;              // Next character to score in each row
+  int *inputs;
+  score_record_t *records;
+  int begin;                // Records [begin, end) of the current block
+  int end;
+  struct score_pool_t *pool;
+} score_worker_t;
+
+/*
+* Workers started once for all blocks. The calling thread scores the
+* records of workers[0], threads[1..] wait for the next block between
+* blocks.
+*/
+typedef struct score_pool_t {
+  score_worker_t *workers;
+  int threads;
+#ifndef WINDOWS
+  pthread_t handles[SCORE_LINES_MAX_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t start;     // A block is handed out, or stop is set
+  pthread_cond_t done;      // pending reached 0
+  unsigned long block;      // Blocks handed out
+  int pending;              // Workers still scoring the block
+  int stop;
+#endif
+} score_pool_t;
+
+static void score_worker_assign(score_worker_t *worker, int row, int record)
+{
+  worker->record[row] = record;
+  worker->pos[row] = 0;
+  worker->inputs[row] = worker->newline;
+  if ( worker->policy == SCORE_STATE_RESET )
+    lstm_batch_reset_row(worker->batch, row);
+}
+
+// Scores the records of a worker, rows are refilled as records finish
+static void score_worker_run(score_worker_t *worker)
+{
+  lstm_batch_t *batch = worker->batch;
+  score_record_t *records = worker->records;
+  int Y = batch->model[0]->Y, rows = 0, next = worker->begin, r, target;
+  double *logits;
+
+  while ( next < worker->end && records[next].length == 0 ) {
+    records[next].nll = NAN;
+    ++next;
+  }
+
+  while ( rows < batch->capacity && next < worker->end ) {
+    score_worker_assign(worker, rows++, next++);
+    while ( next < worker->end && records[next].length == 0 ) {
+      records[next].nll = NAN;
+      ++next;
+    }
+  }
+
+  while ( rows > 0 ) {
+    logits = lstm_batch_step(batch, worker->inputs, rows);
+
+    r = 0;
+    while ( r < rows ) {
+      score_record_t *record = &records[worker->record[r]];
+      char c = record->text[worker->pos[r]];
+
+      target = set_char_to_indx(worker->set, c);
+      if ( target >= 0 && target < Y ) {
+        record->nll -= log_softmax(&logits[r * Y], Y, target);
+        record->count++;
+      }
+      worker->inputs[r] = target;
+
+      if ( ++worker->pos[r] < record->length ) {
+        ++r;
+        continue;
+      }
+
+      // Done, the mean over the record
+      record->nll = record->count > 0 ? record->nll / record->count : NAN;
+
+      if ( worker->policy == SCORE_STATE_CARRY ) {
+        // The state after the record is kept, it is fed the newline next
+        if ( next < worker->end ) {
+          score_worker_assign(worker, r, next++);
+          while ( next < worker->end && records[next].length == 0 ) {
+            records[next].nll = NAN;
+            ++next;
+          }
+          ++r;
+          continue;
+        }
+        --rows;
+        continue;
+      }
+
+      if ( next < worker->end ) {
+        score_worker_assign(worker, r, next++);
+        while ( next < worker->end && records[next].length == 0 ) {
+          records[next].nll = NAN;
+          ++next;
+        }
+        ++r;
+      } else {
+        // Move the last row here
+        --rows;
+        if ( r < rows ) {
+          lstm_batch_copy_row(batch, r, rows);
+          worker->record[r] = worker->record[rows];
+          worker->pos[r] = worker->pos[rows];
+          worker->inputs[r] = worker->inputs[rows];
+        }
+      }
+    }
+  }
+}
+
+#ifndef WINDOWS
+// Scores every block handed out until the pool is stopped
+static void *score_worker_thread(void *arg)
+{
+  score_worker_t *worker = (score_worker_t*) arg;
+  score_pool_t *pool = worker->pool;
+  unsigned long seen = 0;
+
+  trace_thread_name("score");
+  pthread_mutex_lock(&pool->lock);
+  while ( 1 ) {
+    while ( !pool->stop && pool->block == seen )
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if ( pool->stop )
+      break;
+    seen = pool->block;
+    pthread_mutex_unlock(&pool->lock);
+
+    score_worker_run(worker);
+
+    pthread_mutex_lock(&pool->lock);
+    if ( --pool->pending == 0 )
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+#endif
+
+static void score_pool_start(score_pool_t *pool, score_worker_t *workers, int threads)
+{
+  int w = 0;
+
+  pool->workers = workers;
+  pool->threads = threads;
+  while ( w < threads )
+    workers[w++].pool = pool;
+
+#ifndef WINDOWS
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->block = 0;
+  pool->pending = 0;
+  pool->stop = 0;
+
+  w = 1;
+  while ( w < threads ) {
+    if ( pthread_create(&pool->handles[w], NULL, score_worker_thread, &workers[w]) != 0 ) {
+      fprintf(stderr, "%s error: could not start a thread\n", __func__);
+      exit(1);
+    }
+    ++w;
+  }
+#endif
+}
+
+static void score_pool_stop(score_pool_t *pool)
+{
+#ifndef WINDOWS
+  int w = 1;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  while ( w < pool->threads ) {
+    pthread_join(pool->handles[w], NULL);
+    ++w;
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+#else
+  (void) pool;
+#endif
+}
+
+// Splits the records of a block over the workers and scores them
+static void score_lines_block(score_pool_t *pool, score_record_t *records, int count)
+{
+  score_worker_t *workers = pool->workers;
+  int threads = pool->threads, per_worker = (count + threads - 1) / threads, w = 0;
+
+  // Workers past the end get no records
+  while ( w < threads ) {
+    workers[w].records = records;
+    workers[w].begin = w * per_worker < count ? w * per_worker : count;
+    workers[w].end = (w + 1) * per_worker < count ? (w + 1) * per_worker : count;
+    ++w;
+  }
+
+#ifdef WINDOWS
+  w = 0;
+  while ( w < threads ) {
+    score_worker_run(&workers[w]);
+    ++w;
+  }
+#else
+  pthread_mutex_lock(&pool->lock);
+  pool->pending = threads - 1;
+  pool->block++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  score_worker_run(&workers[0]);
+
+  pthread_mutex_lock(&pool->lock);
+  while ( pool->pending > 0 )
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+long lstm_score_lines(lstm_model_t **model_layers, int layers, set_t *set,
+  FILE *in, writer_t *writer, int threads, int rows, int policy)
+{
+  score_worker_t *workers;
+  score_pool_t pool;
+  score_record_t *records = NULL;
+  size_t capacity = SCORE_LINES_READ_CHUNK, used = 0, start, i, bytes;
+  int record_capacity = 0, count, w, at_end = 0;
+  long scored = 0;
+  char *buffer, result[64];
+
+  if ( policy == SCORE_STATE_CARRY ) {
+    threads = 1;
+    rows = 1;
+  }
+  if ( threads <= 0 )
+    threads = 1;
+  if ( threads > SCORE_LINES_MAX_THREADS )
+    threads = SCORE_LINES_MAX_THREADS;
+  if ( rows <= 0 )
+    rows = 1;
+
+  workers = e_calloc(threads, sizeof(score_worker_t));
+  w = 0;
+  while ( w < threads ) {
+    workers[w].batch = lstm_batch_init(model_layers, layers, rows);
+    workers[w].set = set;
+    workers[w].policy = policy;
+    workers[w].newline = set_char_to_indx(set, '\n');
+    workers[w].record = e_calloc(rows, sizeof(int));
+    workers[w].pos = e_calloc(rows, sizeof(size_t));
+    workers[w].inputs = e_calloc(rows, sizeof(int));
+    ++w;
+  }
+
+  score_pool_start(&pool, workers, threads);
+  buffer = e_calloc(capacity, 1);
+
+  while ( !at_end ) {
+    if ( used == capacity ) {
+      // A record longer than the buffer
+      char *grown = e_calloc(capacity * 2, 1);
+      memcpy(grown, buffer, used);
+      free(buffer);
+      buffer = grown;
+      capacity *= 2;
+    }
+
+#ifdef WINDOWS
+    bytes = fread(buffer + used, 1, capacity - used, in);
+#else
+    {
+      // Whatever is available, so records are scored as they arrive
+      ssize_t got;
+      do {
+        got = read(fileno(in), buffer + used, capacity - used);
+      } while ( got < 0 && errno == EINTR );
+      bytes = got > 0 ? (size_t) got : 0;
+    }
+#endif
+    used += bytes;
+    if ( bytes == 0 ) {
+      at_end = 1;
+      // The last record may lack its newline
+      if ( used > 0 && buffer[used - 1] != '\n' ) {
+        if ( used == capacity ) {
+          char *grown = e_calloc(capacity + 1, 1);
+          memcpy(grown, buffer, used);
+          free(buffer);
+          buffer = grown;
+          capacity += 1;
+        }
+        buffer[used++] = '\n';
+      }
+    }
+
+    // The complete records in the buffer form a block
+    count = 0;
+    start = 0;
+    i = 0;
+    while ( i < used ) {
+      if ( buffer[i] == '\n' ) {
+        if ( count == record_capacity ) {
+          score_record_t *grown;
+          record_capacity = record_capacity > 0 ? record_capacity * 2 : 1024;
+          grown = e_calloc(record_capacity, sizeof(score_record_t));
+          if ( records != NULL ) {
+            memcpy(grown, records, count * sizeof(score_record_t));
+            free(records);
+          }
+          records = grown;
+        }
+        records[count].text = buffer + start;
+        records[count].length = i - start;
+        records[count].count = 0;
+        records[count].nll = 0.0;
+        ++count;
+        start = i + 1;
+      }
+      ++i;
+    }
+
+    if ( count == 0 )
+      continue;
+
+    score_lines_block(&pool, records, count);
+
+    w = 0;
+    while ( w < count ) {
+      int len = snprintf(result, sizeof(result), "%lf\n", records[w].nll);
+      writer_write(writer, result, len);
+      ++w;
+    }
+    writer_flush(writer);
+    scored += count;
+
+    // Keep the incomplete record
+    memmove(buffer, buffer + start, used - start);
+    used -= start;
+  }
+
+  score_pool_stop(&pool);
+
+  w = 0;
+  while ( w < threads ) {
+    lstm_batch_free(workers[w].batch);
+    free(workers[w].record);
+    free(workers[w].pos);
+    free(workers[w].inputs);
+    ++w;
+  }
+  free(workers);
+  free(records);
+  free(buffer);
+
+  return scored;
+}
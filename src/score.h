@@ -0,0 +1,94 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file score.h
+    \brief Scoring text with a trained network
+
+    Runs a network over a text without backpropagation and sums the
+    negative log-likelihood of every character given the ones before it.
+*/
+
+#ifndef LSTM_SCORE_H
+#define LSTM_SCORE_H
+
+#include "lstm.h"
+#include "set.h"
+#include "utilities.h"
+
+#define SCORE_STATE_RESET                     0
+#define SCORE_STATE_CARRY                     1
+
+typedef struct lstm_score_result_t {
+  double nll;                /**< Summed negative log-likelihood, in nats */
+  unsigned long count;       /**< Number of scored characters */
+} lstm_score_result_t;
+
+/**
+* Score a text, split in chunks that are scored in parallel.
+*
+* Character i is scored given characters [0, i), the first character
+* is not scored. Every chunk but the first starts from a zero state
+* and is warmed up on the \p warmup characters before it, these are
+* not scored again. Characters missing from \p set are not scored.
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @param set The feature-to-index mapping.
+* @param text the text
+* @param length length of \p text
+* @param threads number of chunks scored in parallel
+* @param warmup characters fed before each chunk
+* @param log_probs if not NULL, the natural log probability of every \
+character is written here, length - 1 values, NAN if not scored
+* @param result the summed negative log-likelihood and number of scored characters
+* @return 0 on success, negative values on errors
+*/
+int lstm_score(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *text, size_t length, int threads, size_t warmup,
+  float *log_probs, lstm_score_result_t *result);
+
+/**
+* Score newline separated records read from a stream.
+*
+* For every record the mean negative log-likelihood of its characters
+* is written to \p writer, one line per record in input order ("nan" for
+* records without known characters). The first character of a record is
+* scored given a newline. Empty records are not fed through the network. Records are read in blocks. With \ref SCORE_STATE_RESET every
+* record starts from a zero state, so the records of a block are spread
+* over \p threads threads and \p rows batch rows per thread. The threads
+* are started once and wait for the next block in between. With
+* \ref SCORE_STATE_CARRY the state is carried over from the previous
+* record, records are then scored one after another.
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @param set The feature-to-index mapping.
+* @param in records are read from here until end of file
+* @param writer results are written here
+* @param threads number of threads
+* @param rows number of records each thread runs through the network together
+* @param policy \ref SCORE_STATE_RESET or \ref SCORE_STATE_CARRY
+* @return number of records scored, negative values on errors
+*/
+long lstm_score_lines(lstm_model_t **model_layers, int layers, set_t *set,
+  FILE *in, writer_t *writer, int threads, int rows, int policy);
+
+#endif
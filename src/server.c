@@ -0,0 +1,540 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "server.h"
+
+#ifdef WINDOWS
+
+int lstm_serve(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *address, int max_batch, prefix_cache_t *cache)
+{
+  (void) model_layers; (void) layers; (void) set;
+  (void) address; (void) max_batch; (void) cache;
+  fprintf(stderr, "%s error: serving is not supported on this platform.\n",
+    __func__);
+  return -1;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SERVER_MAX_CLIENTS          256
+#define SERVER_MAX_LINE             65536
+#define SERVER_READ_CHUNK           4096
+
+enum {
+  REQUEST_NONE = 0,
+  REQUEST_GENERATE,
+  REQUEST_SCORE
+};
+
+typedef struct server_client_t {
+  int fd;
+  int closing;                  // close once the output is written
+  char *in;                     // received bytes, not yet parsed
+  size_t in_len;
+  char *out;                    // bytes to send
+  size_t out_len;
+  size_t out_cap;
+
+  // The active request
+  int request;
+  int row;                      // row in the batch, -1 while waiting for one
+  char *text;                   // seed or text to score
+  size_t text_len;
+  size_t pos;                   // characters of text fed so far
+  int remaining;                // characters left to generate
+  int last;                     // last generated character
+  char *gen;                    // generated characters
+  size_t gen_len;
+  double nll;
+  long scored;
+} server_client_t;
+
+typedef struct server_t {
+  lstm_model_t **model;
+  int layers;
+  set_t *set;
+  lstm_batch_t *batch;
+  int max_batch;
+  int rows;                     // rows in use
+  int *row_owner;               // client using each row
+  int *inputs;                  // input index of each row
+  double *probs;                // softmax scratch
+  sampler_t *sampler;           // chooses generated characters
+  prefix_cache_t *cache;        // seed prefix states, may be NULL
+  double *state;                // room for one state
+  server_client_t clients[SERVER_MAX_CLIENTS];
+  int nbr_clients;
+} server_t;
+
+static void server_out_append(server_client_t *client, const char *data, size_t len)
+{
+  if ( client->out_len + len > client->out_cap ) {
+    size_t cap = client->out_cap ? client->out_cap : SERVER_READ_CHUNK;
+    while ( cap < client->out_len + len )
+      cap *= 2;
+    client->out = realloc(client->out, cap);
+    if ( client->out == NULL ) {
+      fprintf(stderr, "%s error: failed to allocate %zu bytes\n", __func__, cap);
+      exit(1);
+    }
+    client->out_cap = cap;
+  }
+  memcpy(&client->out[client->out_len], data, len);
+  client->out_len += len;
+}
+
+static void server_reply(server_client_t *client, const char *fmt_msg)
+{
+  server_out_append(client, fmt_msg, strlen(fmt_msg));
+}
+
+static int server_listen(const char *address)
+{
+  int fd, one = 1;
+
+  if ( !strncmp(address, "unix:", 5) ) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( strlen(address + 5) >= sizeof(addr.sun_path) ) {
+      fprintf(stderr, "%s error: socket path too long: %s\n", __func__, address + 5);
+      return -1;
+    }
+    strcpy(addr.sun_path, address + 5);
+    unlink(addr.sun_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ) {
+      fprintf(stderr, "%s error: failed to bind %s: %s\n", __func__,
+        address, strerror(errno));
+      return -1;
+    }
+  } else {
+    struct sockaddr_in addr;
+    int port = atoi(address);
+
+    if ( port <= 0 || port > 65535 ) {
+      fprintf(stderr, "%s error: invalid port: %s\n", __func__, address);
+      return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short) port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ( fd >= 0 )
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if ( fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ) {
+      fprintf(stderr, "%s error: failed to bind port %d: %s\n", __func__,
+        port, strerror(errno));
+      return -1;
+    }
+  }
+
+  if ( listen(fd, 64) < 0 ) {
+    fprintf(stderr, "%s error: listen failed: %s\n", __func__, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return fd;
+}
+
+static void server_request_clear(server_client_t *client)
+{
+  free(client->text);
+  free(client->gen);
+  client->text = NULL;
+  client->gen = NULL;
+  client->request = REQUEST_NONE;
+  client->row = -1;
+}
+
+// Releases the batch row held by a client, moving the last row into its place
+static void server_release_row(server_t *server, server_client_t *client)
+{
+  int row = client->row, last = server->rows - 1;
+
+  if ( row < 0 )
+    return;
+
+  if ( row != last ) {
+    lstm_batch_copy_row(server->batch, row, last);
+    server->row_owner[row] = server->row_owner[last];
+    server->clients[server->row_owner[row]].row = row;
+  }
+
+  server->rows--;
+  client->row = -1;
+}
+
+static void server_client_close(server_t *server, int c)
+{
+  server_client_t *client = &server->clients[c];
+
+  server_release_row(server, client);
+  server_request_clear(client);
+  close(client->fd);
+  free(client->in);
+  free(client->out);
+
+  // Keep the clients packed, moving the last one into this slot
+  --server->nbr_clients;
+  if ( c != server->nbr_clients ) {
+    *client = server->clients[server->nbr_clients];
+    if ( client->row >= 0 )
+      server->row_owner[client->row] = c;
+  }
+}
+
+// Parse one request line, returns 0 if a request was started
+static int server_request_start(server_t *server, server_client_t *client, char *line)
+{
+  char *text = NULL;
+
+  if ( !strncmp(line, "GEN ", 4) ) {
+    char *end;
+    long count = strtol(line + 4, &end, 10);
+
+    if ( end == line + 4 || count <= 0 || count > SERVER_MAX_LINE ) {
+      server_reply(client, "ERR expected: GEN <count> <seed>\n");
+      return -1;
+    }
+    if ( *end == ' ' )
+      ++end;
+
+    client->request = REQUEST_GENERATE;
+    client->remaining = (int) count;
+    client->gen = malloc(count);
+    client->gen_len = 0;
+    text = end;
+  } else if ( !strncmp(line, "SCORE ", 6) ) {
+    client->request = REQUEST_SCORE;
+    client->nll = 0.0;
+    client->scored = 0;
+    text = line + 6;
+  } else if ( !strcmp(line, "QUIT") ) {
+    client->closing = 1;
+    return -1;
+  } else {
+    server_reply(client, "ERR unknown request\n");
+    return -1;
+  }
+
+  client->text_len = strlen(text);
+  client->text = malloc(client->text_len + 1);
+  if ( client->text == NULL || ( client->request == REQUEST_GENERATE && client->gen == NULL ) ) {
+    fprintf(stderr, "%s error: failed to allocate request\n", __func__);
+    exit(1);
+  }
+  memcpy(client->text, text, client->text_len + 1);
+  client->pos = 0;
+  client->row = -1;
+
+  if ( client->request == REQUEST_SCORE && client->text_len < 2 ) {
+    server_reply(client, "OK 0.000000 0 0.000000\n");
+    server_request_clear(client);
+    return -1;
+  }
+
+  (void) server;
+  return 0;
+}
+
+static void server_request_finish(server_client_t *client)
+{
+  char header[128];
+
+  if ( client->request == REQUEST_GENERATE ) {
+    snprintf(header, sizeof(header), "OK %zu\n", client->gen_len);
+    server_reply(client, header);
+    server_out_append(client, client->gen, client->gen_len);
+  } else {
+    snprintf(header, sizeof(header), "OK %.6lf %ld %.6lf\n", client->nll, client->scored,
+      client->scored > 0 ? client->nll / client->scored / log(2.0) : 0.0);
+    server_reply(client, header);
+  }
+}
+
+// The input of a row for the coming step
+static int server_next_input(server_t *server, server_client_t *client)
+{
+  if ( client->pos < client->text_len )
+    return set_char_to_indx(server->set, client->text[client->pos]);
+  if ( client->request == REQUEST_GENERATE && client->text_len == 0 && client->gen_len == 0 )
+    return 0;
+  return set_char_to_indx(server->set, (char) client->last);
+}
+
+// Handle the output of a step for one row, returns 1 when the request is done
+static int server_step_done(server_t *server, server_client_t *client, double *logits)
+{
+  lstm_model_t *output_layer = server->model[0];
+  int Y = output_layer->Y;
+
+  if ( client->pos < client->text_len ) {
+    client->pos++;
+
+    if ( server->cache != NULL && client->request == REQUEST_GENERATE &&
+      ( client->pos % server->cache->interval == 0 || client->pos + 1 == client->text_len ) ) {
+      lstm_batch_get_state(server->batch, client->row, server->state);
+      prefix_cache_insert(server->cache, client->text, client->pos, server->state);
+    }
+  }
+
+  if ( client->request == REQUEST_SCORE ) {
+    if ( client->pos < client->text_len ) {
+      int target = set_char_to_indx(server->set, client->text[client->pos]);
+      if ( target >= 0 && target < Y ) {
+        softmax_layers_forward(server->probs, logits, Y, output_layer->params->softmax_temp);
+        client->nll += cross_entropy(server->probs, target);
+        client->scored++;
+      }
+    }
+    return client->pos + 1 >= client->text_len;
+  }
+
+  if ( client->pos < client->text_len )
+    return 0; // Still feeding the seed
+
+  client->last = set_indx_to_char(server->set, sampler_sample(server->sampler, logits));
+  client->gen[client->gen_len++] = (char) client->last;
+  client->remaining--;
+
+  return client->remaining <= 0;
+}
+
+static void server_step(server_t *server)
+{
+  int r, c;
+  double *logits;
+  int Y = server->model[0]->Y;
+
+  // Requests waiting for a row get one if there is room
+  c = 0;
+  while ( c < server->nbr_clients && server->rows < server->max_batch ) {
+    server_client_t *client = &server->clients[c];
+    if ( client->request != REQUEST_NONE && client->row < 0 ) {
+      client->row = server->rows++;
+      server->row_owner[client->row] = c;
+      lstm_batch_reset_row(server->batch, client->row);
+
+      // At least one seed character is fed, it produces the first output
+      if ( server->cache != NULL && client->request == REQUEST_GENERATE && client->text_len > 1 ) {
+        client->pos = prefix_cache_lookup(server->cache, client->text,
+          client->text_len - 1, server->state);
+        if ( client->pos > 0 )
+          lstm_batch_set_state(server->batch, client->row, server->state);
+      }
+    }
+    ++c;
+  }
+
+  if ( server->rows == 0 )
+    return;
+
+  r = 0;
+  while ( r < server->rows ) {
+    server->inputs[r] = server_next_input(server,
+      &server->clients[server->row_owner[r]]);
+    ++r;
+  }
+
+  logits = lstm_batch_step(server->batch, server->inputs, server->rows);
+
+  // Walking backwards, finished rows are replaced by rows already handled
+  r = server->rows - 1;
+  while ( r >= 0 ) {
+    server_client_t *client = &server->clients[server->row_owner[r]];
+    if ( server_step_done(server, client, &logits[r * Y]) ) {
+      server_request_finish(client);
+      server_release_row(server, client);
+      server_request_clear(client);
+    }
+    --r;
+  }
+}
+
+// Start the next request of a client if there is a complete line
+static void server_parse(server_t *server, server_client_t *client)
+{
+  char *newline;
+
+  while ( client->request == REQUEST_NONE && !client->closing &&
+    ( newline = memchr(client->in, '\n', client->in_len) ) != NULL ) {
+    size_t line_len = newline - client->in;
+
+    *newline = '\0';
+    if ( line_len > 0 && client->in[line_len-1] == '\r' )
+      client->in[line_len-1] = '\0';
+
+    server_request_start(server, client, client->in);
+
+    memmove(client->in, newline + 1, client->in_len - line_len - 1);
+    client->in_len -= line_len + 1;
+  }
+
+  if ( client->in_len >= SERVER_MAX_LINE && client->request == REQUEST_NONE ) {
+    server_reply(client, "ERR line too long\n");
+    client->closing = 1;
+  }
+}
+
+int lstm_serve(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *address, int max_batch, prefix_cache_t *cache)
+{
+  server_t server;
+  struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+  int listen_fd, c;
+
+  listen_fd = server_listen(address);
+  if ( listen_fd < 0 )
+    return -1;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  memset(&server, 0, sizeof(server));
+  server.model = model_layers;
+  server.layers = layers;
+  server.set = set;
+  server.max_batch = max_batch;
+  server.batch = lstm_batch_init(model_layers, layers, max_batch);
+  server.row_owner = e_calloc(max_batch, sizeof(int));
+  server.inputs = e_calloc(max_batch, sizeof(int));
+  server.probs = get_zero_vector(model_layers[0]->Y);
+  server.sampler = lstm_sampler_init(model_layers[0]);
+  server.cache = cache;
+  server.state = get_zero_vector(lstm_state_size(model_layers, layers));
+
+  printf("Serving on %s, batching up to %d requests.\n", address, max_batch);
+  fflush(stdout);
+
+  while ( 1 ) {
+    int nfds = 0;
+
+    fds[nfds].fd = listen_fd;
+    fds[nfds].events = server.nbr_clients < SERVER_MAX_CLIENTS ? POLLIN : 0;
+    fds[nfds].revents = 0;
+    ++nfds;
+
+    c = 0;
+    while ( c < server.nbr_clients ) {
+      fds[nfds].fd = server.clients[c].fd;
+      fds[nfds].events = ( server.clients[c].in_len < SERVER_MAX_LINE ? POLLIN : 0 ) |
+        ( server.clients[c].out_len > 0 ? POLLOUT : 0 );
+      fds[nfds].revents = 0;
+      ++nfds;
+      ++c;
+    }
+
+    // Don't block while there is work to be done
+    if ( poll(fds, nfds, server.rows > 0 ? 0 : -1) < 0 && errno != EINTR ) {
+      fprintf(stderr, "%s error: poll failed: %s\n", __func__, strerror(errno));
+      break;
+    }
+
+    // Walking backwards, closed clients are replaced by clients already handled
+    c = server.nbr_clients - 1;
+    while ( c >= 0 ) {
+      server_client_t *client = &server.clients[c];
+      short revents = fds[c + 1].revents;
+      int closed = 0;
+
+      if ( revents & POLLIN ) {
+        ssize_t got = recv(client->fd, &client->in[client->in_len],
+          SERVER_MAX_LINE - client->in_len, 0);
+        if ( got > 0 )
+          client->in_len += got;
+        else if ( got == 0 || ( errno != EAGAIN && errno != EINTR ) )
+          closed = 1;
+      } else if ( revents & ( POLLHUP | POLLERR ) ) {
+        closed = 1;
+      }
+
+      if ( !closed && ( revents & POLLOUT ) && client->out_len > 0 ) {
+        ssize_t sent = send(client->fd, client->out, client->out_len, 0);
+        if ( sent > 0 ) {
+          memmove(client->out, client->out + sent, client->out_len - sent);
+          client->out_len -= sent;
+        } else if ( sent < 0 && errno != EAGAIN && errno != EINTR ) {
+          closed = 1;
+        }
+      }
+
+      if ( !closed ) {
+        server_parse(&server, client);
+        if ( client->closing && client->out_len == 0 && client->request == REQUEST_NONE )
+          closed = 1;
+      }
+
+      if ( closed )
+        server_client_close(&server, c);
+      --c;
+    }
+
+    if ( fds[0].revents & POLLIN ) {
+      int fd;
+      while ( server.nbr_clients < SERVER_MAX_CLIENTS &&
+        ( fd = accept(listen_fd, NULL, NULL) ) >= 0 ) {
+        server_client_t *client = &server.clients[server.nbr_clients++];
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        memset(client, 0, sizeof(*client));
+        client->fd = fd;
+        client->row = -1;
+        client->in = malloc(SERVER_MAX_LINE + 1);
+        if ( client->in == NULL ) {
+          fprintf(stderr, "%s error: failed to allocate client buffer\n", __func__);
+          exit(1);
+        }
+      }
+    }
+
+    server_step(&server);
+  }
+
+  close(listen_fd);
+  lstm_batch_free(server.batch);
+  free(server.row_owner);
+  free(server.inputs);
+  free_vector(&server.probs);
+  sampler_free(server.sampler);
+  free_vector(&server.state);
+  return -1;
+}
+
+#endif
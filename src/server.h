@@ -0,0 +1,63 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file server.h
+    \brief Serving a trained network over a socket
+
+    The network is loaded once and kept in memory. Requests from
+    all connected clients are run through it together, every
+    request holding one row of a \ref lstm_batch_t, so each step
+    is a single batched forward pass.
+*/
+
+#ifndef LSTM_SERVER_H
+#define LSTM_SERVER_H
+
+#include "lstm.h"
+#include "set.h"
+#include "prefix_cache.h"
+
+/**
+* Serve generation and scoring requests.
+*
+* The protocol is line based, one request per line:
+*
+*     GEN <count> <seed>  ->  "OK <bytes>\n" followed by <bytes> of generated text
+*     SCORE <text>        ->  "OK <total nll> <scored characters> <bits per character>\n"
+*     QUIT                ->  the connection is closed
+*
+* Failed requests are answered with "ERR <message>\n".
+* @param model_layers the network, must have been initialized
+* @param layers how many layers this network has
+* @param set The feature-to-index mapping.
+* @param address "unix:<path>" for a Unix domain socket, \
+otherwise a TCP port to listen to on localhost
+* @param max_batch at most this many requests are stepped together
+* @param cache generation requests resume from the deepest seed prefix \
+in this cache, NULL to feed every seed in full
+* @return only returns on errors, with a negative value
+*/
+int lstm_serve(lstm_model_t **model_layers, int layers, set_t *set,
+  const char *address, int max_batch, prefix_cache_t *cache);
+
+#endif
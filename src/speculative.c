@@ -0,0 +1,162 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "speculative.h"
+
+int lstm_speculative_output(lstm_model_t **model_layers, int layers,
+  lstm_model_t **draft_layers, int draft_layer_count, set_t *set,
+  const char *seed, int proposal, int length, writer_t *writer)
+{
+  lstm_batch_t *batch;
+  lstm_session_t *draft;
+  sampler_t *sampler;
+  double temperature = model_layers[0]->params->softmax_temp;
+  double *draft_probs, *draft_states, *probs, *logits;
+  int *inputs;
+  int Y = model_layers[0]->Y;
+  int draft_state_size, pending, generated = 0, j, n;
+  size_t i;
+
+  if ( proposal <= 0 || length <= 0 )
+    return -1;
+
+  if ( draft_layers[0]->Y != model_layers[0]->Y ||
+    draft_layers[draft_layer_count-1]->X != model_layers[layers-1]->X ) {
+    fprintf(stderr, "%s error: the draft network does not have the same features\n",
+      __func__);
+    return -1;
+  }
+
+  batch = lstm_batch_init(model_layers, layers, proposal + 1);
+  draft = lstm_session_init(draft_layers, draft_layer_count);
+  draft_state_size = (int) lstm_state_size(draft_layers, draft_layer_count);
+  draft_states = get_zero_vector(proposal * draft_state_size);
+  draft_probs = get_zero_vector(proposal * Y);
+  probs = get_zero_vector(Y);
+  inputs = e_calloc(proposal + 1, sizeof(int));
+  sampler = lstm_sampler_init(model_layers[0]);
+
+  /*
+  * Both networks have consumed all generated characters except the
+  * pending one, which is the first input of the next round.
+  */
+  writer_write(writer, seed, strlen(seed));
+  pending = 0;
+  i = 0;
+  while ( seed[i] != '\0' ) {
+    pending = set_char_to_indx(set, seed[i]);
+    if ( seed[i + 1] != '\0' ) {
+      lstm_batch_step(batch, &pending, 1);
+      lstm_session_step(draft, pending);
+    }
+    ++i;
+  }
+
+  while ( generated < length ) {
+    int accepted = 1, next = 0;
+
+    // The draft proposes
+    inputs[0] = pending;
+    j = 0;
+    while ( j < proposal ) {
+      double *q = &draft_probs[j * Y];
+
+      logits = lstm_session_step(draft, inputs[j]);
+      lstm_session_get_state(draft, &draft_states[j * draft_state_size]);
+      softmax_layers_forward(q, logits, Y, temperature);
+      inputs[j + 1] = sampler_choice(sampler, q, Y);
+      ++j;
+    }
+
+    // All proposals are checked in one pass
+    logits = lstm_batch_sequence(batch, inputs, proposal + 1);
+
+    j = 0;
+    while ( j < proposal && generated < length ) {
+      double *q = &draft_probs[j * Y];
+      int x = inputs[j + 1];
+
+      softmax_layers_forward(probs, &logits[j * Y], Y, temperature);
+
+      if ( sampler_uniform(sampler) * q[x] < probs[x] ) {
+        writer_putc(writer, set_indx_to_char(set, x));
+        ++generated;
+        ++j;
+        continue;
+      }
+
+      // Rejected, sample from the normalized max(0, p - q) instead
+      accepted = 0;
+      {
+        double sum = 0.0;
+        n = 0;
+        while ( n < Y ) {
+          probs[n] = probs[n] > q[n] ? probs[n] - q[n] : 0.0;
+          sum += probs[n];
+          ++n;
+        }
+        if ( sum > 0.0 ) {
+          n = 0;
+          while ( n < Y ) {
+            probs[n] /= sum;
+            ++n;
+          }
+          next = sampler_choice(sampler, probs, Y);
+        } else {
+          next = x;
+        }
+      }
+      break;
+    }
+
+    if ( generated >= length )
+      break;
+
+    if ( accepted ) {
+      // Every proposal was accepted, one more from the large network
+      softmax_layers_forward(probs, &logits[proposal * Y], Y, temperature);
+      next = sampler_choice(sampler, probs, Y);
+      lstm_session_step(draft, inputs[proposal]);
+      j = proposal;
+    } else {
+      lstm_session_set_state(draft, &draft_states[j * draft_state_size]);
+    }
+
+    // Rewind to the state after the last accepted input
+    lstm_batch_copy_row(batch, 0, j);
+
+    writer_putc(writer, set_indx_to_char(set, next));
+    ++generated;
+    pending = next;
+  }
+
+  lstm_batch_free(batch);
+  lstm_session_free(draft);
+  free_vector(&draft_states);
+  free_vector(&draft_probs);
+  free_vector(&probs);
+  free(inputs);
+  sampler_free(sampler);
+
+  return 0;
+}
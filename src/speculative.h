@@ -0,0 +1,61 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*! \file speculative.h
+    \brief Speculative decoding with a draft network
+
+    A small draft network proposes a few characters ahead, which
+    the large network then checks in one pass over the proposal.
+    Proposals are accepted or rejected such that the output follows
+    the distribution of the large network exactly.
+*/
+
+#ifndef LSTM_SPECULATIVE_H
+#define LSTM_SPECULATIVE_H
+
+#include "lstm.h"
+#include "set.h"
+#include "utilities.h"
+
+/**
+* Write a seed and a sampled continuation of it, using a draft network.
+*
+* Both networks must use the same feature-to-index mapping. Characters
+* are drawn from the full distribution at the temperature of the network,
+* the sampler mode (top-k, top-p, ...) is not applied.
+* @param model_layers the network that is sampled from
+* @param layers how many layers \p model_layers has
+* @param draft_layers the draft network
+* @param draft_layer_count how many layers \p draft_layers has
+* @param set The feature-to-index mapping.
+* @param seed input seed, may be empty
+* @param proposal number of characters proposed by the draft at a time
+* @param length number of characters to generate
+* @param writer the seed followed by the continuation is written here
+* @return 0 on success, negative values on errors
+*/
+int lstm_speculative_output(lstm_model_t **model_layers, int layers,
+  lstm_model_t **draft_layers, int draft_layer_count, set_t *set,
+  const char *seed, int proposal, int length, writer_t *writer);
+
+#endif
@@ -32,12 +32,20 @@
 #ifndef STD_CONF_H
 #define STD_CONF_H
 
+#define ITERATIONS                                              100000000
+#define NO_EPOCHS                                               0 // set to 0 to only stop after ITERATIONS
+
 #define NEURONS                                                 68
 
 #define STD_LEARNING_RATE                                       0.001
 #define STD_MOMENTUM                                            0.0
 #define STD_LAMBDA                                              0.05
 #define SOFTMAX_TEMP                                            1.0
+/*
+* Candidates kept when sampling with -sample topk and -sample topp.
+*/
+#define STD_TOP_K                                               40
+#define STD_TOP_P                                               0.9
 #define GRADIENT_CLIP_LIMIT                                     5.0
 #define MINI_BATCH_SIZE                                         100
 #define LOSS_MOVING_AVG                                         0.01
@@ -82,6 +90,47 @@
 */
 #define STD_LOADABLE_NET_NAME                                   "lstm_net.net"
 #define STD_JSON_NET_NAME                                       "lstm_net.json"
+// Weights in the JSON file as numbers (0) or as base64 float32 (1), see -json
+#define STD_JSON_FORMAT                                         0
+// Weights of the stored network, LSTM_DTYPE_DOUBLE (0), see -dtype and -compress
+#define STD_NETWORK_DTYPE                                       0
+// Stores (-st) kept as deltas against a full base, see -delta. 0 stores every network in full
+#define STD_DELTA_EVERY                                         0
+// Deltas exact (0), or rounded to 16 (1) or 8 (2) bits, see -delta_type
+#define STD_DELTA_ENCODING                                      0
+
+/*
+* When serving a network (--serve), this many requests are
+* run through the network together in each step.
+*/
+#define SERVE_MAX_BATCH                                         32
+/*
+* States of seed prefixes are cached when serving, so that repeated
+* seeds are not fed again. Memory budget in MB (0 disables the cache)
+* and how often, in characters, a state is kept while feeding a seed.
+*/
+#define PREFIX_CACHE_MB                                         64
+#define PREFIX_CACHE_INTERVAL                                   16
+/*
+* Beam search (-beam), hypotheses are ranked by their log probability
+* divided by ((5 + length) / 6) ^ BEAM_LENGTH_PENALTY.
+*/
+#define BEAM_LENGTH_PENALTY                                     0.6
+/*
+* Speculative decoding (-draft), number of characters the draft
+* network proposes before the network checks them.
+*/
+#define SPECULATIVE_PROPOSAL                                    4
+/*
+* Scoring (-score), the text is split in one chunk per thread. Each
+* chunk is warmed up on this many characters before it.
+*/
+#define SCORE_WARMUP                                            256
+/*
+* Scoring lines (-score_lines), number of records each thread runs
+* through the network together.
+*/
+#define SCORE_LINES_ROWS                                        64
 
 // ================== DO NOT CHANGE THE FOLLOWING DEFINES ======================
 // Don't change this one, else the HTML application will not work.
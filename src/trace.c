@@ -0,0 +1,252 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "trace.h"
+#include "utilities.h"
+#include <string.h>
+#include <signal.h>
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL  __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL  __thread
+#endif
+
+#ifdef __GNUC__
+#define TRACE_BARRIER()     __sync_synchronize()
+#else
+#define TRACE_BARRIER()
+#endif
+
+typedef struct trace_event_t {
+  const char *name;
+  double begin;                       // Seconds, time_seconds
+  double duration;
+  int layer;
+  uint64_t seq;                       // Number of the event + 1, 0 while it is written
+} trace_event_t;
+
+typedef struct trace_buffer_t {
+  trace_event_t *events;
+  uint64_t count;                     // Events recorded, the last TRACE_BUFFER_EVENTS are kept
+  int tid;
+  const char *name;
+  struct trace_buffer_t *next;
+} trace_buffer_t;
+
+static char *trace_path = NULL;
+static double trace_start = 0.0;
+static trace_buffer_t *trace_buffers = NULL;  // Pushed to, never removed from
+static int trace_threads = 0;
+static volatile sig_atomic_t trace_requested = 0;
+static TRACE_THREAD_LOCAL trace_buffer_t *trace_local = NULL;
+
+#ifndef WINDOWS
+static void trace_signal(int signo)
+{
+  (void) signo;
+  trace_requested = 1;
+}
+#endif
+
+static void trace_exit(void)
+{
+  trace_dump();
+}
+
+/* The buffer of the calling thread, added to the list on first use */
+static trace_buffer_t* trace_thread_buffer(void)
+{
+  trace_buffer_t *buffer = trace_local;
+
+  if ( buffer != NULL )
+    return buffer;
+
+  // Not counted by e_calloc, it is not memory of the network
+  buffer = calloc(1, sizeof(trace_buffer_t));
+  if ( buffer == NULL || ( buffer->events = calloc(TRACE_BUFFER_EVENTS, sizeof(trace_event_t)) ) == NULL ) {
+    fprintf(stderr, "%s error: Failed to allocate the trace of a thread.\n", __func__);
+    exit(1);
+  }
+#ifdef __GNUC__
+  buffer->tid = __sync_add_and_fetch(&trace_threads, 1);
+  do {
+    buffer->next = trace_buffers;
+  } while ( !__sync_bool_compare_and_swap(&trace_buffers, buffer->next, buffer) );
+#else
+  buffer->tid = ++trace_threads;
+  buffer->next = trace_buffers;
+  trace_buffers = buffer;
+#endif
+
+  trace_local = buffer;
+  return buffer;
+}
+
+int trace_init(const char *path)
+{
+  if ( trace_path != NULL )
+    return -1;
+
+  trace_path = e_calloc(strlen(path) + 1, 1);
+  memcpy(trace_path, path, strlen(path));
+  trace_start = time_seconds();
+  trace_thread_name("main");
+
+#ifndef WINDOWS
+  signal(SIGUSR1, trace_signal);
+#endif
+  atexit(trace_exit);
+  return 0;
+}
+
+int trace_enabled(void)
+{
+  return trace_path != NULL;
+}
+
+void trace_thread_name(const char *name)
+{
+  if ( trace_path != NULL )
+    trace_thread_buffer()->name = name;
+}
+
+double trace_begin(void)
+{
+  return trace_path != NULL ? time_seconds() : 0.0;
+}
+
+void trace_end(const char *name, int layer, double begin)
+{
+  trace_buffer_t *buffer;
+  trace_event_t *event;
+
+  if ( trace_path == NULL )
+    return;
+
+  buffer = trace_thread_buffer();
+  event = &buffer->events[buffer->count % TRACE_BUFFER_EVENTS];
+
+  // A dump reading the event meanwhile sees seq change and skips it
+  event->seq = 0;
+  TRACE_BARRIER();
+  event->name = name;
+  event->begin = begin;
+  event->duration = time_seconds() - begin;
+  event->layer = layer;
+  TRACE_BARRIER();
+  event->seq = buffer->count + 1;
+  buffer->count++;
+}
+
+void trace_poll(void)
+{
+  if ( trace_requested ) {
+    trace_requested = 0;
+    if ( trace_dump() == 0 )
+      fprintf(stderr, "Wrote the trace: %s\n", trace_path);
+  }
+}
+
+static void trace_write_event(writer_t *writer, const trace_buffer_t *buffer,
+  const trace_event_t *event, int *first)
+{
+  char line[256];
+  int length;
+
+  length = snprintf(line, sizeof(line),
+    "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+    *first ? "" : ",", event->name, buffer->tid,
+    ( event->begin - trace_start ) * 1e6, event->duration * 1e6);
+  writer_write(writer, line, (size_t) length);
+
+  if ( event->layer >= 0 ) {
+    length = snprintf(line, sizeof(line), ",\"args\":{\"layer\":%d}", event->layer);
+    writer_write(writer, line, (size_t) length);
+  }
+  writer_putc(writer, '}');
+  *first = 0;
+}
+
+int trace_dump(void)
+{
+  FILE *fp;
+  writer_t writer;
+  trace_buffer_t *buffer;
+  trace_event_t event;
+  uint64_t count, e;
+  char line[256], *tmp_path;
+  int length, first = 1;
+
+  if ( trace_path == NULL )
+    return -1;
+
+  tmp_path = temp_file_name(trace_path);
+  fp = fopen(tmp_path, "wb");
+  if ( fp == NULL ) {
+    fprintf(stderr, "%s error: Failed to open file: %s for writing.\n", __func__, tmp_path);
+    free(tmp_path);
+    return -1;
+  }
+
+  writer_init(&writer, fp);
+  writer_write(&writer, "{\"traceEvents\":[", 16);
+
+  buffer = trace_buffers;
+  while ( buffer != NULL ) {
+    if ( buffer->name != NULL ) {
+      length = snprintf(line, sizeof(line),
+        "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+        first ? "" : ",", buffer->tid, buffer->name);
+      writer_write(&writer, line, (size_t) length);
+      first = 0;
+    }
+
+    count = buffer->count;
+    TRACE_BARRIER();
+    e = count > TRACE_BUFFER_EVENTS ? count - TRACE_BUFFER_EVENTS : 0;
+    while ( e < count ) {
+      event = buffer->events[e % TRACE_BUFFER_EVENTS];
+      TRACE_BARRIER();
+      // Skipped if the thread wrote the event while it was copied
+      if ( event.seq == e + 1 && buffer->events[e % TRACE_BUFFER_EVENTS].seq == e + 1 )
+        trace_write_event(&writer, buffer, &event, &first);
+      ++e;
+    }
+    buffer = buffer->next;
+  }
+
+  writer_write(&writer, "\n],\"displayTimeUnit\":\"ms\"}\n", 27);
+  writer_flush(&writer);
+
+  if ( ferror(fp) | fclose(fp) ) {
+    fprintf(stderr, "%s error: Failed to write %s.\n", __func__, tmp_path);
+    remove(tmp_path);
+    free(tmp_path);
+    return -1;
+  }
+
+  length = replace_file(tmp_path, trace_path);
+  free(tmp_path);
+  return length;
+}
@@ -0,0 +1,71 @@
+/*
+* This file is part of the LSTM Network implementation In C made by Rickard Hallerbäck
+* 
+*                 Copyright (c) 2018 Rickard Hallerbäck
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+* software and associated documentation files (the "Software"), 
+* to deal in the Software without restriction, including without limitation the rights 
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+* Software, and to permit persons to whom the Software is furnished to do so, subject to 
+* the following conditions:
+* The above copyright notice and this permission notice shall be included in all copies 
+* or substantial portions of the Software.
+*
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+* PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+* FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+* OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+/*! \file trace.h
+    \brief Timeline of training and generation as Chrome trace events
+
+    With tracing started (-trace) the phases of training, every layer of
+    every timestep, checkpoint writes and generation are recorded as
+    complete events ("ph": "X") and written as Chrome trace JSON, for
+    chrome://tracing or https://ui.perfetto.dev, at exit and whenever
+    the process gets SIGUSR1.
+
+    Every thread records to its own ring buffer without locks, which
+    keeps the last TRACE_BUFFER_EVENTS events of the thread. A dump
+    copes with threads still recording. The SIGUSR1 handler only sets a
+    flag, the dump is written by the next \ref trace_poll of the main
+    loops.
+*/
+
+#ifndef LSTM_TRACE_H
+#define LSTM_TRACE_H
+
+#include <stdint.h>
+
+/** Events kept per thread, older ones are overwritten */
+#define TRACE_BUFFER_EVENTS                   ( 1 << 18 )
+
+/**
+* Start recording, to be written to \p path at exit and on SIGUSR1
+* @param path the trace file, replaced through a temporary file
+* @return 0 on success, -1 if tracing had been started already
+*/
+int trace_init(const char *path);
+/** 1 if recording */
+int trace_enabled(void);
+/** Name the calling thread in the trace */
+void trace_thread_name(const char *name);
+/** Start of an event, the time when recording and 0 otherwise */
+double trace_begin(void);
+/**
+* Record an event from \p begin, see \ref trace_begin, to now
+* @param name the name, a string that outlives the trace (a literal)
+* @param layer layer the event belongs to, or -1
+* @param begin value of \ref trace_begin
+*/
+void trace_end(const char *name, int layer, double begin);
+/** Write the trace if SIGUSR1 asked for it, called from the main loops */
+void trace_poll(void);
+/** Write the trace now, returns 0 on success */
+int trace_dump(void);
+
+#endif
@@ -33,132 +33,150 @@
 *
 */
 #include "utilities.h"
+#include "roofline.h"
+#include <string.h>
+#include <time.h>
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+// getpid, by the platform as the CMake build defines WINDOWS everywhere
+#ifdef _WIN32
+#include <process.h>
+#define getpid    _getpid
+#else
+#include <unistd.h>
+#endif
 
 // used on contigous vectors
 void  vectors_add(double* A, double* B, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] += B[l];
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_ADD, begin, L, 24.0 * L);
 }
 
 void  vectors_add_scalar(double* A, double B, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] += B;
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_ADD_SCALAR, begin, L, 16.0 * L);
 }
 
 void  vectors_scalar_multiply(double* A, double d, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] *= d;
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_SCALAR_MULTIPLY, begin, L, 16.0 * L);
 }
 
 // A = A + (B * s)
 void  vectors_add_scalar_multiply(double* A, double* B, int L, double s)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] += B[l] * s;
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_ADD_SCALAR_MULTIPLY, begin, 2.0 * L, 24.0 * L);
 }
 
 void  vectors_substract(double* A, double* B, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] -= B[l];
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_SUBSTRACT, begin, L, 24.0 * L);
 }
 
 void  vectors_div(double* A, double* B, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] /= B[l];
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_DIV, begin, L, 24.0 * L);
 }
 
 void  vector_sqrt(double* A, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] = sqrt(A[l]);
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTOR_SQRT, begin, L, 16.0 * L);
 }
 // A = A - (B * s)
 void  vectors_substract_scalar_multiply(double* A, double* B, int L, double s)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] -= B[l] * s;
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_SUBSTRACT_SCALAR_MULTIPLY, begin, 2.0 * L, 24.0 * L);
 }
 
 
 void  vectors_multiply(double* A, double* B, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] *= B[l];
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_VECTORS_MULTIPLY, begin, L, 24.0 * L);
 }
 void  vectors_mutliply_scalar(double* A, double b, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     A[l] *= b;
     ++l;
   }
-} 
 
-int   init_random_matrix(double*** A, int R, int C)
-{
-  int r = 0, c = 0;
-
-  *A = e_calloc(R, sizeof(double*));
-
-  while ( r < R ) {
-    (*A)[r] = e_calloc(C, sizeof(double));
-    ++r;
-  }
-
-  r = 0, c = 0;
-
-  while ( r < R ) {
-    c = 0;
-    while ( c < C ) {
-      (*A)[r][c] =  randn(0,1) / sqrt( R ); 
-      ++c;
-    }
-    ++r;
-  }
-
-  return 0;
-}
+  ROOFLINE_END(ROOFLINE_VECTORS_SCALAR_MULTIPLY, begin, L, 16.0 * L);
+} 
 
-double*   get_random_vector(int L, int R) {
+double*   get_random_vector(int L, int R, uint64_t *random_state) {
   
   int l = 0;
   double *p;
   p = e_calloc(L, sizeof(double));
 
   while ( l < L ) {
-    p[l] = randn(0,1) / sqrt( R / 5 );
+    p[l] = randn(random_state, 0, 1) / sqrt( R / 5 );
     ++l;
   }
 
@@ -166,31 +184,6 @@ double*   get_random_vector(int L, int R) {
 
 }
 
-double**  get_random_matrix(int R, int C)
-{
-  int r = 0, c = 0;
-  double ** p;
-  p = e_calloc(R, sizeof(double*));
-
-  while ( r < R ) {
-    p[r] = e_calloc(C, sizeof(double));
-    ++r;
-  }
-
-  r = 0, c = 0;
-
-  while ( r < R ) {
-    c = 0;
-    while ( c < C ) {
-      p[r][c] =  ((( (double) rand() ) / RAND_MAX) ) / sqrt( R / 2.0 ); 
-      ++c;
-    }
-    ++r;
-  }
-
-  return p;
-}
-
 double**  get_zero_matrix(int R, int C)
 {
   int r = 0, c = 0;
@@ -291,11 +284,14 @@ int   free_vector(double** V)
 void  copy_vector(double* A, double* B, int L)
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
 
   while ( l < L ) {
     A[l] = B[l];
     ++l;
   }
+
+  ROOFLINE_END(ROOFLINE_COPY_VECTOR, begin, 0, 16.0 * L);
 }
 
 void  matrix_add(double** A, double** B, int R, int C)
@@ -315,8 +311,12 @@ void  matrix_add(double** A, double** B, int R, int C)
 void  vector_set_to_zero(double* V, int L )
 {
   int l = 0;
+  double begin = ROOFLINE_BEGIN();
+
   while ( l < L )
     V[l++] = 0.0;
+
+  ROOFLINE_END(ROOFLINE_VECTOR_SET_TO_ZERO, begin, 0, 8.0 * L);
 }
 
 
@@ -381,12 +381,13 @@ void  matrix_clip(double** A, double limit, int R, int C)
 double one_norm(double* V, int L)
 {
   int l = 0;
-  double norm = 0.0;
+  double norm = 0.0, begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     norm += fabs(V[l]);
     ++l;
   }
 
+  ROOFLINE_END(ROOFLINE_ONE_NORM, begin, L, 8.0 * L);
   return norm;
 }
 
@@ -394,18 +395,20 @@ int   vectors_fit(double* V, double limit, int L)
 {
   int l = 0;
   int msg = 0;
-  double norm;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     if ( V[l] > limit || V[l] < -limit ) {
       msg = 1;
-      norm = one_norm(V, L);
       break;
     }
     ++l;
   }
 
+  // The norm and the scaling count as kernels of their own
+  ROOFLINE_END(ROOFLINE_VECTORS_FIT, begin, 0, 8.0 * ( l < L ? l + 1 : L ));
+
   if ( msg )
-    vectors_mutliply_scalar(V, limit / norm, L);
+    vectors_mutliply_scalar(V, limit / one_norm(V, L), L);
 
   return msg;
 }
@@ -414,6 +417,7 @@ int   vectors_clip(double* V, double limit, int L)
 {
   int l = 0;
   int msg = 0;
+  double begin = ROOFLINE_BEGIN();
   while ( l < L ) {
     if ( V[l] > limit ) {
       msg = 1;
@@ -425,6 +429,7 @@ int   vectors_clip(double* V, double limit, int L)
     ++l;
   }
 
+  ROOFLINE_END(ROOFLINE_VECTORS_CLIP, begin, 0, 8.0 * L);
   return msg;
 }
 
@@ -489,37 +494,16 @@ void  matrix_read(double ** A, int R, int C, FILE * fp)
 
 void  vector_store(double* V, int L, FILE * fp)
 {
-  int l = 0;
-  size_t i = 0;
-  char *p;
-
-  while ( l < L ) {
-    i = 0; p = (char*)&V[l];
-    while ( i < sizeof(double) ) {
-      fputc(*(p), fp);
-      ++i; ++p;
-    }
-    ++l;
-  }
+  fwrite(V, sizeof(double), L, fp);
 }
 
 void  vector_read(double * V, int L, FILE * fp) 
 {
-  int l = 0;
-  size_t i = 0;
-  char *p;
-  double value;
-
-  while ( l < L ) {
-    i = 0; p = (char*)&value;
-    while ( i < sizeof(double) ) {
-      *(p) = fgetc(fp);
-      ++i; ++p;
-    }
-    V[l] = value;
-    ++l;
-  }
+  size_t read = fread(V, sizeof(double), L, fp);
 
+  // As before, a short file leaves the rest undefined (0xff bytes)
+  if ( read < (size_t) L )
+    memset(&V[read], 0xff, ( L - read ) * sizeof(double));
 }
 
 void  vector_store_ascii(double* V, int L, FILE * fp)
@@ -553,39 +537,14 @@ void  vector_read_ascii(double * V, int L, FILE * fp)
 */
 void  vector_store_as_matrix_json(double* V, int R, int C, FILE * fp)
 {
-  int r = 0, c = 0;
+  writer_t writer;
 
   if ( fp == NULL )
     return; // No file, nothing to do. 
 
-  fprintf(fp, "[");
-
-  r = 0;
-
-  while ( r < R ) {
-
-    if ( r > 0 )
-      fprintf(fp, ",");
-
-    fprintf(fp,"[");
-
-    c = 0;
-    while ( c < C ) {
-
-      if ( c > 0 )
-        fprintf(fp, ",");
-
-      fprintf(fp,"%.15f", V[r*C + c]);
-
-      ++c;
-    }
-
-    fprintf(fp,"]");
-
-    ++r;
-  }
-
-  fprintf(fp, "]");
+  writer_init(&writer, fp);
+  vector_write_matrix_json(&writer, V, R, C);
+  writer_flush(&writer);
 }
 
 
@@ -595,69 +554,75 @@ void  vector_store_as_matrix_json(double* V, int R, int C, FILE * fp)
 */
 void  vector_store_json(double* V, int L, FILE * fp)
 {
-  int l = 0;
+  writer_t writer;
 
   if ( fp == NULL )
     return; // No file, nothing to do. 
 
-  fprintf(fp, "[");
+  writer_init(&writer, fp);
+  vector_write_json(&writer, V, L);
+  writer_flush(&writer);
+}
 
-  while ( l < L ) {
+/*
+* Random numbers, xorshift64*. The state is kept by the caller,
+* so that threads do not share a generator.
+*/
+void random_seed(uint64_t *state, unsigned long seed)
+{
+  uint64_t z = seed;
 
-    if ( l > 0 )
-      fprintf(fp, ",");
+  if ( z == 0 )
+    z = (uint64_t) time(NULL) ^ ((uint64_t) clock() << 32) ^ (uint64_t) (uintptr_t) state;
 
-    fprintf(fp,"%.15f", V[l]);
+  // splitmix64, so that nearby seeds give unrelated streams
+  z += 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
 
-    ++l;
-  }
+  *state = z != 0 ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+uint64_t random_next(uint64_t *state)
+{
+  uint64_t x = *state;
 
-  fprintf(fp, "]");
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+
+  return x * 2685821657736338717ULL;
+}
+
+double random_uniform(uint64_t *state)
+{
+  return (random_next(state) >> 11) * (1.0 / 9007199254740992.0);
 }
 
 /*
 * Gaussian generator: https://phoxis.org/2013/05/04/generating-random-numbers-from-normal-distribution-in-c/
+* (the polar method, without keeping the second value between calls)
 */
 double
-randn (double mu, double sigma)
+randn (uint64_t *state, double mu, double sigma)
 {
   double U1, U2, W, mult;
-  static double X1, X2;
-  static int call = 0;
- 
-  if (call == 1)
-  {
-    call = !call;
-    return (mu + sigma * (double) X2);
-  }
 
   do {
-    U1 = -1 + ((double) rand () / RAND_MAX) * 2;
-    U2 = -1 + ((double) rand () / RAND_MAX) * 2;
+    U1 = -1 + random_uniform(state) * 2;
+    U2 = -1 + random_uniform(state) * 2;
     W = pow (U1, 2) + pow (U2, 2);
   } while ( W >= 1 || W == 0 );
  
   mult = sqrt ((-2 * log (W)) / W);
-  X1 = U1 * mult;
-  X2 = U2 * mult;
- 
-  call = !call;
- 
-  return (mu + sigma * (double) X1);
-}
 
-double sample_normal() {
-  double u = ((double) rand() / (RAND_MAX)) * 2 - 1;
-  double v = ((double) rand() / (RAND_MAX)) * 2 - 1;
-  double r = u * u + v * v;
-  if (r == 0 || r > 1)
-    return sample_normal();
-  double c = sqrt(-2 * log(r) / r);
-  return u * c;
+  return (mu + sigma * U1 * mult);
 }
 
 /* Memory related utilities */
-static size_t alloc_mem_tot = 0;
+static size_t alloc_mem_tot = 0; // Statistics only, updated atomically where possible
 void*   e_calloc(size_t count, size_t size)
 {
   void *p = calloc(count, size);
@@ -667,7 +632,11 @@ void*   e_calloc(size_t count, size_t size)
       __func__, count*size, alloc_mem_tot);
     exit(1);
   }
+#ifdef __GNUC__
+  __sync_fetch_and_add(&alloc_mem_tot, count*size);
+#else
   alloc_mem_tot += count*size;
+#endif
   return p;
 }
 
@@ -675,3 +644,740 @@ size_t  e_alloc_total()
 {
   return alloc_mem_tot;
 }
+
+/* CRC-32 (IEEE 802.3, as in zlib) */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t length)
+{
+  const unsigned char *p = data;
+  uint32_t table[256], c;
+  int i = 0, k;
+
+  // Building the table costs less than checksumming a few kB with it
+  while ( i < 256 ) {
+    c = (uint32_t) i;
+    k = 0;
+    while ( k < 8 ) {
+      c = c & 1 ? 0xedb88320u ^ ( c >> 1 ) : c >> 1;
+      ++k;
+    }
+    table[i] = c;
+    ++i;
+  }
+
+  crc = ~crc;
+  while ( length > 0 ) {
+    crc = table[( crc ^ *p ) & 0xff] ^ ( crc >> 8 );
+    ++p;
+    --length;
+  }
+  return ~crc;
+}
+
+/* Half precision, IEEE 754 binary16 */
+uint16_t float_to_half(float value)
+{
+  uint32_t x, mantissa, rest, halfway;
+  uint16_t sign, half;
+  int exponent, shift;
+
+  memcpy(&x, &value, sizeof(x));
+  sign = (uint16_t) ( ( x >> 16 ) & 0x8000 );
+  exponent = (int) ( ( x >> 23 ) & 0xff );
+  mantissa = x & 0x7fffff;
+
+  if ( exponent == 0xff ) // Inf or NaN
+    return sign | 0x7c00 | ( mantissa ? 0x200 : 0 );
+
+  exponent = exponent - 127 + 15;
+
+  if ( exponent >= 31 ) // Too large, Inf
+    return sign | 0x7c00;
+
+  if ( exponent <= 0 ) {
+    if ( exponent < -10 ) // Too small, zero
+      return sign;
+    // Subnormal, rounded to nearest even
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+    half = (uint16_t) ( mantissa >> shift );
+    rest = mantissa & ( ( 1u << shift ) - 1 );
+    halfway = 1u << ( shift - 1 );
+    if ( rest > halfway || ( rest == halfway && ( half & 1 ) ) )
+      ++half;
+    return sign | half;
+  }
+
+  // Rounded to nearest even, a carry correctly moves into the exponent
+  half = (uint16_t) ( ( exponent << 10 ) | ( mantissa >> 13 ) );
+  rest = mantissa & 0x1fff;
+  if ( rest > 0x1000 || ( rest == 0x1000 && ( half & 1 ) ) )
+    ++half;
+  return sign | half;
+}
+
+float half_to_float(uint16_t half)
+{
+  uint32_t sign = ( (uint32_t) half & 0x8000 ) << 16;
+  uint32_t mantissa = half & 0x3ff, x;
+  int exponent = ( half >> 10 ) & 0x1f;
+  float value;
+
+  if ( exponent == 0 ) {
+    if ( mantissa == 0 ) {
+      x = sign;
+    } else {
+      // Subnormal, normalized as a float
+      exponent = 1;
+      while ( !( mantissa & 0x400 ) ) {
+        mantissa <<= 1;
+        --exponent;
+      }
+      mantissa &= 0x3ff;
+      x = sign | ( (uint32_t) ( exponent + 127 - 15 ) << 23 ) | ( mantissa << 13 );
+    }
+  } else if ( exponent == 31 ) {
+    x = sign | 0x7f800000 | ( mantissa << 13 );
+  } else {
+    x = sign | ( (uint32_t) ( exponent + 127 - 15 ) << 23 ) | ( mantissa << 13 );
+  }
+
+  memcpy(&value, &x, sizeof(value));
+  return value;
+}
+
+/* bfloat16, the upper half of a float */
+uint16_t float_to_bfloat16(float value)
+{
+  uint32_t x;
+
+  memcpy(&x, &value, sizeof(x));
+  if ( ( x & 0x7fffffff ) > 0x7f800000 ) // NaN stays NaN
+    return (uint16_t) ( ( x >> 16 ) | 0x40 );
+  // Rounded to nearest even, a carry correctly moves into the exponent
+  x += 0x7fff + ( ( x >> 16 ) & 1 );
+  return (uint16_t) ( x >> 16 );
+}
+
+float bfloat16_to_float(uint16_t value)
+{
+  uint32_t x = (uint32_t) value << 16;
+  float f;
+
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/*
+* Order-0 entropy coding, rANS as described by Duda with a 32 bit state
+* and byte output. Output: a method byte, then for ENTROPY_RANS the
+* frequencies of the 256 byte values (uint16, little endian, summing to
+* 1 << ENTROPY_PROB_BITS) and the coded bytes. Data that does not get
+* smaller is stored as it is (ENTROPY_RAW).
+*/
+#define ENTROPY_RAW           0
+#define ENTROPY_RANS          1
+#define ENTROPY_PROB_BITS     12
+#define ENTROPY_PROB_SCALE    ( 1u << ENTROPY_PROB_BITS )
+#define ENTROPY_STATE_LOW     ( 1u << 23 )
+#define ENTROPY_TABLE_SIZE    ( 256 * 2 )
+
+size_t  entropy_bound(size_t length)
+{
+  return 1 + length;
+}
+
+/* Frequencies of the bytes scaled to sum to ENTROPY_PROB_SCALE, each byte present at least 1 */
+static void entropy_frequencies(const unsigned char *in, size_t length, uint32_t *freq)
+{
+  uint64_t counts[256];
+  uint32_t sum = 0, largest;
+  size_t i = 0;
+  int s;
+
+  memset(counts, 0, sizeof(counts));
+  while ( i < length )
+    ++counts[in[i++]];
+
+  s = 0;
+  while ( s < 256 ) {
+    freq[s] = (uint32_t) ( counts[s] * ENTROPY_PROB_SCALE / length );
+    if ( counts[s] > 0 && freq[s] == 0 )
+      freq[s] = 1;
+    sum += freq[s];
+    ++s;
+  }
+
+  // Rounding is made up by the most frequent bytes
+  while ( sum != ENTROPY_PROB_SCALE ) {
+    largest = 0;
+    s = 1;
+    while ( s < 256 ) {
+      if ( freq[s] > freq[largest] )
+        largest = s;
+      ++s;
+    }
+    if ( sum < ENTROPY_PROB_SCALE ) {
+      freq[largest] += ENTROPY_PROB_SCALE - sum;
+      sum = ENTROPY_PROB_SCALE;
+    } else {
+      --freq[largest];
+      --sum;
+    }
+  }
+}
+
+size_t  entropy_encode(const unsigned char *in, size_t length, unsigned char *out)
+{
+  uint32_t freq[256], start[256], x = ENTROPY_STATE_LOW, x_max;
+  unsigned char *coded, *p;
+  size_t i, size;
+  int s;
+
+  if ( length > 0 ) {
+    entropy_frequencies(in, length, freq);
+
+    start[0] = 0;
+    s = 1;
+    while ( s < 256 ) {
+      start[s] = start[s - 1] + freq[s - 1];
+      ++s;
+    }
+
+    // Coded from the end, backwards, and decoded forwards
+    coded = e_calloc(length + 8, 1);
+    p = coded + length + 8;
+    i = length;
+    while ( i > 0 && p - coded > 4 ) {
+      s = in[--i];
+      x_max = ( ( ENTROPY_STATE_LOW >> ENTROPY_PROB_BITS ) << 8 ) * freq[s];
+      while ( x >= x_max && p - coded > 4 ) {
+        *--p = (unsigned char) ( x & 0xff );
+        x >>= 8;
+      }
+      x = ( ( x / freq[s] ) << ENTROPY_PROB_BITS ) + ( x % freq[s] ) + start[s];
+    }
+
+    size = (size_t) ( coded + length + 8 - p ) + 4;
+    if ( i == 0 && p - coded >= 4 && 1 + ENTROPY_TABLE_SIZE + size < entropy_bound(length) ) {
+      out[0] = ENTROPY_RANS;
+      s = 0;
+      while ( s < 256 ) {
+        out[1 + 2 * s] = (unsigned char) ( freq[s] & 0xff );
+        out[2 + 2 * s] = (unsigned char) ( freq[s] >> 8 );
+        ++s;
+      }
+      p -= 4;
+      p[0] = (unsigned char) ( x & 0xff );
+      p[1] = (unsigned char) ( ( x >> 8 ) & 0xff );
+      p[2] = (unsigned char) ( ( x >> 16 ) & 0xff );
+      p[3] = (unsigned char) ( x >> 24 );
+      memcpy(&out[1 + ENTROPY_TABLE_SIZE], p, size);
+      free(coded);
+      return 1 + ENTROPY_TABLE_SIZE + size;
+    }
+    free(coded);
+  }
+
+  out[0] = ENTROPY_RAW;
+  memcpy(&out[1], in, length);
+  return 1 + length;
+}
+
+int     entropy_decode(const unsigned char *in, size_t size, unsigned char *out, size_t length)
+{
+  uint32_t freq[256], start[256], x, slot, sum = 0;
+  unsigned char *symbols;
+  const unsigned char *p, *end = in + size;
+  size_t i = 0;
+  int s;
+
+  if ( size < 1 )
+    return -1;
+
+  if ( in[0] == ENTROPY_RAW ) {
+    if ( size != 1 + length )
+      return -1;
+    memcpy(out, &in[1], length);
+    return 0;
+  }
+
+  if ( in[0] != ENTROPY_RANS || size < 1 + ENTROPY_TABLE_SIZE + 4 )
+    return -1;
+
+  s = 0;
+  while ( s < 256 ) {
+    freq[s] = in[1 + 2 * s] | ( (uint32_t) in[2 + 2 * s] << 8 );
+    start[s] = sum;
+    sum += freq[s];
+    ++s;
+  }
+  if ( sum != ENTROPY_PROB_SCALE )
+    return -1;
+
+  symbols = e_calloc(ENTROPY_PROB_SCALE, 1);
+  s = 0;
+  while ( s < 256 ) {
+    memset(&symbols[start[s]], s, freq[s]);
+    ++s;
+  }
+
+  p = &in[1 + ENTROPY_TABLE_SIZE];
+  x = p[0] | ( (uint32_t) p[1] << 8 ) | ( (uint32_t) p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+  p += 4;
+
+  while ( i < length ) {
+    slot = x & ( ENTROPY_PROB_SCALE - 1 );
+    s = symbols[slot];
+    out[i++] = (unsigned char) s;
+    x = freq[s] * ( x >> ENTROPY_PROB_BITS ) + slot - start[s];
+    while ( x < ENTROPY_STATE_LOW && p < end )
+      x = ( x << 8 ) | *p++;
+  }
+
+  free(symbols);
+  return p == end && x == ENTROPY_STATE_LOW ? 0 : -1;
+}
+
+/* System */
+int     cpu_count(void)
+{
+#ifdef WINDOWS
+  return 1;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int) count : 1;
+#endif
+}
+
+double  time_seconds(void)
+{
+#ifdef WINDOWS
+  return (double) clock() / CLOCKS_PER_SEC;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+/* Files */
+static unsigned long temp_file_count = 0;
+char*   temp_file_name(const char *path)
+{
+  unsigned long count;
+  size_t length = strlen(path) + 48;
+  char *name = e_calloc(length, 1);
+
+#ifdef __GNUC__
+  count = __sync_fetch_and_add(&temp_file_count, 1);
+#else
+  count = temp_file_count++;
+#endif
+  // The process id keeps processes writing the same file apart
+  snprintf(name, length, "%s.%ld.%lu.tmp", path, (long) getpid(), count);
+  return name;
+}
+
+int     replace_file(const char *from, const char *to)
+{
+#ifdef WINDOWS
+  // rename does not replace an existing file on Windows
+  remove(to);
+#endif
+  if ( rename(from, to) != 0 ) {
+    fprintf(stderr, "%s error: Failed to rename %s to %s.\n", __func__, from, to);
+    remove(from);
+    return -1;
+  }
+  return 0;
+}
+
+/* Buffered output */
+void    writer_init(writer_t *writer, FILE *fp)
+{
+  writer->fp = fp;
+  writer->len = 0;
+}
+
+void    writer_flush(writer_t *writer)
+{
+  if ( writer->len > 0 && writer->fp != NULL ) {
+    fwrite(writer->buffer, 1, writer->len, writer->fp);
+    fflush(writer->fp);
+  }
+  writer->len = 0;
+}
+
+void    writer_putc(writer_t *writer, char c)
+{
+  if ( writer->len == WRITER_BUFFER_SIZE )
+    writer_flush(writer);
+  writer->buffer[writer->len++] = c;
+}
+
+void    writer_write(writer_t *writer, const char *data, size_t len)
+{
+  while ( len > 0 ) {
+    size_t room = WRITER_BUFFER_SIZE - writer->len;
+    size_t chunk = len < room ? len : room;
+
+    memcpy(&writer->buffer[writer->len], data, chunk);
+    writer->len += chunk;
+    data += chunk;
+    len -= chunk;
+
+    if ( writer->len == WRITER_BUFFER_SIZE )
+      writer_flush(writer);
+  }
+}
+
+/* JSON output */
+
+/*
+* Shortest digits that read back as the same double, Grisu2 by
+* Florian Loitsch ("Printing Floating-Point Numbers Quickly and
+* Accurately with Integers", PLDI 2010). Only integer arithmetic,
+* an order of magnitude faster than printf.
+*/
+typedef struct grisu_fp_t {
+  uint64_t f;
+  int e;
+} grisu_fp_t;
+
+/* 10^(-348 + 8 i), normalized */
+static const grisu_fp_t grisu_powers[] = {
+  { 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 },
+  { 0x8b16fb203055ac76ULL, -1166 }, { 0xcf42894a5dce35eaULL, -1140 },
+  { 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 },
+  { 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 },
+  { 0xbe5691ef416bd60cULL, -1007 }, { 0x8dd01fad907ffc3cULL, -980 },
+  { 0xd3515c2831559a83ULL, -954 }, { 0x9d71ac8fada6c9b5ULL, -927 },
+  { 0xea9c227723ee8bcbULL, -901 }, { 0xaecc49914078536dULL, -874 },
+  { 0x823c12795db6ce57ULL, -847 }, { 0xc21094364dfb5637ULL, -821 },
+  { 0x9096ea6f3848984fULL, -794 }, { 0xd77485cb25823ac7ULL, -768 },
+  { 0xa086cfcd97bf97f4ULL, -741 }, { 0xef340a98172aace5ULL, -715 },
+  { 0xb23867fb2a35b28eULL, -688 }, { 0x84c8d4dfd2c63f3bULL, -661 },
+  { 0xc5dd44271ad3cdbaULL, -635 }, { 0x936b9fcebb25c996ULL, -608 },
+  { 0xdbac6c247d62a584ULL, -582 }, { 0xa3ab66580d5fdaf6ULL, -555 },
+  { 0xf3e2f893dec3f126ULL, -529 }, { 0xb5b5ada8aaff80b8ULL, -502 },
+  { 0x87625f056c7c4a8bULL, -475 }, { 0xc9bcff6034c13053ULL, -449 },
+  { 0x964e858c91ba2655ULL, -422 }, { 0xdff9772470297ebdULL, -396 },
+  { 0xa6dfbd9fb8e5b88fULL, -369 }, { 0xf8a95fcf88747d94ULL, -343 },
+  { 0xb94470938fa89bcfULL, -316 }, { 0x8a08f0f8bf0f156bULL, -289 },
+  { 0xcdb02555653131b6ULL, -263 }, { 0x993fe2c6d07b7facULL, -236 },
+  { 0xe45c10c42a2b3b06ULL, -210 }, { 0xaa242499697392d3ULL, -183 },
+  { 0xfd87b5f28300ca0eULL, -157 }, { 0xbce5086492111aebULL, -130 },
+  { 0x8cbccc096f5088ccULL, -103 }, { 0xd1b71758e219652cULL, -77 },
+  { 0x9c40000000000000ULL, -50 }, { 0xe8d4a51000000000ULL, -24 },
+  { 0xad78ebc5ac620000ULL, 3 }, { 0x813f3978f8940984ULL, 30 },
+  { 0xc097ce7bc90715b3ULL, 56 }, { 0x8f7e32ce7bea5c70ULL, 83 },
+  { 0xd5d238a4abe98068ULL, 109 }, { 0x9f4f2726179a2245ULL, 136 },
+  { 0xed63a231d4c4fb27ULL, 162 }, { 0xb0de65388cc8ada8ULL, 189 },
+  { 0x83c7088e1aab65dbULL, 216 }, { 0xc45d1df942711d9aULL, 242 },
+  { 0x924d692ca61be758ULL, 269 }, { 0xda01ee641a708deaULL, 295 },
+  { 0xa26da3999aef774aULL, 322 }, { 0xf209787bb47d6b85ULL, 348 },
+  { 0xb454e4a179dd1877ULL, 375 }, { 0x865b86925b9bc5c2ULL, 402 },
+  { 0xc83553c5c8965d3dULL, 428 }, { 0x952ab45cfa97a0b3ULL, 455 },
+  { 0xde469fbd99a05fe3ULL, 481 }, { 0xa59bc234db398c25ULL, 508 },
+  { 0xf6c69a72a3989f5cULL, 534 }, { 0xb7dcbf5354e9beceULL, 561 },
+  { 0x88fcf317f22241e2ULL, 588 }, { 0xcc20ce9bd35c78a5ULL, 614 },
+  { 0x98165af37b2153dfULL, 641 }, { 0xe2a0b5dc971f303aULL, 667 },
+  { 0xa8d9d1535ce3b396ULL, 694 }, { 0xfb9b7cd9a4a7443cULL, 720 },
+  { 0xbb764c4ca7a44410ULL, 747 }, { 0x8bab8eefb6409c1aULL, 774 },
+  { 0xd01fef10a657842cULL, 800 }, { 0x9b10a4e5e9913129ULL, 827 },
+  { 0xe7109bfba19c0c9dULL, 853 }, { 0xac2820d9623bf429ULL, 880 },
+  { 0x80444b5e7aa7cf85ULL, 907 }, { 0xbf21e44003acdd2dULL, 933 },
+  { 0x8e679c2f5e44ff8fULL, 960 }, { 0xd433179d9c8cb841ULL, 986 },
+  { 0x9e19db92b4e31ba9ULL, 1013 }, { 0xeb96bf6ebadf77d9ULL, 1039 },
+  { 0xaf87023b9bf0ee6bULL, 1066 }
+};
+
+static const uint64_t grisu_pow10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+  10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static grisu_fp_t grisu_multiply(grisu_fp_t x, grisu_fp_t y)
+{
+  const uint64_t M32 = 0xFFFFFFFFULL;
+  uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = ( bd >> 32 ) + ( ad & M32 ) + ( bc & M32 ) + ( 1ULL << 31 );
+  grisu_fp_t r;
+
+  r.f = ac + ( ad >> 32 ) + ( bc >> 32 ) + ( tmp >> 32 );
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+static grisu_fp_t grisu_normalize(grisu_fp_t x)
+{
+  while ( !( x.f & ( 1ULL << 63 ) ) ) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+static void grisu_round(char *buffer, int length, uint64_t delta, uint64_t rest,
+  uint64_t ten_kappa, uint64_t wp_w)
+{
+  while ( rest < wp_w && delta - rest >= ten_kappa &&
+    ( rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w ) ) {
+    buffer[length - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/* Digits of a positive, finite value, which is digits * 10^K */
+static int grisu_digits(double value, char *buffer, int *K)
+{
+  uint64_t bits, f, p2, delta, tmp, wp_w;
+  uint32_t p1, d;
+  grisu_fp_t v, w, plus, minus, c, one;
+  int e, k, kappa, length = 0, index;
+  double dk;
+
+  memcpy(&bits, &value, sizeof(bits));
+  f = bits & ( ( 1ULL << 52 ) - 1 );
+  e = (int) ( ( bits >> 52 ) & 0x7FF );
+  if ( e != 0 ) {
+    v.f = f + ( 1ULL << 52 );
+    v.e = e - 1075;
+  } else {
+    v.f = f;
+    v.e = -1074;
+  }
+
+  // Boundaries halfway to the neighbouring doubles
+  plus.f = ( v.f << 1 ) + 1;
+  plus.e = v.e - 1;
+  plus = grisu_normalize(plus);
+  if ( v.f == ( 1ULL << 52 ) && e > 1 ) {
+    minus.f = ( v.f << 2 ) - 1;
+    minus.e = v.e - 2;
+  } else {
+    minus.f = ( v.f << 1 ) - 1;
+    minus.e = v.e - 1;
+  }
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  // Cached power bringing the exponent into [-60, -32]
+  dk = ( -61 - plus.e ) * 0.30102999566398114 + 347;
+  k = (int) dk;
+  if ( dk - k > 0.0 )
+    ++k;
+  index = ( k >> 3 ) + 1;
+  *K = -( -348 + index * 8 );
+  c = grisu_powers[index];
+
+  w = grisu_multiply(grisu_normalize(v), c);
+  plus = grisu_multiply(plus, c);
+  minus = grisu_multiply(minus, c);
+  plus.f--;
+  minus.f++;
+  delta = plus.f - minus.f;
+
+  one.f = 1ULL << -plus.e;
+  one.e = plus.e;
+  wp_w = plus.f - w.f;
+  p1 = (uint32_t) ( plus.f >> -one.e );
+  p2 = plus.f & ( one.f - 1 );
+
+  kappa = 1;
+  while ( kappa < 10 && p1 >= grisu_pow10[kappa] )
+    ++kappa;
+
+  while ( kappa > 0 ) {
+    d = p1 / (uint32_t) grisu_pow10[kappa - 1];
+    p1 %= (uint32_t) grisu_pow10[kappa - 1];
+    if ( d || length )
+      buffer[length++] = (char) ( '0' + d );
+    kappa--;
+    tmp = ( (uint64_t) p1 << -one.e ) + p2;
+    if ( tmp <= delta ) {
+      *K += kappa;
+      grisu_round(buffer, length, delta, tmp, grisu_pow10[kappa] << -one.e, wp_w);
+      return length;
+    }
+  }
+
+  while ( 1 ) {
+    p2 *= 10;
+    delta *= 10;
+    d = (uint32_t) ( p2 >> -one.e );
+    if ( d || length )
+      buffer[length++] = (char) ( '0' + d );
+    p2 &= one.f - 1;
+    kappa--;
+    if ( p2 < delta ) {
+      *K += kappa;
+      index = -kappa;
+      grisu_round(buffer, length, delta, p2, one.f,
+        wp_w * ( index < 20 ? grisu_pow10[index] : 0 ));
+      return length;
+    }
+  }
+}
+
+void    writer_double(writer_t *writer, double value)
+{
+  char digits[32], number[48];
+  int length, K, point, n = 0, sign, i;
+
+  uint64_t bits;
+
+  // Checked on the bits, -Ofast assumes finite values
+  memcpy(&bits, &value, sizeof(bits));
+  if ( ( ( bits >> 52 ) & 0x7FF ) == 0x7FF ) {
+    // Not representable in JSON
+    writer_write(writer, "null", 4);
+    return;
+  }
+
+  if ( bits >> 63 ) {
+    number[n++] = '-';
+    value = -value;
+  }
+
+  if ( value == 0.0 ) {
+    number[n++] = '0';
+    writer_write(writer, number, n);
+    return;
+  }
+
+  sign = n;
+  length = grisu_digits(value, digits, &K);
+  point = length + K;   // 10^(point - 1) <= value < 10^point
+
+  if ( K >= 0 && point <= 21 ) {
+    // 1234e3 -> 1234000
+    memcpy(&number[n], digits, length);
+    n += length;
+    while ( n - sign < point )
+      number[n++] = '0';
+  } else if ( point > 0 && point <= 21 ) {
+    // 1234e-2 -> 12.34
+    memcpy(&number[n], digits, point);
+    n += point;
+    number[n++] = '.';
+    memcpy(&number[n], &digits[point], length - point);
+    n += length - point;
+  } else if ( point > -6 && point <= 0 ) {
+    // 1234e-6 -> 0.001234
+    number[n++] = '0';
+    number[n++] = '.';
+    i = point;
+    while ( i < 0 ) {
+      number[n++] = '0';
+      ++i;
+    }
+    memcpy(&number[n], digits, length);
+    n += length;
+  } else {
+    // 1234e30 -> 1.234e33
+    number[n++] = digits[0];
+    if ( length > 1 ) {
+      number[n++] = '.';
+      memcpy(&number[n], &digits[1], length - 1);
+      n += length - 1;
+    }
+    n += snprintf(&number[n], sizeof(number) - n, "e%d", point - 1);
+  }
+
+  writer_write(writer, number, n);
+}
+
+static void writer_base64_group(writer_t *writer, const unsigned char *bytes, int count)
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint32_t group = (uint32_t) bytes[0] << 16;
+  char chars[4];
+
+  if ( count > 1 )
+    group |= (uint32_t) bytes[1] << 8;
+  if ( count > 2 )
+    group |= bytes[2];
+
+  chars[0] = alphabet[( group >> 18 ) & 0x3f];
+  chars[1] = alphabet[( group >> 12 ) & 0x3f];
+  chars[2] = count > 1 ? alphabet[( group >> 6 ) & 0x3f] : '=';
+  chars[3] = count > 2 ? alphabet[group & 0x3f] : '=';
+  writer_write(writer, chars, 4);
+}
+
+void    writer_float32_base64(writer_t *writer, const double *values, size_t count)
+{
+  unsigned char group[3];
+  uint32_t bits;
+  float value;
+  int filled = 0, b;
+  size_t i = 0;
+
+  while ( i < count ) {
+    value = (float) values[i];
+    memcpy(&bits, &value, sizeof(bits));
+
+    // Little endian, as read by a Float32Array on common machines
+    b = 0;
+    while ( b < 4 ) {
+      group[filled++] = ( bits >> ( 8 * b ) ) & 0xff;
+      if ( filled == 3 ) {
+        writer_base64_group(writer, group, 3);
+        filled = 0;
+      }
+      ++b;
+    }
+    ++i;
+  }
+
+  if ( filled > 0 )
+    writer_base64_group(writer, group, filled);
+}
+
+void    vector_write_json(writer_t *writer, const double *V, int L)
+{
+  int l = 0;
+
+  writer_putc(writer, '[');
+  while ( l < L ) {
+    if ( l > 0 )
+      writer_putc(writer, ',');
+    writer_double(writer, V[l]);
+    ++l;
+  }
+  writer_putc(writer, ']');
+}
+
+void    vector_write_matrix_json(writer_t *writer, const double *V, int R, int C)
+{
+  int r = 0;
+
+  writer_putc(writer, '[');
+  while ( r < R ) {
+    if ( r > 0 )
+      writer_putc(writer, ',');
+    vector_write_json(writer, &V[r * C], C);
+    ++r;
+  }
+  writer_putc(writer, ']');
+}
+
+void    vector_write_float32_json(writer_t *writer, const double *V, int R, int C)
+{
+  char shape[64];
+  int length;
+
+  if ( R > 0 )
+    length = snprintf(shape, sizeof(shape), "{\"shape\":[%d,%d],\"float32\":\"", R, C);
+  else
+    length = snprintf(shape, sizeof(shape), "{\"shape\":[%d],\"float32\":\"", C);
+
+  writer_write(writer, shape, length);
+  writer_float32_base64(writer, V, (size_t) ( R > 0 ? R : 1 ) * C);
+  writer_write(writer, "\"}", 2);
+}
@@ -33,6 +33,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
 
 // used on contigous vectors
 //		A = A + B		A,		B,    l
@@ -57,7 +58,6 @@ void 	vectors_multiply(double*, double*, int);
 //		A = A * b		A,		b,    l
 void 	vectors_mutliply_scalar(double*, double, int);
 //		A = random( (R, C) ) / sqrt(R / 2), &A, R, C
-int 	init_random_matrix(double***, int, int);
 //		A = 0.0s, &A, R, C
 int 	init_zero_matrix(double***, int, int);
 int 	free_matrix(double**, int);
@@ -68,14 +68,17 @@ int 	free_vector(double**);
 void 	copy_vector(double*, double*, int);
 double* 	get_zero_vector(int); 
 double** 	get_zero_matrix(int, int);
-double** 	get_random_matrix(int, int);
-double* 	get_random_vector(int,int);
+//						Length, fan in, random state
+double* 	get_random_vector(int, int, uint64_t*);
 
 void 	matrix_set_to_zero(double**, int, int);
 void 	vector_set_to_zero(double*, int);
 
-double sample_normal(void);
-double randn(double, double);
+// Random numbers, the caller keeps the state
+void     random_seed(uint64_t*, unsigned long);
+uint64_t random_next(uint64_t*);
+double   random_uniform(uint64_t*);
+double   randn(uint64_t*, double, double);
 
 double one_norm(double*, int);
 
@@ -95,5 +98,68 @@ void 	vector_store_ascii(double *, int, FILE *);
 // Memory
 void*   e_calloc(size_t count, size_t size);
 size_t  e_alloc_total();
+
+// CRC-32 as in zlib, start with crc = 0 and feed the data in parts
+uint32_t crc32_update(uint32_t crc, const void *data, size_t length);
+
+// Half precision (IEEE 754 binary16), rounded to nearest even
+uint16_t float_to_half(float value);
+float   half_to_float(uint16_t half);
+// bfloat16, the upper 16 bits of a float, rounded to nearest even
+uint16_t float_to_bfloat16(float value);
+float   bfloat16_to_float(uint16_t value);
+
+// Order-0 entropy coding (rANS) of bytes, for data with skewed byte frequencies
+/** Largest size of \p length bytes encoded, data that does not get smaller is kept as it is */
+size_t  entropy_bound(size_t length);
+/** Encode \p length bytes to \p out, which holds \ref entropy_bound bytes, returns the size */
+size_t  entropy_encode(const unsigned char *in, size_t length, unsigned char *out);
+/** Decode \p size bytes to the \p length bytes they were encoded from, returns 0 or -1 if damaged */
+int     entropy_decode(const unsigned char *in, size_t size, unsigned char *out, size_t length);
+
+// System
+int     cpu_count(void);
+/** Seconds on a monotonic clock, only differences between two calls are meaningful */
+double  time_seconds(void);
+
+// Files
+/**
+* Name of a temporary file next to \p path, unique within the process,
+* to be written and then moved over \p path with \ref replace_file.
+* Free it after use.
+*/
+char*   temp_file_name(const char *path);
+/** Rename \p from to \p to, replacing it. On failure \p from is removed and -1 returned. */
+int     replace_file(const char *from, const char *to);
+
+// Buffered output
+#define WRITER_BUFFER_SIZE    4096
+
+/** Buffered writer, collects output and writes it to \p fp in large chunks */
+typedef struct writer_t {
+  FILE *fp;
+  size_t len;
+  char buffer[WRITER_BUFFER_SIZE];
+} writer_t;
+
+void    writer_init(writer_t *, FILE *);
+void    writer_putc(writer_t *, char);
+void    writer_write(writer_t *, const char *, size_t);
+void    writer_flush(writer_t *);
+
+// JSON output
+/** Write a number with the fewest digits that read back as \p value (rarely one more) */
+void    writer_double(writer_t *, double value);
+/** Write values as base64 of little endian 32 bit floats */
+void    writer_float32_base64(writer_t *, const double *values, size_t count);
+/** Write a vector of length L as a JSON array */
+void    vector_write_json(writer_t *, const double *V, int L);
+/** Write a R x C matrix as a JSON array of rows */
+void    vector_write_matrix_json(writer_t *, const double *V, int R, int C);
+/**
+* Write a R x C matrix, or a vector of length C if R is 0, compactly as
+* {"shape": [R, C], "float32": "<base64 of the little endian floats>"}
+*/
+void    vector_write_float32_json(writer_t *, const double *V, int R, int C);
 #endif
 